@@ -0,0 +1,220 @@
+// Microbenchmark of the registry and event paths of usbdetect_core, without
+// V8. Built with `node-gyp rebuild -- -Dusb_detection_bench=1` as
+// build/Release/usbdetect_bench.
+//
+//   usbdetect_bench [devices...]     (default: 100 1000 10000 100000)
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <list>
+#include <string>
+#include <vector>
+#include "detectionCore.h"
+#include "deviceColumns.h"
+
+using namespace std;
+
+/**********************************
+ * Local defines
+ **********************************/
+#define BENCH_VENDOR_ID 0xfffe
+#define BENCH_PRODUCT_ID 0x0001
+// Events dispatched per measurement of the event path
+#define BENCH_EVENTS 100000
+// Vendor ids in the filter crossover registry cycle through this many values,
+// so a vendor filter matches 1 in BENCH_VENDORS devices
+#define BENCH_VENDORS 256
+// Devices visited per filter strategy and registry size; sets the query count
+#define BENCH_FILTER_WORK 4000000
+
+/**********************************
+ * Local Helper Functions
+ **********************************/
+static uint64_t NowNs()
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void BenchKey(size_t index, char *key, size_t size)
+{
+	snprintf(key, size, "bench:%zu", index);
+}
+
+static DeviceItem_t *CreateBenchDevice(size_t index)
+{
+	char serial[32];
+	DeviceItem_t *item = new DeviceItem_t();
+	item->deviceParams.locationId = (int)index;
+	item->deviceParams.vendorId = BENCH_VENDOR_ID;
+	item->deviceParams.productId = BENCH_PRODUCT_ID;
+	item->deviceParams.deviceName = "USB Serial Converter";
+	item->deviceParams.manufacturer = "FTDI";
+	snprintf(serial, sizeof(serial), "BENCH%08zu", index);
+	item->deviceParams.serialNumber = serial;
+	item->deviceParams.deviceAddress = (int)(index % 127) + 1;
+	item->deviceState = DeviceState_Connect;
+	return item;
+}
+
+// What an addon environment does with an event on the monitor thread
+static void CopyingHandler(DeviceEvent_t event, ListResultItem_t *item, void *context)
+{
+	delete CopyElement(item);
+}
+
+static double PerOp(uint64_t ns, size_t ops)
+{
+	return ops ? (double)ns / ops : 0;
+}
+
+static void Measure(size_t count)
+{
+	char key[64];
+
+	uint64_t startedAt = NowNs();
+	for (size_t i = 0; i < count; i++)
+	{
+		BenchKey(i, key, sizeof(key));
+		AddItemToList(key, CreateBenchDevice(i));
+	}
+	uint64_t addNs = NowNs() - startedAt;
+
+	list<ListResultItem_t *> copies;
+	startedAt = NowNs();
+	CreateFilteredList(&copies, BENCH_VENDOR_ID, 0);
+	uint64_t filterNs = NowNs() - startedAt;
+	for (ListResultItem_t *copy : copies)
+	{
+		delete copy;
+	}
+
+	vector<ListResultItem_t> snapshot;
+	startedAt = NowNs();
+	CreateFilteredSnapshot(&snapshot, BENCH_VENDOR_ID, 0);
+	uint64_t snapshotNs = NowNs() - startedAt;
+
+	startedAt = NowNs();
+	for (size_t i = 0; i < count; i++)
+	{
+		BenchKey(i, key, sizeof(key));
+		delete TakeItemFromList(key);
+	}
+	uint64_t removeNs = NowNs() - startedAt;
+
+	printf("| %zu | %.0f | %.0f | %.1f | %.1f |\n", count, PerOp(addNs, count), PerOp(removeNs, count), PerOp(filterNs, count), PerOp(snapshotNs, count));
+}
+
+static double MeasureFilterQueries(size_t queries)
+{
+	vector<ListResultItem_t> snapshot;
+	uint64_t startedAt = NowNs();
+	for (size_t i = 0; i < queries; i++)
+	{
+		snapshot.clear();
+		CreateFilteredSnapshot(&snapshot, BENCH_VENDOR_ID - (int)(i % BENCH_VENDORS), 0);
+	}
+	return PerOp(NowNs() - startedAt, queries);
+}
+
+// Map walk against the id columns under each kernel, for picking
+// DEFAULT_COLUMN_FILTER_THRESHOLD
+static void MeasureFilterCrossover(size_t count)
+{
+	char key[64];
+	for (size_t i = 0; i < count; i++)
+	{
+		DeviceItem_t *item = CreateBenchDevice(i);
+		item->deviceParams.vendorId = BENCH_VENDOR_ID - (int)(i % BENCH_VENDORS);
+		BenchKey(i, key, sizeof(key));
+		AddItemToList(key, item);
+	}
+	size_t queries = BENCH_FILTER_WORK / count + 1;
+
+	printf("| %zu", count);
+	SetColumnFilterThreshold(SIZE_MAX);
+	printf(" | %.0f", MeasureFilterQueries(queries));
+	SetColumnFilterThreshold(0);
+	for (ColumnsKernel_t kernel : {ColumnsKernel_Scalar, ColumnsKernel_SSE2, ColumnsKernel_AVX2})
+	{
+		if (DeviceColumnsSetKernel(kernel))
+		{
+			printf(" | %.0f", MeasureFilterQueries(queries));
+		}
+		else
+		{
+			printf(" | -");
+		}
+	}
+	printf(" |\n");
+	DeviceColumnsSetKernel(ColumnsKernel_Auto);
+	SetColumnFilterThreshold(DEFAULT_COLUMN_FILTER_THRESHOLD);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		BenchKey(i, key, sizeof(key));
+		delete TakeItemFromList(key);
+	}
+}
+
+static void MeasureDispatch(int handlers)
+{
+	vector<int> handlerIds;
+	for (int i = 0; i < handlers; i++)
+	{
+		handlerIds.push_back(AddDeviceEventHandler(CopyingHandler, NULL));
+	}
+
+	DeviceItem_t *item = CreateBenchDevice(0);
+	uint64_t startedAt = NowNs();
+	for (int i = 0; i < BENCH_EVENTS; i++)
+	{
+		DispatchDeviceEvent(i & 1 ? DeviceEvent_Removed : DeviceEvent_Added, &item->deviceParams);
+	}
+	uint64_t dispatchNs = NowNs() - startedAt;
+	delete item;
+
+	for (int handlerId : handlerIds)
+	{
+		RemoveDeviceEventHandler(handlerId);
+	}
+
+	printf("| %d | %.0f |\n", handlers, PerOp(dispatchNs, BENCH_EVENTS));
+}
+
+int main(int argc, char **argv)
+{
+	vector<size_t> sizes;
+	for (int i = 1; i < argc; i++)
+	{
+		sizes.push_back(strtoul(argv[i], NULL, 10));
+	}
+	if (sizes.empty())
+	{
+		sizes = {100, 1000, 10000, 100000};
+	}
+
+	printf("| devices | add ns/dev | remove ns/dev | filter ns/dev | snapshot ns/dev |\n");
+	printf("| --- | --- | --- | --- | --- |\n");
+	for (size_t count : sizes)
+	{
+		Measure(count);
+	}
+
+	printf("\n| handlers | dispatch ns/event |\n");
+	printf("| --- | --- |\n");
+	for (int handlers : {1, 4, 16})
+	{
+		MeasureDispatch(handlers);
+	}
+
+	printf("\n| devices | map ns/query | scalar ns/query | sse2 ns/query | avx2 ns/query |\n");
+	printf("| --- | --- | --- | --- | --- |\n");
+	for (size_t count : {16, 64, 256, 1024, 4096, 16384, 65536})
+	{
+		MeasureFilterCrossover(count);
+	}
+
+	return 0;
+}
@@ -0,0 +1,191 @@
+// Scaling harness for the native device registry.
+//
+// Fills the registry with N synthetic devices through the real
+// `AddItemToList` path and measures, for each N:
+//  - add/remove cost per device
+//  - native heap per device
+//  - `find()` latency through the threadpool (filter + copy + marshal)
+//  - `CreateFilteredList` alone, and marshalling alone (a cached `findSync()`)
+//
+// Needs an addon built with the bench hooks:
+//
+//   node-gyp rebuild -- -Dusb_detection_bench=1
+//   node --expose-gc bench/registry-scaling.js [--sizes 10,100,1000] [--json report.json]
+
+var fs = require('fs');
+var detection = require('bindings')('detection.node');
+
+// Outside the range of any real vendor, so the filtered queries only see
+// synthetic devices
+var BENCH_VENDOR_ID = 0xfffe;
+var BENCH_PRODUCT_ID = 0x0001;
+
+var DEFAULT_SIZES = [10, 100, 1000, 10000, 100000];
+
+function parseArgs(argv) {
+	var options = { sizes: DEFAULT_SIZES, json: null };
+	for(var i = 0; i < argv.length; i++) {
+		if(argv[i] === '--sizes') {
+			options.sizes = argv[++i].split(',').map(Number);
+		} else if(argv[i] === '--json') {
+			options.json = argv[++i];
+		}
+	}
+	return options;
+}
+
+function now() {
+	return Number(process.hrtime.bigint());
+}
+
+function median(values) {
+	var sorted = values.slice().sort(function(a, b) { return a - b; });
+	return sorted[Math.floor(sorted.length / 2)];
+}
+
+function collectGarbage() {
+	if(global.gc) {
+		global.gc();
+	}
+}
+
+// Falls back to RSS where the allocator has no usage counter
+function nativeHeapBytes() {
+	var bytes = detection.bench.heapBytes();
+	return bytes >= 0 ? bytes : process.memoryUsage().rss;
+}
+
+function findAsync(vid, pid) {
+	return new Promise(function(resolve, reject) {
+		var startedAt = now();
+		detection.find(vid, pid, function(err, devices) {
+			if(err) {
+				reject(err);
+				return;
+			}
+			resolve({ ns: now() - startedAt, count: devices.length });
+		});
+	});
+}
+
+// Enough repetitions for a stable median without spending minutes at 100k
+function iterationsFor(size) {
+	return Math.max(5, Math.min(200, Math.floor(200000 / size)));
+}
+
+function measure(size) {
+	var iterations = iterationsFor(size);
+	var result = { devices: size, iterations: iterations };
+
+	collectGarbage();
+	var heapBefore = nativeHeapBytes();
+	var addNs = detection.bench.populate(size, BENCH_VENDOR_ID, BENCH_PRODUCT_ID);
+	result.heapBytesPerDevice = (nativeHeapBytes() - heapBefore) / size;
+	result.addNsPerDevice = addNs / size;
+
+	var filterNs = [];
+	for(var i = 0; i < iterations; i++) {
+		filterNs.push(detection.bench.filter(BENCH_VENDOR_ID, 0).ns);
+	}
+	result.filterNs = median(filterNs);
+
+	// The first call fills the cache; the rest only marshal
+	detection.findSync(BENCH_VENDOR_ID, 0);
+	var marshalNs = [];
+	var jsHeapBytes = 0;
+	for(var j = 0; j < iterations; j++) {
+		collectGarbage();
+		var heapUsed = process.memoryUsage().heapUsed;
+		var startedAt = now();
+		var devices = detection.findSync(BENCH_VENDOR_ID, 0);
+		marshalNs.push(now() - startedAt);
+		jsHeapBytes = process.memoryUsage().heapUsed - heapUsed;
+		if(devices.length !== size) {
+			throw new Error('Expected ' + size + ' devices, found ' + devices.length);
+		}
+	}
+	result.marshalNs = median(marshalNs);
+	result.marshalNsPerDevice = result.marshalNs / size;
+	result.jsHeapBytesPerDevice = global.gc ? jsHeapBytes / size : null;
+
+	var findNs = [];
+	var sequence = Promise.resolve();
+	for(var k = 0; k < iterations; k++) {
+		sequence = sequence.then(function() {
+			return findAsync(BENCH_VENDOR_ID, BENCH_PRODUCT_ID).then(function(timing) {
+				findNs.push(timing.ns);
+			});
+		});
+	}
+
+	return sequence.then(function() {
+		result.findNs = median(findNs);
+
+		var removeNs = detection.bench.depopulate();
+		result.removeNsPerDevice = removeNs / size;
+		return result;
+	});
+}
+
+function formatRow(cells) {
+	return '| ' + cells.join(' | ') + ' |';
+}
+
+function printReport(results) {
+	var header = ['devices', 'add ns/dev', 'remove ns/dev', 'heap B/dev', 'JS B/dev', 'filter us', 'marshal us', 'find us'];
+	console.log(formatRow(header));
+	console.log(formatRow(header.map(function() { return '---'; })));
+	results.forEach(function(result) {
+		console.log(formatRow([
+			result.devices,
+			result.addNsPerDevice.toFixed(0),
+			result.removeNsPerDevice.toFixed(0),
+			result.heapBytesPerDevice.toFixed(0),
+			result.jsHeapBytesPerDevice === null ? '-' : result.jsHeapBytesPerDevice.toFixed(0),
+			(result.filterNs / 1000).toFixed(1),
+			(result.marshalNs / 1000).toFixed(1),
+			(result.findNs / 1000).toFixed(1)
+		]));
+	});
+}
+
+function main() {
+	if(!detection.bench) {
+		console.error('The addon was built without the bench hooks. Rebuild with `node-gyp rebuild -- -Dusb_detection_bench=1`.');
+		process.exit(1);
+	}
+
+	var options = parseArgs(process.argv.slice(2));
+	if(!global.gc) {
+		console.error('Run with `node --expose-gc` to measure the JS heap per device.');
+	}
+
+	// Get the real enumeration out of the way first
+	detection.findSync(0, 0);
+
+	var results = [];
+	options.sizes.reduce(function(sequence, size) {
+		return sequence.then(function() {
+			return measure(size).then(function(result) {
+				results.push(result);
+			});
+		});
+	}, Promise.resolve())
+		.then(function() {
+			printReport(results);
+			if(options.json) {
+				fs.writeFileSync(options.json, JSON.stringify({
+					node: process.version,
+					platform: process.platform,
+					arch: process.arch,
+					results: results
+				}, null, 2));
+			}
+		})
+		.catch(function(err) {
+			console.error(err);
+			process.exit(1);
+		});
+}
+
+main();
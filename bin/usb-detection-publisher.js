@@ -0,0 +1,20 @@
+#!/usr/bin/env node
+// Owns the USB monitor and publishes the device list in shared memory for
+// processes that call `useSharedRegistry()` (Linux only).
+//
+//   usb-detection-publisher [name]
+
+var usbDetect = require('..');
+
+usbDetect.publishRegistry(process.argv[2]);
+
+// The native monitor does not keep the event loop alive by itself
+var keepAlive = setInterval(function() {}, 1 << 30);
+
+function stop() {
+	clearInterval(keepAlive);
+	usbDetect.stopPublishingRegistry();
+}
+
+process.on('SIGINT', stop);
+process.on('SIGTERM', stop);
@@ -1,58 +1,104 @@
 {
+    "variables": {
+        "usb_detection_trace%": 0,
+        "usb_detection_debug_log%": 0,
+        "usb_detection_bench%": 0
+    },
+    "target_defaults": {
+        "cflags_cc": ["-fexceptions"],
+        "conditions": [
+            [
+                "usb_detection_trace==1",
+                {
+                    "defines": ["USB_DETECTION_TRACE=1"]
+                }
+            ],
+            [
+                "usb_detection_debug_log==1",
+                {
+                    "defines": ["USB_DETECTION_DEBUG_LOG=1"]
+                }
+            ],
+            [
+                "OS=='win'",
+                {
+                    "defines": [
+                        "_HAS_EXCEPTIONS=1"
+                    ],
+                    "msvs_settings": {
+                        "VCCLCompilerTool": {
+                            "ExceptionHandling": 1,
+                            "RuntimeTypeInfo": "true"
+                        }
+                    }
+                }
+            ],
+            [
+                "OS=='mac'",
+                {
+                    "default_configuration": "Debug",
+                    "configurations": {
+                        "Debug": {
+                            "defines": ["DEBUG", "_DEBUG"]
+                        },
+                        "Release": {
+                            "defines": ["NDEBUG"]
+                        }
+                    },
+                    "cflags": ["-fvisibility=default"],
+                    "xcode_settings": {
+                        "MACOSX_DEPLOYMENT_TARGET": "14.0",
+                        "GCC_ENABLE_CPP_EXCEPTIONS": "YES",
+                        "CLANG_CXX_LIBRARY": "libc++"
+                    }
+                }
+            ]
+        ]
+    },
     "targets": [
         {
-            "target_name": "detection",
+            "target_name": "usbdetect_core",
+            "type": "static_library",
             "sources": [
-                "src/detection.cpp",
-                "src/detection.h",
-                "src/deviceList.cpp"
+                "src/detectionCore.cpp",
+                "src/detectionCore.h",
+                "src/deviceColumns.cpp",
+                "src/deviceList.cpp",
+                "src/deviceCache.cpp",
+                "src/deviceEvents.cpp",
+                "src/deviceRecord.cpp",
+                "src/eventHub.cpp",
+                "src/handleIndex.cpp",
+                "src/inotifyMonitor.cpp",
+                "src/memoryUsage.cpp",
+                "src/metrics.cpp",
+                "src/nameDatabase.cpp",
+                "src/nodeIndex.cpp",
+                "src/sharedRegistry.cpp",
+                "src/threadPolicy.cpp",
+                "src/trace.cpp",
+                "src/topology.cpp",
+                "src/usbDescriptors.cpp"
             ],
-            "defines": [
-                "NODE_ADDON_API_CPP_EXCEPTIONS=1",
-                "NAPI_VERSION=8"
-            ],
-            "include_dirs": [
-                "<!@(node -p \"require('node-addon-api').include\")"
-            ],
-            "cflags_cc": ["-fexceptions"],
+            "direct_dependent_settings": {
+                "include_dirs": ["src"]
+            },
             "conditions": [
                 [
                     "OS=='win'",
                     {
-                        "sources": ["src/detection_win.cpp"],
-                        "defines": [
-                            "_HAS_EXCEPTIONS=1"
-                        ],
-                        "msvs_settings": {
-                            "VCCLCompilerTool": {
-                                "ExceptionHandling": 1,
-                                "RuntimeTypeInfo": "true"
-                            }
-                        }
+                        "sources": ["src/detection_win.cpp"]
                     }
                 ],
                 [
                     "OS=='mac'",
                     {
                         "sources": ["src/detection_mac.cpp"],
-                        "libraries": [
-                        "-Wl,-framework,IOKit",
-                        "-Wl,-framework,CoreFoundation"
-                        ],
-                        "default_configuration": "Debug",
-                        "configurations": {
-                            "Debug": {
-                                "defines": ["DEBUG", "_DEBUG"]
-                            },
-                            "Release": {
-                                "defines": ["NDEBUG"]
-                            }
-                        },
-                        "cflags": ["-fvisibility=default"],
-                        "xcode_settings": {
-                            "MACOSX_DEPLOYMENT_TARGET": "14.0",
-                            "GCC_ENABLE_CPP_EXCEPTIONS": "YES",
-                            "CLANG_CXX_LIBRARY": "libc++"
+                        "link_settings": {
+                            "libraries": [
+                            "-Wl,-framework,IOKit",
+                            "-Wl,-framework,CoreFoundation"
+                            ]
                         }
                     }
                 ],
@@ -60,12 +106,52 @@
                     "OS=='linux'",
                     {
                         "sources": ["src/detection_linux.cpp"],
+                        "cflags": ["-fPIC"],
                         "link_settings": {
-                            "libraries": ["-ludev"]
+                            "libraries": ["-ludev", "-lrt", "-pthread"]
                         }
                     }
                 ]
             ]
+        },
+        {
+            "target_name": "detection",
+            "dependencies": ["usbdetect_core"],
+            "sources": [
+                "src/detection.cpp",
+                "src/detection.h"
+            ],
+            "defines": [
+                "NODE_ADDON_API_CPP_EXCEPTIONS=1",
+                "NAPI_VERSION=8"
+            ],
+            "include_dirs": [
+                "<!@(node -p \"require('node-addon-api').include\")"
+            ],
+            "conditions": [
+                [
+                    "usb_detection_bench==1",
+                    {
+                        "sources": ["src/benchHooks.cpp"],
+                        "defines": ["USB_DETECTION_BENCH=1"]
+                    }
+                ]
+            ]
         }
+    ],
+    "conditions": [
+        [
+            "usb_detection_bench==1",
+            {
+                "targets": [
+                    {
+                        "target_name": "usbdetect_bench",
+                        "type": "executable",
+                        "dependencies": ["usbdetect_core"],
+                        "sources": ["bench/coreBench.cpp"]
+                    }
+                ]
+            }
+        ]
     ]
 }
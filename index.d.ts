@@ -11,17 +11,174 @@ export interface Device {
     manufacturer: string;
     serialNumber: string;
     deviceAddress: number;
+    handle: number;
+    path?: string;
+    driver?: string;
+    speed?: number;
+    deviceClass?: number;
+    bcdDevice?: number;
+    portPath?: string;
+    nodes?: string[];
 }
 
+export interface TopologyNode {
+    portPath: string;
+    device: Device | null;
+    children: TopologyNode[];
+}
+
+export interface DeviceEvent {
+    type: 'add' | 'remove' | 'change';
+    device: Device;
+    // For 'change': a mask of `fieldBits`
+    changedFields?: number;
+}
+
+export interface FieldBits {
+    deviceName: number;
+    manufacturer: number;
+    path: number;
+    driver: number;
+    speed: number;
+    deviceClass: number;
+    bcdDevice: number;
+    portPath: number;
+    nodes: number;
+}
+
+export const fieldBits: FieldBits;
+
+export interface EventsOptions {
+    filter?: { vendorId?: number; productId?: number };
+    highWaterMark?: number;
+}
+
+export interface DeviceEventIterator extends AsyncIterableIterator<DeviceEvent> {
+    dropped: number;
+}
+
+export interface MonitorOptions {
+    cpus?: number[] | null;
+    nice?: number | null;
+    priority?: number | null;
+}
+
+export interface Stats {
+    monitoring: boolean;
+    monitorThread: {
+        cpus: number[];
+        nice: number | null;
+        priority: number | null;
+        error: string | null;
+    };
+    dispatchLatency: {
+        count: number;
+        meanUs: number;
+        maxUs: number;
+        lastUs: number;
+    };
+}
+
+export interface MemoryUsageCategory {
+    count: number;
+    bytes: number;
+}
+
+export interface MemoryUsage {
+    registry: MemoryUsageCategory;
+    strings: MemoryUsageCategory;
+    events: MemoryUsageCategory;
+    batons: MemoryUsageCategory;
+    findCache: MemoryUsageCategory;
+    names: MemoryUsageCategory;
+    totalBytes: number;
+}
+
+export interface TraceEntry {
+    timeUs: number;
+    name: string;
+    arg1: number;
+    arg2: number;
+}
+
+export interface ReconcileResult {
+    added: Device[];
+    removed: Device[];
+    // With `changedFields` set
+    changed: Device[];
+}
+
+export interface DeviceQuery {
+    vendorId?: number;
+    productId?: number;
+    serialNumber?: string;
+}
+
+export interface FindQuery {
+    vendorId?: number;
+    productId?: number;
+    interfaceClass?: number;
+    interfaceSubclass?: number;
+    protocol?: number;
+}
+
+export type DeviceField = 'path' | 'driver' | 'speed' | 'deviceClass' | 'bcdDevice' | 'portPath' | 'nodes';
+
 export function find(vid: number, pid: number, callback: (error: any, devices: Device[]) => any): void;
 export function find(vid: number, pid: number): Promise<Device[]>;
+export function find(query: FindQuery, callback: (error: any, devices: Device[]) => any): void;
+export function find(query: FindQuery): Promise<Device[]>;
 export function find(vid: number, callback: (error: any, devices: Device[]) => any): void;
 export function find(vid: number): Promise<Device[]>;
 export function find(callback: (error: any, devices: Device[]) => any): void;
 export function find(): Promise<Device[]>;
 
+export function findSync(vid?: number, pid?: number): Device[];
+export function findSync(query: FindQuery): Device[];
+
+export function publishRegistry(name?: string): void;
+export function stopPublishingRegistry(): void;
+export function useSharedRegistry(name?: string): void;
+
+export function useInotifyMonitor(options?: { sysfsRoot?: string; devRoot?: string }): void;
+
+export function startEventHub(path?: string): void;
+export function stopEventHub(): void;
+export function useEventHub(path?: string, filter?: { vendorId?: number; productId?: number }): void;
+
+export function waitFor(query: DeviceQuery, timeoutMs?: number): Promise<Device>;
+
+export function findUnder(portPath: string, callback: (error: any, devices: Device[]) => any): void;
+export function findUnder(portPath: string): Promise<Device[]>;
+
+export function findByNode(path: string, callback: (error: any, device: Device | null) => any): void;
+export function findByNode(path: string): Promise<Device | null>;
+
+export function getDevice(handle: number): Device | null;
+
+export function getTopology(callback: (error: any, roots: TopologyNode[]) => any): void;
+export function getTopology(): Promise<TopologyNode[]>;
+
+export function reconcile(callback: (error: any, changes: ReconcileResult) => any): void;
+export function reconcile(): Promise<ReconcileResult>;
+export function setReconcileInterval(ms: number): void;
+
+export function ready(): Promise<void>;
+export function setCacheFile(path: string): void;
+export function setExtraFields(fields: DeviceField[]): void;
+export function setResolveNames(enabled: boolean): void;
+
+export function events(options?: EventsOptions): DeviceEventIterator;
+
 export function startMonitoring(): void;
 export function stopMonitoring(): void;
-export function on(event: string, callback: (device: Device) => void): void;
+export function setMonitorOptions(options: MonitorOptions): void;
+export function getStats(): Stats;
+export function getTrace(): TraceEntry[];
+export function getMetrics(): string;
+export function getMemoryUsage(): MemoryUsage;
+export function pause(): void;
+export function resume(): void;
+export function on(event: string, callback: (device: Device, changedFields?: number) => void): void;
 
 export const version: number;
@@ -3,6 +3,9 @@
 
 var index = require('./package.json');
 
+// `global` is per realm, so this pins one instance per main thread/worker.
+// The native side keeps a single shared monitor and fans events out to each.
+
 function isFunction(functionToCheck) {
 	return typeof functionToCheck === 'function';
 }
@@ -19,6 +22,15 @@ if(global[index.name] && global[index.name].version === index.version) {
 		maxListeners: 1000 // default would be 10!
 	});
 
+	// find(vid, pid) or find({ vendorId, productId, interfaceClass,
+	// interfaceSubclass, protocol }) as the native finders' arguments
+	function findArgs(vid, pid) {
+		if(vid !== null && typeof vid === 'object') {
+			return [vid.vendorId || 0, vid.productId || 0, vid.interfaceClass, vid.interfaceSubclass, vid.protocol];
+		}
+		return [vid || 0, pid || 0];
+	}
+
 	//detector.find = detection.find;
 	detector.find = function(vid, pid, callback) {
 		// Suss out the optional parameters
@@ -30,16 +42,26 @@ if(global[index.name] && global[index.name].version === index.version) {
 			pid = undefined;
 		}
 
-		return new Promise(function(resolve, reject) {
-			// Assemble the optional args into something we can use with `apply`
-			var args = [];
-			if(vid) {
-				args = args.concat(vid);
-			}
-			if(pid) {
-				args = args.concat(pid);
+		// Once the device list is ready, answer from the native per-query
+		// cache without a trip through the threadpool. If the shared device
+		// list can't be read, the threadpool path reports why.
+		var args = findArgs(vid, pid);
+		var cached;
+		try {
+			cached = detection.findCached.apply(detection, args);
+		} catch(err) {
+			cached = undefined;
+		}
+		if(cached) {
+			if(callback) {
+				process.nextTick(function() {
+					callback.call(callback, null, cached);
+				});
 			}
+			return Promise.resolve(cached);
+		}
 
+		return new Promise(function(resolve, reject) {
 			// Tack on our own callback that takes care of things
 			args = args.concat(function(err, devices) {
 
@@ -61,6 +83,208 @@ if(global[index.name] && global[index.name].version === index.version) {
 		});
 	};
 
+	// Blocks on the initial enumeration if `ready`/`find` have not already done it
+	detector.findSync = function(vid, pid) {
+		return detection.findSync.apply(detection, findArgs(vid, pid));
+	};
+
+	// Keep a host-wide copy of the device list in shared memory for other
+	// processes to read with `useSharedRegistry` (Linux only)
+	detector.publishRegistry = function(name) {
+		detection.publishRegistry(name);
+	};
+
+	detector.stopPublishingRegistry = function() {
+		detection.stopPublishingRegistry();
+	};
+
+	// Serve `find` and device events from a publisher's shared device list
+	// instead of this process's own monitor. Call before `startMonitoring`.
+	detector.useSharedRegistry = function(name) {
+		detection.useSharedRegistry(name);
+	};
+
+	// Broadcast device events to other local processes over a Unix domain
+	// socket, for them to receive with `useEventHub` (not on Windows)
+	detector.startEventHub = function(path) {
+		detection.startEventHub(path);
+	};
+
+	detector.stopEventHub = function() {
+		detection.stopEventHub();
+	};
+
+	// Take device events from an event hub instead of this process's own
+	// monitor, optionally only for `{ vendorId, productId }`. Call before
+	// `startMonitoring`.
+	detector.useEventHub = function(path, filter) {
+		filter = filter || {};
+		detection.useEventHub(path, filter.vendorId || 0, filter.productId || 0);
+	};
+
+	// Watch /dev/bus/usb with inotify instead of listening for udev events,
+	// for containers where those never arrive (Linux only). `sysfsRoot` and
+	// `devRoot` default to '/sys' and '/dev'. Must be called before the first
+	// `ready`/`find`/`startMonitoring`.
+	detector.useInotifyMonitor = function(options) {
+		options = options || {};
+		detection.useInotifyMonitor(options.sysfsRoot, options.devRoot);
+	};
+
+	if(process.env.USB_DETECTION_MONITOR === 'inotify') {
+		detector.useInotifyMonitor({
+			sysfsRoot: process.env.USB_DETECTION_SYSFS_ROOT,
+			devRoot: process.env.USB_DETECTION_DEV_ROOT
+		});
+	}
+
+	// Persist the registry between runs so warm starts can answer `find`
+	// immediately. Must be set before the first `ready`/`find`/`startMonitoring`.
+	detector.setCacheFile = function(path) {
+		detection.setCacheFile(path);
+	};
+
+	if(process.env.USB_DETECTION_CACHE_FILE) {
+		detector.setCacheFile(process.env.USB_DETECTION_CACHE_FILE);
+	}
+
+	// Devices attached at or below a hub port, e.g. '2-1.4' (Linux only)
+	detector.findUnder = function(portPath, callback) {
+		return new Promise(function(resolve, reject) {
+			detection.findUnder(portPath, function(err, devices) {
+				if(callback) {
+					callback.call(callback, err, devices);
+				}
+
+				if(err) {
+					reject(err);
+					return;
+				}
+				resolve(devices);
+			});
+		});
+	};
+
+	// The device a tty/hidraw/block/input/sg node such as '/dev/ttyACM0'
+	// belongs to, or null (Linux only)
+	detector.findByNode = function(path, callback) {
+		return new Promise(function(resolve, reject) {
+			detection.findByNode(path, function(err, devices) {
+				var device = devices && devices.length > 0 ? devices[0] : null;
+				if(callback) {
+					callback.call(callback, err, device);
+				}
+
+				if(err) {
+					reject(err);
+					return;
+				}
+				resolve(device);
+			});
+		});
+	};
+
+	// The connected device with a `handle` from an earlier result or event, or null
+	detector.getDevice = function(handle) {
+		return detection.getDevice(handle);
+	};
+
+	// The bus/hub tree as nested `{ portPath, device, children }` nodes (Linux only)
+	detector.getTopology = function(callback) {
+		return new Promise(function(resolve, reject) {
+			detection.getTopology(function(err, roots) {
+				if(callback) {
+					callback.call(callback, err, roots);
+				}
+
+				if(err) {
+					reject(err);
+					return;
+				}
+				resolve(roots);
+			});
+		});
+	};
+
+	// Resolve with the first device matching `{ vendorId, productId, serialNumber }`,
+	// whether it is already attached or attached later. Rejects after
+	// `timeoutMs` (no timeout if omitted). Non-matching devices never reach JS.
+	detector.waitFor = function(query, timeoutMs) {
+		return detection.waitFor(query || {}, timeoutMs || 0);
+	};
+
+	// Rescan, apply the difference to the registry and emit add/remove/change
+	// events for it. Resolves with `{ added, removed, changed }` (Linux only).
+	detector.reconcile = function(callback) {
+		return new Promise(function(resolve, reject) {
+			detection.reconcile(function(err, changes) {
+				if(callback) {
+					callback.call(callback, err, changes);
+				}
+
+				if(err) {
+					reject(err);
+					return;
+				}
+				resolve(changes);
+			});
+		});
+	};
+
+	var reconcileTimer = null;
+
+	// Run `reconcile` every `ms` milliseconds; 0 turns it off. The timer does
+	// not keep the process alive.
+	detector.setReconcileInterval = function(ms) {
+		if(reconcileTimer) {
+			clearInterval(reconcileTimer);
+			reconcileTimer = null;
+		}
+
+		if(ms > 0) {
+			reconcileTimer = setInterval(function() {
+				detector.reconcile().catch(function(err) {
+					detector.emit('error', err);
+				});
+			}, ms);
+			reconcileTimer.unref();
+		}
+	};
+
+	// Opt into extra device fields: 'path', 'driver', 'speed', 'deviceClass', 'bcdDevice', 'portPath' (Linux only).
+	// Applies to devices enumerated or attached afterwards.
+	detector.setExtraFields = function(fields) {
+		detection.setExtraFields(fields);
+	};
+
+	// Fill in `manufacturer`/`deviceName` from the hwdb's usb.ids names for
+	// devices that have no string descriptors (Linux only). Applies to devices
+	// enumerated or attached afterwards.
+	detector.setResolveNames = function(enabled) {
+		detection.setResolveNames(!!enabled);
+	};
+
+	if(process.env.USB_DETECTION_RESOLVE_NAMES) {
+		detector.setResolveNames(true);
+	}
+
+	var readyPromise = null;
+
+	// Build the initial device list on a background thread. `find` calls made
+	// before it completes simply wait for it off the JS thread.
+	detector.ready = function() {
+		if(!readyPromise) {
+			readyPromise = detection.ready();
+		}
+
+		return readyPromise;
+	};
+
+	// Opt-in: start warming up as soon as the module is required
+	if(process.env.USB_DETECTION_BACKGROUND_INIT) {
+		detector.ready();
+	}
+
 	detection.registerAdded(function(device) {
 		detector.emit('add:' + device.vendorId + ':' + device.productId, device);
 		detector.emit('insert:' + device.vendorId + ':' + device.productId, device);
@@ -84,8 +308,96 @@ if(global[index.name] && global[index.name].version === index.version) {
 		detector.emit('change', device);
 	});
 
+	// A known device's details changed (a driver was bound or unbound, or an
+	// attribute changed). `changedFields` is a mask of `fieldBits`.
+	detection.registerChanged(function(device, changedFields) {
+		detector.emit('change:' + device.vendorId + ':' + device.productId, device, changedFields);
+		detector.emit('change:' + device.vendorId, device, changedFields);
+		detector.emit('change', device, changedFields);
+	});
+
+	// `changedFields & usbDetect.fieldBits.driver` etc.
+	detector.fieldBits = detection.fieldBits;
+
+	// Pull-based alternative to the events above: an async iterable of
+	// `{ type: 'add' | 'remove' | 'change', device, changedFields }`. Native memory is bounded by
+	// `highWaterMark`; past it, events for the same device are coalesced and
+	// otherwise the oldest are dropped (counted in `iterator.dropped`).
+	// Monitoring runs while the iterator is open.
+	detector.events = function(options) {
+		options = options || {};
+
+		var buffered = [];
+		var waiting = [];
+		var closed = false;
+
+		var iterator = {
+			dropped: 0,
+
+			next: function() {
+				if(buffered.length) {
+					return Promise.resolve({ value: buffered.shift(), done: false });
+				}
+				if(closed) {
+					return Promise.resolve({ value: undefined, done: true });
+				}
+
+				return new Promise(function(resolve) {
+					waiting.push(resolve);
+					// Only ask for more once everything delivered has been consumed
+					detection.requestEvents(queueId);
+				});
+			},
+
+			return: function() {
+				if(!closed) {
+					closed = true;
+					buffered = [];
+					detection.closeEventQueue(queueId);
+					waiting.splice(0).forEach(function(resolve) {
+						resolve({ value: undefined, done: true });
+					});
+				}
+
+				return Promise.resolve({ value: undefined, done: true });
+			}
+		};
+
+		iterator[Symbol.asyncIterator] = function() {
+			return iterator;
+		};
+
+		var queueId = detection.openEventQueue({
+			vendorId: options.filter && options.filter.vendorId,
+			productId: options.filter && options.filter.productId,
+			highWaterMark: options.highWaterMark
+		}, function(events, dropped) {
+			if(closed) {
+				return;
+			}
+
+			iterator.dropped += dropped;
+			buffered = buffered.concat(events);
+			while(waiting.length && buffered.length) {
+				waiting.shift()({ value: buffered.shift(), done: false });
+			}
+			if(waiting.length) {
+				detection.requestEvents(queueId);
+			}
+		});
+
+		return iterator;
+	};
+
 	var started = false;
 
+	// On Linux, Ctrl + c or a SIGTERM stops monitoring so that the process
+	// can wind down and exit on its own
+	var stopOnSignals = process.platform === 'linux';
+	function onTerminate() {
+		detector.stopMonitoring();
+	}
+
 	detector.startMonitoring = function() {
 		if(started) {
 			return;
@@ -93,6 +405,10 @@ if(global[index.name] && global[index.name].version === index.version) {
 
 		started = true;
 		detection.startMonitoring();
+		if(stopOnSignals) {
+			process.on('SIGINT', onTerminate);
+			process.on('SIGTERM', onTerminate);
+		}
 	};
 
 	detector.stopMonitoring = function() {
@@ -102,6 +418,48 @@ if(global[index.name] && global[index.name].version === index.version) {
 
 		started = false;
 		detection.stopMonitoring();
+		if(stopOnSignals) {
+			process.removeListener('SIGINT', onTerminate);
+			process.removeListener('SIGTERM', onTerminate);
+		}
+	};
+
+	// Pin the native monitor thread and set its scheduling, e.g.
+	// `{ cpus: [0], nice: -5 }` or `{ priority: 50 }` for SCHED_FIFO.
+	// A running monitor is restarted to apply them.
+	detector.setMonitorOptions = function(options) {
+		detection.setMonitorOptions(options || {});
+	};
+
+	// Monitor thread settings (and any error applying them) plus the
+	// latency from the monitor thread to the `add`/`remove` callbacks
+	detector.getStats = function() {
+		return detection.getStats();
+	};
+
+	// Native health counters in the Prometheus text exposition format
+	detector.getMetrics = function() {
+		return detection.getMetrics();
+	};
+
+	// Live native objects and bytes per category
+	detector.getMemoryUsage = function() {
+		return detection.getMemoryUsage();
+	};
+
+	// Recent native trace events; empty unless built with `-Dusb_detection_trace=1`
+	detector.getTrace = function() {
+		return detection.getTrace();
+	};
+
+	// Hold back add/remove events without stopping the monitor; only the
+	// latest event per device is kept until `resume`
+	detector.pause = function() {
+		detection.pause();
+	};
+
+	detector.resume = function() {
+		detection.resume();
 	};
 
 	detector.version = index.version;
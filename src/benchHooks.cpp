@@ -0,0 +1,153 @@
+#include <chrono>
+#include <list>
+#include <stdio.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#include "benchHooks.h"
+#include "deviceList.h"
+
+using namespace std;
+
+/**********************************
+ * Local defines
+ **********************************/
+#define BENCH_KEY_PREFIX "bench:"
+// Synthetic devices hang off their own bus so they never collide with real ones
+#define BENCH_BUS 99
+// Ports per synthetic hub
+#define BENCH_HUB_PORTS 7
+
+/**********************************
+ * Local Variables
+ **********************************/
+static size_t benchDevices = 0;
+
+/**********************************
+ * Local Helper Functions
+ **********************************/
+static uint64_t NowNs()
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void BenchKey(size_t index, char *key, size_t size)
+{
+	snprintf(key, size, BENCH_KEY_PREFIX "%zu", index);
+}
+
+// Spreads devices over a tree of 7-port hubs, "99-1", "99-1.2", ... so the
+// topology index sees a realistic fan-out
+static string BenchPortPath(size_t index)
+{
+	string path = to_string(BENCH_BUS) + "-" + to_string(index % BENCH_HUB_PORTS + 1);
+	for (index /= BENCH_HUB_PORTS; index > 0; index /= BENCH_HUB_PORTS)
+	{
+		path += "." + to_string(index % BENCH_HUB_PORTS + 1);
+	}
+	return path;
+}
+
+/**********************************
+ * Public Functions
+ **********************************/
+// populate(count, vendorId, productId) -> nanoseconds spent in AddItemToList
+static Napi::Value Populate(const Napi::CallbackInfo &info)
+{
+	size_t count = info[0].As<Napi::Number>().Uint32Value();
+	int vendorId = info[1].As<Napi::Number>().Int32Value();
+	int productId = info[2].As<Napi::Number>().Int32Value();
+	char key[64];
+	char serial[32];
+	uint64_t spent = 0;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		size_t index = benchDevices + i;
+		DeviceItem_t *item = new DeviceItem_t();
+		item->deviceParams.locationId = (int)index;
+		item->deviceParams.vendorId = vendorId;
+		item->deviceParams.productId = productId;
+		item->deviceParams.deviceName = "USB Serial Converter";
+		item->deviceParams.manufacturer = "FTDI";
+		snprintf(serial, sizeof(serial), "BENCH%08zu", index);
+		item->deviceParams.serialNumber = serial;
+		item->deviceParams.deviceAddress = (int)(index % 127) + 1;
+		item->deviceParams.extraFields[DeviceField_PortPath] = BenchPortPath(index);
+		item->deviceParams.extraFieldMask = DEVICE_FIELD_BIT(DeviceField_PortPath);
+		item->deviceState = DeviceState_Connect;
+		BenchKey(index, key, sizeof(key));
+
+		uint64_t startedAt = NowNs();
+		AddItemToList(key, item);
+		spent += NowNs() - startedAt;
+	}
+	benchDevices += count;
+
+	return Napi::Number::New(info.Env(), (double)spent);
+}
+
+// depopulate() -> nanoseconds spent in TakeItemFromList and freeing the items
+static Napi::Value Depopulate(const Napi::CallbackInfo &info)
+{
+	char key[64];
+	uint64_t spent = 0;
+
+	for (size_t i = 0; i < benchDevices; i++)
+	{
+		BenchKey(i, key, sizeof(key));
+
+		uint64_t startedAt = NowNs();
+		delete TakeItemFromList(key);
+		spent += NowNs() - startedAt;
+	}
+	benchDevices = 0;
+
+	return Napi::Number::New(info.Env(), (double)spent);
+}
+
+// filter(vendorId, productId) -> { ns, count } for one CreateFilteredList,
+// i.e. the threadpool half of find() without the scheduling
+static Napi::Value Filter(const Napi::CallbackInfo &info)
+{
+	int vendorId = info[0].As<Napi::Number>().Int32Value();
+	int productId = info[1].As<Napi::Number>().Int32Value();
+	list<ListResultItem_t *> results;
+
+	uint64_t startedAt = NowNs();
+	CreateFilteredList(&results, vendorId, productId);
+	uint64_t spent = NowNs() - startedAt;
+
+	size_t count = results.size();
+	for (list<ListResultItem_t *>::iterator it = results.begin(); it != results.end(); ++it)
+	{
+		delete *it;
+	}
+
+	Napi::Object result = Napi::Object::New(info.Env());
+	result.Set("ns", Napi::Number::New(info.Env(), (double)spent));
+	result.Set("count", Napi::Number::New(info.Env(), (double)count));
+	return result;
+}
+
+// heapBytes() -> bytes currently allocated from the C heap, or -1 where the
+// allocator cannot tell us (the harness then falls back to RSS)
+static Napi::Value HeapBytes(const Napi::CallbackInfo &info)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	struct mallinfo2 usage = mallinfo2();
+	return Napi::Number::New(info.Env(), (double)usage.uordblks);
+#else
+	return Napi::Number::New(info.Env(), -1);
+#endif
+}
+
+void InitBenchHooks(Napi::Env env, Napi::Object exports)
+{
+	Napi::Object bench = Napi::Object::New(env);
+	bench.Set("populate", Napi::Function::New(env, Populate));
+	bench.Set("depopulate", Napi::Function::New(env, Depopulate));
+	bench.Set("filter", Napi::Function::New(env, Filter));
+	bench.Set("heapBytes", Napi::Function::New(env, HeapBytes));
+	exports.Set("bench", bench);
+}
@@ -0,0 +1,14 @@
+#ifndef _BENCH_HOOKS_H
+#define _BENCH_HOOKS_H
+
+#include <napi.h>
+
+// Native hooks for bench/registry-scaling.js, exported as `bench` when built
+// with USB_DETECTION_BENCH (`node-gyp rebuild -- -Dusb_detection_bench=1`).
+// They fill the registry with synthetic devices through the same
+// AddItemToList path the platform backends use, and time the registry
+// operations that cannot be isolated from JS.
+
+void InitBenchHooks(Napi::Env env, Napi::Object exports);
+
+#endif
@@ -1,4 +1,19 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
 #include "detection.h"
+#include "benchHooks.h"
+#include "deviceCache.h"
+#include "deviceEvents.h"
+#include "nameDatabase.h"
+#include "threadPolicy.h"
+#include "topology.h"
+#include "usbDescriptors.h"
 #define OBJECT_ITEM_LOCATION_ID "locationId"
 #define OBJECT_ITEM_VENDOR_ID "vendorId"
 #define OBJECT_ITEM_PRODUCT_ID "productId"
@@ -6,107 +21,855 @@
 #define OBJECT_ITEM_MANUFACTURER "manufacturer"
 #define OBJECT_ITEM_SERIAL_NUMBER "serialNumber"
 #define OBJECT_ITEM_DEVICE_ADDRESS "deviceAddress"
+#define OBJECT_ITEM_HANDLE "handle"
 
-Napi::ThreadSafeFunction addedTsFunc;
-Napi::ThreadSafeFunction removedTsFunc;
+#define EVENT_QUEUE_DEFAULT_HIGH_WATER_MARK 64
 
-static std::atomic<bool> isInitialized{false};
+// Distinct (vid, pid) queries kept by the find() cache before it is reset
+#define FIND_CACHE_MAX_QUERIES 64
+
+// extraFieldNames base of a newline-separated list
+#define FIELD_LIST -1
+
+// Smallest change in native memory worth reporting to V8
+#define EXTERNAL_MEMORY_GRANULARITY (64 * 1024)
+
+// Optional fields, in DeviceField_t order. Numeric ones are parsed from the
+// raw string with `base`; a base of 0 means the value is passed through, and
+// FIELD_LIST a newline-separated list passed as an array.
+static const struct {
+    const char* name;
+    int base;
+} extraFieldNames[DeviceField_Count] = {
+    { "path", 0 },
+    { "driver", 0 },
+    { "speed", 10 },
+    { "deviceClass", 16 },
+    { "bcdDevice", 16 },
+    { "portPath", 0 },
+    { "nodes", FIELD_LIST },
+};
+
+// Time from the monitor thread handing an event to an environment until its
+// JS callback runs, across all environments
+static std::atomic<uint64_t> dispatchCount{0};
+static std::atomic<uint64_t> dispatchTotalNs{0};
+static std::atomic<uint64_t> dispatchMaxNs{0};
+static std::atomic<uint64_t> dispatchLastNs{0};
+
+// An event on its way to an environment's add/remove callback
+struct PostedEvent {
+    ListResultItem_t* item;
+    // 0 if the delay was deliberate (pause) and should not be measured
+    uint64_t postedAt;
+};
+
+// find() results per (vid, pid, interface query), valid while the registry generation is
+// unchanged. Shared by all environments; each call marshals its own objects,
+// so callers are free to modify what they get back.
+typedef std::shared_ptr<const std::vector<ListResultItem_t>> FindResult_t;
+struct FindCacheEntry {
+    uint64_t generation;
+    FindResult_t devices;
+    // What the entry adds to MemoryCategory_FindCache
+    int64_t bytes;
+};
+static std::mutex findCacheMutex;
+static std::map<std::tuple<int, int, uint32_t>, FindCacheEntry> findCache;
+
+// ReadyBaton struct for the background warm-up started by `ready()`
+struct ReadyBaton {
+    Napi::Promise::Deferred deferred;
+    napi_async_work work;
+    std::string error;
+
+    ReadyBaton(Napi::Env env) : deferred(Napi::Promise::Deferred::New(env)), work(nullptr) {}
+};
+
+// Copy the optional fields that are both populated on `it` and in `fieldMask`
+static void SetExtraFieldValues(Napi::Env env, Napi::Object& item, const ListResultItem_t* it, unsigned int fieldMask) {
+    unsigned int mask = it->extraFieldMask & fieldMask;
+    if (mask == 0) {
+        return;
+    }
+
+    for (int field = 0; field < DeviceField_Count; field++) {
+        if (!(mask & DEVICE_FIELD_BIT(field))) {
+            continue;
+        }
+
+        const std::string& value = it->extraFields[field];
+        if (extraFieldNames[field].base == FIELD_LIST) {
+            Napi::Array values = Napi::Array::New(env);
+            size_t start = 0;
+            while (start < value.size()) {
+                size_t end = value.find('\n', start);
+                if (end == std::string::npos) {
+                    end = value.size();
+                }
+                values[values.Length()] = Napi::String::New(env, value.substr(start, end - start));
+                start = end + 1;
+            }
+            item.Set(extraFieldNames[field].name, values);
+        } else if (extraFieldNames[field].base == 0) {
+            item.Set(extraFieldNames[field].name, Napi::String::New(env, value));
+        } else if (extraFieldNames[field].base == 10) {
+            item.Set(extraFieldNames[field].name, Napi::Number::New(env, strtod(value.c_str(), NULL)));
+        } else {
+            item.Set(extraFieldNames[field].name, Napi::Number::New(env, strtol(value.c_str(), NULL, extraFieldNames[field].base)));
+        }
+    }
+}
+
+static Napi::Object CreateDeviceObject(Napi::Env env, const ListResultItem_t* it, unsigned int fieldMask) {
+    Napi::Object item = Napi::Object::New(env);
+    item.Set(OBJECT_ITEM_LOCATION_ID, it->locationId);
+    item.Set(OBJECT_ITEM_VENDOR_ID, it->vendorId);
+    item.Set(OBJECT_ITEM_PRODUCT_ID, it->productId);
+    item.Set(OBJECT_ITEM_DEVICE_NAME, Napi::String::New(env, it->deviceName));
+    item.Set(OBJECT_ITEM_MANUFACTURER, Napi::String::New(env, it->manufacturer));
+    item.Set(OBJECT_ITEM_SERIAL_NUMBER, Napi::String::New(env, it->serialNumber));
+    item.Set(OBJECT_ITEM_DEVICE_ADDRESS, it->deviceAddress);
+    // Handles are counted up from 1, far below 2^53
+    item.Set(OBJECT_ITEM_HANDLE, Napi::Number::New(env, (double)it->handle));
+    SetExtraFieldValues(env, item, it, fieldMask);
+
+    return item;
+}
+
+// Select which optional fields are read for devices enumerated or attached from now on
+void SetExtraFields(const Napi::CallbackInfo& info) {
+    if (info.Length() < 1 || !info[0].IsArray()) {
+        throw Napi::Error::New(info.Env(), "An array of field names needs to be passed in.");
+    }
+
+    Napi::Array names = info[0].As<Napi::Array>();
+    unsigned int mask = 0;
+    for (uint32_t i = 0; i < names.Length(); i++) {
+        std::string name = names.Get(i).ToString().Utf8Value();
+        int field = 0;
+        while (field < DeviceField_Count && name != extraFieldNames[field].name) {
+            field++;
+        }
+        if (field == DeviceField_Count) {
+            throw Napi::Error::New(info.Env(), "Unknown device field: " + name);
+        }
+        mask |= DEVICE_FIELD_BIT(field);
+    }
+
+    SetExtraFieldMask(mask);
+}
+
+// Fill in missing vendor/product names from the hwdb for devices enumerated
+// or attached from now on
+void SetResolveNames(const Napi::CallbackInfo& info) {
+    if (info.Length() < 1 || !info[0].IsBoolean()) {
+        throw Napi::Error::New(info.Env(), "A boolean needs to be passed in.");
+    }
+    SetNameResolution(info[0].As<Napi::Boolean>().Value());
+}
+
+static AddonData* GetAddonData(Napi::Env env) {
+    return env.GetInstanceData<AddonData>();
+}
 
 // Register added callback
 void RegisterAdded(const Napi::CallbackInfo &info)
 {
-    printf("RegisterAdded\n");
+    TRACE_EVENT(register_added, 0, 0);
     if (info.Length() < 1 || !info[0].IsFunction())
     {
         throw Napi::Error::New(info.Env(), "A function parameter needs to be passed in.");
     }
-    addedTsFunc = Napi::ThreadSafeFunction::New(info.Env(), info[0].As<Napi::Function>(), "AddedCallback", 0, 1);
+    AddonData* data = GetAddonData(info.Env());
+    // The monitor thread posts to the TSFNs under pauseMutex
+    std::lock_guard<std::mutex> lock(data->pauseMutex);
+    if (data->addedTsFunc) data->addedTsFunc.Release();
+    data->addedTsFunc = Napi::ThreadSafeFunction::New(info.Env(), info[0].As<Napi::Function>(), "AddedCallback", 0, 1);
+    // Only keep the process alive while monitoring
+    if (!data->isMonitoring) data->addedTsFunc.Unref(info.Env());
 }
 
 // Register removed callback
 void RegisterRemoved(const Napi::CallbackInfo &info)
 {
-    printf("RegisterRemoved\n");
+    TRACE_EVENT(register_removed, 0, 0);
     if (info.Length() < 1 || !info[0].IsFunction())
     {
         throw Napi::Error::New(info.Env(), "A function parameter needs to be passed in.");
     }
-    removedTsFunc = Napi::ThreadSafeFunction::New(info.Env(), info[0].As<Napi::Function>(), "RemovedCallback", 0, 1);
+    AddonData* data = GetAddonData(info.Env());
+    std::lock_guard<std::mutex> lock(data->pauseMutex);
+    if (data->removedTsFunc) data->removedTsFunc.Release();
+    data->removedTsFunc = Napi::ThreadSafeFunction::New(info.Env(), info[0].As<Napi::Function>(), "RemovedCallback", 0, 1);
+    if (!data->isMonitoring) data->removedTsFunc.Unref(info.Env());
 }
 
-// Notify JS callback for added device
-void NotifyAdded(ListResultItem_t* it) {
-    if (!it || !addedTsFunc) return;
+// Register changed callback, called with (device, changedFields)
+void RegisterChanged(const Napi::CallbackInfo &info)
+{
+    if (info.Length() < 1 || !info[0].IsFunction())
+    {
+        throw Napi::Error::New(info.Env(), "A function parameter needs to be passed in.");
+    }
+    AddonData* data = GetAddonData(info.Env());
+    std::lock_guard<std::mutex> lock(data->pauseMutex);
+    if (data->changedTsFunc) data->changedTsFunc.Release();
+    data->changedTsFunc = Napi::ThreadSafeFunction::New(info.Env(), info[0].As<Napi::Function>(), "ChangedCallback", 0, 1);
+    if (!data->isMonitoring) data->changedTsFunc.Unref(info.Env());
+}
 
-    addedTsFunc.BlockingCall(it, [](Napi::Env env, Napi::Function jsCallback, ListResultItem_t* it) {
-        if (!it) return;
+// { deviceName, manufacturer, path, driver, ... }: the bit of each field in
+// the `changedFields` mask of change events
+static Napi::Object CreateFieldBits(Napi::Env env) {
+    Napi::Object bits = Napi::Object::New(env);
+    bits.Set("deviceName", Napi::Number::New(env, DEVICE_CHANGED_DEVICE_NAME));
+    bits.Set("manufacturer", Napi::Number::New(env, DEVICE_CHANGED_MANUFACTURER));
+    for (int field = 0; field < DeviceField_Count; field++) {
+        bits.Set(extraFieldNames[field].name, Napi::Number::New(env, DEVICE_FIELD_BIT(field)));
+    }
+    return bits;
+}
 
-        Napi::Object item = Napi::Object::New(env);
-        item.Set(OBJECT_ITEM_LOCATION_ID, it->locationId);
-        item.Set(OBJECT_ITEM_VENDOR_ID, it->vendorId);
-        item.Set(OBJECT_ITEM_PRODUCT_ID, it->productId);
-        item.Set(OBJECT_ITEM_DEVICE_NAME, Napi::String::New(env, it->deviceName));
-        item.Set(OBJECT_ITEM_MANUFACTURER, Napi::String::New(env, it->manufacturer));
-        item.Set(OBJECT_ITEM_SERIAL_NUMBER, Napi::String::New(env, it->serialNumber));
-        item.Set(OBJECT_ITEM_DEVICE_ADDRESS, it->deviceAddress);
+static uint64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void RecordDispatchLatency(uint64_t latencyNs) {
+    dispatchCount++;
+    dispatchTotalNs += latencyNs;
+    dispatchLastNs = latencyNs;
 
+    uint64_t max = dispatchMaxNs.load();
+    while (latencyNs > max && !dispatchMaxNs.compare_exchange_weak(max, latencyNs)) {
+    }
+}
+
+// Events posted to a callback but not yet delivered, for the memory accounting
+static void AccountPostedEvents(int64_t count) {
+    MemoryAccount(MemoryCategory_Events, count, count * (int64_t)(sizeof(PostedEvent) + sizeof(ListResultItem_t)));
+}
+
+// Bring what this environment's V8 heap knows about our native memory up to
+// date, once it has moved by more than the granularity (or always, if forced).
+// The registry is shared, so every environment counts it.
+static void SyncExternalMemory(Napi::Env env, bool force) {
+    AddonData* data = GetAddonData(env);
+    int64_t delta = MemoryGetTotalBytes() - data->externalMemory;
+    if (delta == 0 || (!force && delta < EXTERNAL_MEMORY_GRANULARITY && delta > -EXTERNAL_MEMORY_GRANULARITY)) {
+        return;
+    }
+    Napi::MemoryManagement::AdjustExternalMemory(env, delta);
+    data->externalMemory += delta;
+}
+
+static void CallDeviceCallback(Napi::Env env, Napi::Function jsCallback, PostedEvent* posted) {
+    if (posted->postedAt) {
+        RecordDispatchLatency(NowNs() - posted->postedAt);
+    }
+    Napi::Object item = CreateDeviceObject(env, posted->item, GetExtraFieldMask());
+    unsigned int changedFields = posted->item->changedFieldMask;
+    delete posted->item;
+    delete posted;
+    AccountPostedEvents(-1);
+    METRICS_INCREMENT(Metric_EventsDelivered);
+    SyncExternalMemory(env, false);
+
+    if (changedFields != 0) {
+        jsCallback.Call({ item, Napi::Number::New(env, changedFields) });
+    } else {
         jsCallback.Call({ item });
-    });
+    }
+}
+
+// Fold an event into the newest pending one for the same device, so that
+// only its latest state is reported. Returns false if there is none, or if
+// it belongs to another connection (handle) of the device: whoever holds the
+// old handle still needs to see it removed, so both are kept in order.
+static bool CoalesceEvent(std::deque<QueuedEvent>& events, DeviceEvent_t event, ListResultItem_t* item) {
+    for (auto it = events.rbegin(); it != events.rend(); ++it) {
+        if (!IsSameDevice(it->item, item)) {
+            continue;
+        }
+        if (it->item->handle != item->handle) {
+            return false;
+        }
+
+        unsigned int changedFields = it->item->changedFieldMask;
+        delete it->item;
+        METRICS_INCREMENT(Metric_EventsCoalesced);
+        if (it->event == DeviceEvent_Added && event == DeviceEvent_Removed) {
+            // It came and went before anyone looked; report neither
+            events.erase(std::next(it).base());
+            AccountQueuedEvents(-1);
+        } else if (event == DeviceEvent_Removed) {
+            it->event = event;
+            it->item = CopyElement(item);
+        } else if (it->event == DeviceEvent_Removed) {
+            // Back under the same handle, so it never went away for anyone
+            it->event = DeviceEvent_Changed;
+            it->item = CopyElement(item);
+        } else {
+            // An add or change that is still pending picks up the new details
+            it->item = CopyElement(item);
+            if (it->event == DeviceEvent_Changed) {
+                it->item->changedFieldMask |= changedFields;
+            } else {
+                it->item->changedFieldMask = 0;
+            }
+        }
+        return true;
+    }
+
+    return false;
 }
 
-// Notify JS callback for removed device
-void NotifyRemoved(ListResultItem_t* it) {
-    if (!it || !removedTsFunc) return; // Check if 'it' or 'removedTsFunc' is null
+static Napi::ThreadSafeFunction& EventCallback(AddonData* data, DeviceEvent_t event) {
+    switch (event) {
+        case DeviceEvent_Added:
+            return data->addedTsFunc;
+        case DeviceEvent_Removed:
+            return data->removedTsFunc;
+        default:
+            return data->changedTsFunc;
+    }
+}
 
-    // Using N-API's ThreadSafeFunction
-    removedTsFunc.BlockingCall(it, [](Napi::Env env, Napi::Function jsCallback, ListResultItem_t* it) {
-        // Create a new Napi::Object to store item data
-        Napi::Object item = Napi::Object::New(env);
+static const char* EventTypeName(DeviceEvent_t event) {
+    switch (event) {
+        case DeviceEvent_Added:
+            return "add";
+        case DeviceEvent_Removed:
+            return "remove";
+        default:
+            return "change";
+    }
+}
 
-        // Set properties of the item object
-        item.Set(OBJECT_ITEM_LOCATION_ID, it->locationId);
-        item.Set(OBJECT_ITEM_VENDOR_ID, it->vendorId);
-        item.Set(OBJECT_ITEM_PRODUCT_ID, it->productId);
-        item.Set(OBJECT_ITEM_DEVICE_NAME, Napi::String::New(env, it->deviceName));
-        item.Set(OBJECT_ITEM_MANUFACTURER, Napi::String::New(env, it->manufacturer));
-        item.Set(OBJECT_ITEM_SERIAL_NUMBER, Napi::String::New(env, it->serialNumber));
-        item.Set(OBJECT_ITEM_DEVICE_ADDRESS, it->deviceAddress);
+// Hand `copy` to this environment's add/remove/change callback, which takes ownership
+static void PostDeviceEvent(AddonData* data, DeviceEvent_t event, ListResultItem_t* copy, uint64_t postedAt) {
+    Napi::ThreadSafeFunction& tsFunc = EventCallback(data, event);
+    PostedEvent* posted = new PostedEvent{copy, postedAt};
+    AccountPostedEvents(1);
+    if (!tsFunc || tsFunc.BlockingCall(posted, CallDeviceCallback) != napi_ok) {
+        delete copy;
+        delete posted;
+        AccountPostedEvents(-1);
+        METRICS_INCREMENT(Metric_EventsDropped);
+    }
+}
+
+// Per-environment subscriber on the shared monitor. Runs on the monitor
+// thread, so it only copies the item and queues it to this environment.
+static void HandleDeviceEvent(DeviceEvent_t event, ListResultItem_t* item, void* context) {
+    AddonData* data = static_cast<AddonData*>(context);
+
+    std::lock_guard<std::mutex> lock(data->pauseMutex);
+    if (data->isPaused) {
+        if (!CoalesceEvent(data->pausedEvents, event, item)) {
+            data->pausedEvents.push_back({event, CopyElement(item)});
+            AccountQueuedEvents(1);
+        }
+        return;
+    }
 
-        jsCallback.Call({item});
+    PostDeviceEvent(data, event, CopyElement(item), NowNs());
+}
 
-        delete it;
-    });
+// Hold back add/remove callbacks without stopping the monitor
+void Pause(const Napi::CallbackInfo& info) {
+    AddonData* data = GetAddonData(info.Env());
+    std::lock_guard<std::mutex> lock(data->pauseMutex);
+    data->isPaused = true;
+}
 
+// Deliver what was held back (one event per device at most), then carry on as normal
+void Resume(const Napi::CallbackInfo& info) {
+    AddonData* data = GetAddonData(info.Env());
+    std::lock_guard<std::mutex> lock(data->pauseMutex);
+    data->isPaused = false;
+    AccountQueuedEvents(-(int64_t)data->pausedEvents.size());
+    for (auto& queued : data->pausedEvents) {
+        PostDeviceEvent(data, queued.event, queued.item, 0);
+    }
+    data->pausedEvents.clear();
 }
 
-void LazyInit() {
-    if (!isInitialized.exchange(true)) {
-        printf("[DEBUG] Lazy InitDetection\n");
-        InitDetection();
+// Monitor thread CPU affinity and scheduling: setMonitorOptions({ cpus, nice, priority }).
+// The options are applied by the monitor thread as it starts, so a running
+// monitor is restarted to pick them up.
+void SetMonitorOptions(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsObject()) {
+        throw Napi::Error::New(env, "An options object needs to be passed in.");
+    }
+
+    Napi::Object options = info[0].As<Napi::Object>();
+    MonitorThreadOptions_t threadOptions = GetMonitorThreadOptions();
+    if (options.Has("cpus")) {
+        threadOptions.cpus.clear();
+        Napi::Value cpus = options.Get("cpus");
+        if (cpus.IsArray()) {
+            Napi::Array cpuArray = cpus.As<Napi::Array>();
+            for (uint32_t i = 0; i < cpuArray.Length(); i++) {
+                int cpu = cpuArray.Get(i).ToNumber().Int32Value();
+                if (cpu < 0) {
+                    throw Napi::Error::New(env, "CPU numbers must not be negative.");
+                }
+                threadOptions.cpus.push_back(cpu);
+            }
+        } else if (!cpus.IsNull() && !cpus.IsUndefined()) {
+            throw Napi::Error::New(env, "cpus must be an array of CPU numbers.");
+        }
     }
+    if (options.Has("nice")) {
+        Napi::Value nice = options.Get("nice");
+        threadOptions.setNice = nice.IsNumber();
+        threadOptions.nice = threadOptions.setNice ? nice.As<Napi::Number>().Int32Value() : 0;
+        if (threadOptions.nice < -20 || threadOptions.nice > 19) {
+            throw Napi::Error::New(env, "nice must be between -20 and 19.");
+        }
+    }
+    if (options.Has("priority")) {
+        Napi::Value priority = options.Get("priority");
+        threadOptions.fifoPriority = priority.IsNumber() ? priority.As<Napi::Number>().Int32Value() : 0;
+        if (threadOptions.fifoPriority < 0 || threadOptions.fifoPriority > 99) {
+            throw Napi::Error::New(env, "priority must be between 0 and 99.");
+        }
+    }
+
+    SetMonitorThreadOptions(threadOptions);
+    RestartMonitor();
 }
 
-void Find(const Napi::CallbackInfo& info) {
+// Monitor thread state and dispatch latency (in microseconds)
+Napi::Value GetStats(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
+    Napi::Object stats = Napi::Object::New(env);
+
+    stats.Set("monitoring", IsMonitorRunning());
+
+    MonitorThreadOptions_t threadOptions = GetMonitorThreadOptions();
+    Napi::Object monitorThread = Napi::Object::New(env);
+    Napi::Array cpus = Napi::Array::New(env, threadOptions.cpus.size());
+    for (size_t i = 0; i < threadOptions.cpus.size(); i++) {
+        cpus[i] = threadOptions.cpus[i];
+    }
+    monitorThread.Set("cpus", cpus);
+    monitorThread.Set("nice", threadOptions.setNice ? Napi::Number::New(env, threadOptions.nice) : env.Null());
+    monitorThread.Set("priority", threadOptions.fifoPriority ? Napi::Number::New(env, threadOptions.fifoPriority) : env.Null());
+    std::string error = GetMonitorThreadError();
+    monitorThread.Set("error", error.empty() ? env.Null() : Napi::String::New(env, error));
+    stats.Set("monitorThread", monitorThread);
+
+    uint64_t count = dispatchCount.load();
+    Napi::Object latency = Napi::Object::New(env);
+    latency.Set("count", Napi::Number::New(env, (double)count));
+    latency.Set("meanUs", Napi::Number::New(env, count ? dispatchTotalNs.load() / 1000.0 / count : 0));
+    latency.Set("maxUs", Napi::Number::New(env, dispatchMaxNs.load() / 1000.0));
+    latency.Set("lastUs", Napi::Number::New(env, dispatchLastNs.load() / 1000.0));
+    stats.Set("dispatchLatency", latency);
+
+    return stats;
+}
+
+// Prometheus text exposition of the native counters; cheap enough to scrape often
+Napi::Value GetMetrics(const Napi::CallbackInfo& info) {
+    std::string text;
+    MetricsFormat(&text);
+    return Napi::String::New(info.Env(), text);
+}
+
+// Live native objects and bytes per category:
+// { registry: { count, bytes }, strings, events, batons, findCache, names, totalBytes }.
+// Also brings the figure reported to V8 up to date.
+Napi::Value GetMemoryUsage(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::Object result = Napi::Object::New(env);
+
+    for (int i = 0; i < MemoryCategory_Count; i++) {
+        MemoryCategory_t category = (MemoryCategory_t)i;
+        int64_t count;
+        int64_t bytes;
+        MemoryGetUsage(category, &count, &bytes);
+
+        Napi::Object usage = Napi::Object::New(env);
+        usage.Set("count", Napi::Number::New(env, (double)count));
+        usage.Set("bytes", Napi::Number::New(env, (double)bytes));
+        result.Set(MemoryCategoryName(category), usage);
+    }
+    result.Set("totalBytes", Napi::Number::New(env, (double)MemoryGetTotalBytes()));
+
+    SyncExternalMemory(env, true);
+    return result;
+}
+
+// Contents of the trace ring, oldest first: [{ timeUs, name, arg1, arg2 }].
+// Always empty unless built with USB_DETECTION_TRACE.
+Napi::Value GetTrace(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    std::vector<TraceEntry_t> entries;
+    TraceSnapshot(&entries);
+
+    Napi::Array result = Napi::Array::New(env, entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+        Napi::Object entry = Napi::Object::New(env);
+        entry.Set("timeUs", Napi::Number::New(env, entries[i].timestampNs / 1000.0));
+        entry.Set("name", Napi::String::New(env, entries[i].name));
+        entry.Set("arg1", Napi::Number::New(env, (double)entries[i].arg1));
+        entry.Set("arg2", Napi::Number::New(env, (double)entries[i].arg2));
+        result[i] = entry;
+    }
+
+    return result;
+}
+
+static void Unsubscribe(AddonData* data) {
+    RemoveDeviceEventHandler(data->handlerId);
+    data->handlerId = 0;
+    data->isMonitoring = false;
+    ReleaseMonitor();
+}
+
+// Runs if the environment (e.g. a worker thread) goes away while monitoring.
+// It is registered after the TSFNs, so it runs before they are torn down.
+static void CleanupMonitoring(void* arg) {
+    Unsubscribe(static_cast<AddonData*>(arg));
+}
+
+static void EIO_Ready(napi_env env, void* data) {
+    ReadyBaton* baton = static_cast<ReadyBaton*>(data);
+    if (SharedRegistryIsOpen()) {
+        SharedRegistryWaitReady(&baton->error);
+        return;
+    }
     LazyInit();
-    printf("Find\n");
+}
+
+static void EIO_AfterReady(napi_env env, napi_status status, void* data) {
+    ReadyBaton* baton = static_cast<ReadyBaton*>(data);
+    Napi::HandleScope scope(env);
+
+    if (!baton->error.empty()) {
+        baton->deferred.Reject(Napi::Error::New(env, baton->error).Value());
+    } else {
+        baton->deferred.Resolve(Napi::Env(env).Undefined());
+    }
+
+    napi_delete_async_work(env, baton->work);
+    delete baton;
+}
+
+// Kick off the initial enumeration on the threadpool and return a promise that
+// resolves once the device list is available. In reader mode it waits for the
+// publisher's instead, and rejects if the publisher is gone.
+Napi::Value Ready(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    ReadyBaton* baton = new ReadyBaton(env);
+    Napi::Promise promise = baton->deferred.Promise();
+
+    if (SharedRegistryIsOpen() ? SharedRegistryIsReady() : IsInitialized()) {
+        baton->deferred.Resolve(env.Undefined());
+        delete baton;
+        return promise;
+    }
+
+    napi_value resource_name;
+    napi_create_string_utf8(env, "USBDetection:Ready", NAPI_AUTO_LENGTH, &resource_name);
+
+    napi_create_async_work(
+        env,
+        nullptr,
+        resource_name,
+        EIO_Ready,
+        EIO_AfterReady,
+        baton,
+        &baton->work
+    );
+
+    napi_queue_async_work(env, baton->work);
+
+    return promise;
+}
+
+static std::string SharedRegistryName(const Napi::CallbackInfo& info) {
+    if (info.Length() > 0 && info[0].IsString()) {
+        return info[0].As<Napi::String>().Utf8Value();
+    }
+    return SHARED_REGISTRY_DEFAULT_NAME;
+}
+
+// The publisher holds the monitor, which must not outlive the environment
+static void CleanupSharedRegistry(void* arg) {
+    SharedRegistryStopPublishing();
+}
+
+// publishRegistry(name): own the monitor and keep a host-wide copy of the
+// device list in shared memory for readers (Linux only)
+void PublishRegistry(const Napi::CallbackInfo& info) {
+    std::string error;
+    if (!SharedRegistryPublish(SharedRegistryName(info).c_str(), &error)) {
+        throw Napi::Error::New(info.Env(), error);
+    }
+    napi_add_env_cleanup_hook(info.Env(), CleanupSharedRegistry, nullptr);
+}
+
+void StopPublishingRegistry(const Napi::CallbackInfo& info) {
+    napi_remove_env_cleanup_hook(info.Env(), CleanupSharedRegistry, nullptr);
+    SharedRegistryStopPublishing();
+}
+
+// useSharedRegistry(name): serve find() and device events from a publisher's
+// shared device list instead of this process's own monitor (Linux only)
+void UseSharedRegistry(const Napi::CallbackInfo& info) {
+    std::string error;
+    if (!SharedRegistryOpen(SharedRegistryName(info).c_str(), &error)) {
+        throw Napi::Error::New(info.Env(), error);
+    }
+}
+
+static std::string EventHubPath(const Napi::CallbackInfo& info) {
+    if (info.Length() > 0 && info[0].IsString()) {
+        return info[0].As<Napi::String>().Utf8Value();
+    }
+    std::string path;
+    std::string error;
+    if (!EventHubDefaultPath(&path, &error)) {
+        throw Napi::Error::New(info.Env(), error);
+    }
+    return path;
+}
+
+// The hub thread must not outlive the environment that started it
+static void CleanupEventHub(void* arg) {
+    EventHubClose();
+}
+
+// startEventHub(path): own the monitor and broadcast its events to local
+// subscribers on a Unix domain socket (not on Windows)
+void StartEventHub(const Napi::CallbackInfo& info) {
+    std::string error;
+    if (!EventHubListen(EventHubPath(info).c_str(), &error)) {
+        throw Napi::Error::New(info.Env(), error);
+    }
+    napi_add_env_cleanup_hook(info.Env(), CleanupEventHub, nullptr);
+}
+
+void StopEventHub(const Napi::CallbackInfo& info) {
+    napi_remove_env_cleanup_hook(info.Env(), CleanupEventHub, nullptr);
+    EventHubClose();
+}
+
+// useEventHub(path, vid, pid): take device events from a hub instead of this
+// process's own monitor, optionally only for one vendor/product
+void UseEventHub(const Napi::CallbackInfo& info) {
+    int vid = 0;
+    int pid = 0;
+    if (info.Length() > 1 && info[1].IsNumber()) {
+        vid = info[1].As<Napi::Number>().Int32Value();
+    }
+    if (info.Length() > 2 && info[2].IsNumber()) {
+        pid = info[2].As<Napi::Number>().Int32Value();
+    }
+
+    std::string error;
+    if (!EventHubConnect(EventHubPath(info).c_str(), vid, pid, &error)) {
+        throw Napi::Error::New(info.Env(), error);
+    }
+}
+
+// useInotifyMonitor(sysfsRoot, devRoot): watch usbfs with inotify instead of
+// listening for udev events (Linux only). Must be called before the device
+// list is built.
+void UseInotifyMonitor(const Napi::CallbackInfo& info) {
+    std::string sysfsRoot;
+    std::string devRoot;
+    if (info.Length() > 0 && info[0].IsString()) {
+        sysfsRoot = info[0].As<Napi::String>().Utf8Value();
+    }
+    if (info.Length() > 1 && info[1].IsString()) {
+        devRoot = info[1].As<Napi::String>().Utf8Value();
+    }
+
+    std::string error;
+    if (!InotifyMonitorEnable(sysfsRoot.empty() ? NULL : sysfsRoot.c_str(), devRoot.empty() ? NULL : devRoot.c_str(), &error)) {
+        throw Napi::Error::New(info.Env(), error);
+    }
+}
+
+// Enable the on-disk registry snapshot. Only takes effect for loading if it
+// is called before the initial enumeration has started.
+void SetCacheFile(const Napi::CallbackInfo& info) {
+    if (info.Length() < 1 || !info[0].IsString()) {
+        throw Napi::Error::New(info.Env(), "A cache file path needs to be passed in.");
+    }
+    SetDeviceCachePath(info[0].As<Napi::String>().Utf8Value().c_str());
+}
+
+// The devices matching a query, from the per-query cache if the device list has
+// not changed since. Returns null and sets `error` if the shared device list
+// could not be read.
+static FindResult_t GetFindResult(int vid, int pid, uint32_t interfaceQuery, std::string* error) {
+    std::tuple<int, int, uint32_t> query(vid, pid, interfaceQuery);
+    uint64_t generation = GetDevicesGeneration();
+    {
+        std::lock_guard<std::mutex> lock(findCacheMutex);
+        auto it = findCache.find(query);
+        if (it != findCache.end() && it->second.generation == generation) {
+            return it->second.devices;
+        }
+    }
+
+    auto devices = std::make_shared<std::vector<ListResultItem_t>>();
+    if (!SnapshotDevices(vid, pid, devices.get(), &generation, interfaceQuery)) {
+        if (SharedRegistryIsAbandoned()) {
+            *error = "The publisher of the shared device list has exited";
+        } else {
+            *error = "Couldn't take a consistent copy of the shared device list";
+        }
+        return nullptr;
+    }
+
+    int64_t bytes = sizeof(FindCacheEntry) + devices->capacity() * sizeof(ListResultItem_t);
+    for (const ListResultItem_t& device : *devices) {
+        int64_t stringCount;
+        int64_t stringBytes;
+        DeviceStringUsage(&device, &stringCount, &stringBytes);
+        bytes += stringBytes;
+    }
+
+    std::lock_guard<std::mutex> lock(findCacheMutex);
+    if (findCache.size() >= FIND_CACHE_MAX_QUERIES) {
+        for (auto& entry : findCache) {
+            MemoryAccount(MemoryCategory_FindCache, -1, -entry.second.bytes);
+        }
+        findCache.clear();
+    }
+    auto it = findCache.find(query);
+    if (it != findCache.end()) {
+        MemoryAccount(MemoryCategory_FindCache, -1, -it->second.bytes);
+    }
+    findCache[query] = {generation, devices, bytes};
+    MemoryAccount(MemoryCategory_FindCache, 1, bytes);
+    return devices;
+}
+
+// Find work item: waits for the initial enumeration (if it is still running
+// in the background), then copies out the matching devices. In reader mode it
+// copies them from the shared device list instead, once the publisher has
+// published its initial one.
+static void EIO_Find(napi_env env, void* data) {
+    ListBaton* baton = static_cast<ListBaton*>(data);
+    try {
+        if (SharedRegistryIsOpen()) {
+            std::string error;
+            FindResult_t devices;
+            if (!SharedRegistryWaitReady(&error) ||
+                !(devices = GetFindResult(baton->vid, baton->pid, baton->interfaceQuery, &error))) {
+                strncpy(baton->errorString, error.c_str(), sizeof(baton->errorString) - 1);
+                return;
+            }
+            for (const ListResultItem_t& device : *devices) {
+                baton->results.push_back(new ListResultItem_t(device));
+            }
+            return;
+        }
+        LazyInit();
+        CreateFilteredList(&baton->results, baton->vid, baton->pid, baton->interfaceQuery);
+    } catch (const std::exception& e) {
+        strncpy(baton->errorString, e.what(), sizeof(baton->errorString) - 1);
+    }
+}
+
+// The interface query from find()'s (interfaceClass, interfaceSubclass,
+// protocol) arguments starting at `index`. Anything but a number leaves that
+// field unconstrained.
+static uint32_t InterfaceQueryArg(const Napi::CallbackInfo& info, size_t index) {
+    int fields[3] = {-1, -1, -1};
+    for (size_t i = 0; i < 3; i++) {
+        if (info.Length() > index + i && info[index + i].IsNumber()) {
+            fields[i] = info[index + i].As<Napi::Number>().Int32Value();
+        }
+    }
+    return MakeInterfaceQuery(fields[0], fields[1], fields[2]);
+}
+
+// Answer a find() on the JS thread from the per-query cache
+static Napi::Value FindFromCache(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    uint64_t startedAt = NowNs();
+    int vid = info.Length() > 0 && info[0].IsNumber() ? info[0].As<Napi::Number>().Int32Value() : 0;
+    int pid = info.Length() > 1 && info[1].IsNumber() ? info[1].As<Napi::Number>().Int32Value() : 0;
+    uint32_t interfaceQuery = InterfaceQueryArg(info, 2);
+    TRACE_EVENT(find_start, vid, pid);
+
+    std::string error;
+    FindResult_t devices = GetFindResult(vid, pid, interfaceQuery, &error);
+    if (!devices) {
+        throw Napi::Error::New(env, error);
+    }
+    unsigned int fieldMask = GetExtraFieldMask();
+    Napi::Array result = Napi::Array::New(env, devices->size());
+    for (size_t i = 0; i < devices->size(); i++) {
+        result[i] = CreateDeviceObject(env, &(*devices)[i], fieldMask);
+    }
+
+    TRACE_EVENT(find_done, devices->size(), 0);
+    MetricsObserveFind(NowNs() - startedAt);
+    return result;
+}
+
+// findSync(vid, pid, interfaceClass, interfaceSubclass, protocol): blocks on
+// the initial enumeration if it has not happened yet
+Napi::Value FindSync(const Napi::CallbackInfo& info) {
+    if (SharedRegistryIsOpen()) {
+        std::string error;
+        if (!SharedRegistryWaitReady(&error)) {
+            throw Napi::Error::New(info.Env(), error);
+        }
+    } else {
+        LazyInit();
+    }
+    return FindFromCache(info);
+}
+
+// Like findSync(), but returns undefined instead of blocking if the device
+// list is not ready yet. Used by find() to skip the threadpool.
+Napi::Value FindCached(const Napi::CallbackInfo& info) {
+    if (SharedRegistryIsOpen() ? !SharedRegistryIsReady() : !IsInitialized()) {
+        return info.Env().Undefined();
+    }
+    return FindFromCache(info);
+}
+
+// find(vid, pid, interfaceClass, interfaceSubclass, protocol, callback) on the
+// threadpool; the callback always comes last. Returns a promise if no callback
+// is given.
+Napi::Value Find(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
     ListBaton* baton = new ListBaton(env);
+    baton->startedAt = NowNs();
 
-    size_t argIndex = 0;
-    if (info.Length() > argIndex && info[argIndex].IsNumber()) {
-        baton->vid = info[argIndex++].As<Napi::Number>().Int32Value();
+    if (info.Length() > 0 && info[0].IsNumber()) {
+        baton->vid = info[0].As<Napi::Number>().Int32Value();
     }
-    if (info.Length() > argIndex && info[argIndex].IsNumber()) {
-        baton->pid = info[argIndex++].As<Napi::Number>().Int32Value();
+    if (info.Length() > 1 && info[1].IsNumber()) {
+        baton->pid = info[1].As<Napi::Number>().Int32Value();
     }
-    if (info.Length() > argIndex && info[argIndex].IsFunction()) {
-        baton->callback.Reset(info[argIndex].As<Napi::Function>(), 1);
+    baton->interfaceQuery = InterfaceQueryArg(info, 2);
+    if (info.Length() > 0 && info[info.Length() - 1].IsFunction()) {
+        baton->callback.Reset(info[info.Length() - 1].As<Napi::Function>(), 1);
+    }
+    TRACE_EVENT(find_start, baton->vid, baton->pid);
+
+    napi_value promise = nullptr;
+    if (baton->callback.IsEmpty()) {
+        napi_create_promise(env, &baton->deferred, &promise);
     }
 
     napi_value resource_name;
     napi_create_string_utf8(env, "USBDetection:Find", NAPI_AUTO_LENGTH, &resource_name);
 
-    napi_async_work work;
     napi_create_async_work(
         env,
         nullptr,
@@ -114,10 +877,456 @@ void Find(const Napi::CallbackInfo& info) {
         EIO_Find,
         EIO_AfterFind,
         baton,
-        &work
+        &baton->work
+    );
+
+    napi_queue_async_work(env, baton->work);
+
+    return promise ? Napi::Value(env, promise) : env.Undefined();
+}
+
+static void EIO_FindUnder(napi_env env, void* data) {
+    ListBaton* baton = static_cast<ListBaton*>(data);
+    LazyInit();
+    CreateSubtreeList(&baton->results, baton->portPath);
+}
+
+// Devices at or below a hub/port, e.g. findUnder("2-1.4")
+void FindUnder(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 2 || !info[0].IsString() || !info[1].IsFunction()) {
+        throw Napi::Error::New(env, "A port path and a callback need to be passed in.");
+    }
+
+    ListBaton* baton = new ListBaton(env);
+    baton->startedAt = NowNs();
+    baton->portPath = info[0].As<Napi::String>().Utf8Value();
+    baton->fieldMask |= DEVICE_FIELD_BIT(DeviceField_PortPath);
+    baton->callback.Reset(info[1].As<Napi::Function>(), 1);
+
+    std::vector<int> chain;
+    if (!ParsePortPath(baton->portPath, &chain)) {
+        snprintf(baton->errorString, sizeof(baton->errorString), "Invalid port path: %s", baton->portPath.c_str());
+    }
+
+    napi_value resource_name;
+    napi_create_string_utf8(env, "USBDetection:FindUnder", NAPI_AUTO_LENGTH, &resource_name);
+
+    napi_create_async_work(
+        env,
+        nullptr,
+        resource_name,
+        EIO_FindUnder,
+        EIO_AfterFind,
+        baton,
+        &baton->work
+    );
+
+    napi_queue_async_work(env, baton->work);
+}
+
+static void EIO_FindByNode(napi_env env, void* data) {
+    ListBaton* baton = static_cast<ListBaton*>(data);
+    LazyInit();
+
+    // Accept symlinks such as /dev/serial/by-id/...
+    std::string node = baton->node;
+#ifndef _WIN32
+    char resolved[PATH_MAX];
+    if (realpath(node.c_str(), resolved) != NULL) {
+        node = resolved;
+    }
+#endif
+    ListResultItem_t* item = FindItemByNode(node.c_str());
+    if (item != NULL) {
+        baton->results.push_back(item);
+    }
+}
+
+// The device a tty/hidraw/block/input/sg node belongs to, e.g.
+// findByNode("/dev/ttyACM0") (Linux only)
+void FindByNode(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 2 || !info[0].IsString() || !info[1].IsFunction()) {
+        throw Napi::Error::New(env, "A device node path and a callback need to be passed in.");
+    }
+
+    ListBaton* baton = new ListBaton(env);
+    baton->startedAt = NowNs();
+    baton->node = info[0].As<Napi::String>().Utf8Value();
+    baton->fieldMask |= DEVICE_FIELD_BIT(DeviceField_Nodes);
+    baton->callback.Reset(info[1].As<Napi::Function>(), 1);
+
+    napi_value resource_name;
+    napi_create_string_utf8(env, "USBDetection:FindByNode", NAPI_AUTO_LENGTH, &resource_name);
+
+    napi_create_async_work(
+        env,
+        nullptr,
+        resource_name,
+        EIO_FindByNode,
+        EIO_AfterFind,
+        baton,
+        &baton->work
+    );
+
+    napi_queue_async_work(env, baton->work);
+}
+
+// The device currently connected with a session handle from an earlier
+// result or event, or null. A hash lookup, so it answers on the JS thread.
+Napi::Value GetDevice(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsNumber()) {
+        throw Napi::Error::New(env, "A device handle needs to be passed in.");
+    }
+
+    double handle = info[0].As<Napi::Number>().DoubleValue();
+    ListResultItem_t* item = handle >= 1 ? FindItemByHandle((uint64_t)handle) : NULL;
+    if (item == NULL) {
+        return env.Null();
+    }
+
+    Napi::Object device = CreateDeviceObject(env, item, GetExtraFieldMask());
+    delete item;
+    return device;
+}
+
+static void EIO_GetTopology(napi_env env, void* data) {
+    TopologyBaton* baton = static_cast<TopologyBaton*>(data);
+    LazyInit();
+    CreateTopologySnapshot(&baton->entries);
+}
+
+static void EIO_AfterGetTopology(napi_env env, napi_status status, void* data) {
+    TopologyBaton* baton = static_cast<TopologyBaton*>(data);
+    Napi::HandleScope scope(env);
+    Napi::Env napiEnv = Napi::Env(env);
+    unsigned int fieldMask = GetExtraFieldMask() | DEVICE_FIELD_BIT(DeviceField_PortPath);
+
+    // Entries are in pre-order, so a node's parent has always been built already
+    Napi::Array roots = Napi::Array::New(napiEnv);
+    std::vector<Napi::Array> children;
+    children.reserve(baton->entries.size());
+    for (auto& entry : baton->entries) {
+        Napi::Object node = Napi::Object::New(napiEnv);
+        node.Set("portPath", entry.portPath);
+        if (entry.item) {
+            node.Set("device", CreateDeviceObject(napiEnv, &entry.item->deviceParams, fieldMask));
+            delete entry.item;
+        } else {
+            node.Set("device", napiEnv.Null());
+        }
+        children.push_back(Napi::Array::New(napiEnv));
+        node.Set("children", children.back());
+
+        Napi::Array& siblings = entry.parent < 0 ? roots : children[entry.parent];
+        siblings[siblings.Length()] = node;
+    }
+
+    baton->callback.Call({napiEnv.Null(), roots});
+
+    napi_delete_async_work(env, baton->work);
+    delete baton;
+}
+
+// The bus/hub tree: [{ portPath, device, children: [...] }, ...], one root per bus
+void GetTopology(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsFunction()) {
+        throw Napi::Error::New(env, "A function parameter needs to be passed in.");
+    }
+
+    TopologyBaton* baton = new TopologyBaton();
+    baton->callback.Reset(info[0].As<Napi::Function>(), 1);
+
+    napi_value resource_name;
+    napi_create_string_utf8(env, "USBDetection:GetTopology", NAPI_AUTO_LENGTH, &resource_name);
+
+    napi_create_async_work(
+        env,
+        nullptr,
+        resource_name,
+        EIO_GetTopology,
+        EIO_AfterGetTopology,
+        baton,
+        &baton->work
+    );
+
+    napi_queue_async_work(env, baton->work);
+}
+
+static void EIO_Reconcile(napi_env env, void* data) {
+    ReconcileBaton* baton = static_cast<ReconcileBaton*>(data);
+    std::string error;
+    if (!ReconcileDevices(&baton->added, &baton->removed, &baton->changed, &error)) {
+        snprintf(baton->errorString, sizeof(baton->errorString), "%s", error.c_str());
+    }
+}
+
+static void EIO_AfterReconcile(napi_env env, napi_status status, void* data) {
+    ReconcileBaton* baton = static_cast<ReconcileBaton*>(data);
+    Napi::HandleScope scope(env);
+    Napi::Env napiEnv = Napi::Env(env);
+    unsigned int fieldMask = GetExtraFieldMask();
+
+    if (baton->errorString[0]) {
+        baton->callback.Call({Napi::Error::New(napiEnv, baton->errorString).Value()});
+    } else {
+        Napi::Object result = Napi::Object::New(napiEnv);
+        Napi::Array added = Napi::Array::New(napiEnv, baton->added.size());
+        Napi::Array removed = Napi::Array::New(napiEnv, baton->removed.size());
+        Napi::Array changed = Napi::Array::New(napiEnv, baton->changed.size());
+        uint32_t i = 0;
+        for (auto item : baton->added) {
+            added[i++] = CreateDeviceObject(napiEnv, item, fieldMask);
+        }
+        i = 0;
+        for (auto item : baton->removed) {
+            removed[i++] = CreateDeviceObject(napiEnv, item, fieldMask);
+        }
+        i = 0;
+        for (auto item : baton->changed) {
+            Napi::Object device = CreateDeviceObject(napiEnv, item, fieldMask);
+            device.Set("changedFields", Napi::Number::New(napiEnv, item->changedFieldMask));
+            changed[i++] = device;
+        }
+        result.Set("added", added);
+        result.Set("removed", removed);
+        result.Set("changed", changed);
+        baton->callback.Call({napiEnv.Null(), result});
+    }
+
+    for (auto item : baton->added) {
+        delete item;
+    }
+    for (auto item : baton->removed) {
+        delete item;
+    }
+    for (auto item : baton->changed) {
+        delete item;
+    }
+    napi_delete_async_work(env, baton->work);
+    delete baton;
+}
+
+// Rescan, diff against the registry, apply the difference and emit
+// add/remove/change events for it: reconcile(callback(err, { added, removed, changed }))
+void Reconcile(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsFunction()) {
+        throw Napi::Error::New(env, "A function parameter needs to be passed in.");
+    }
+
+    ReconcileBaton* baton = new ReconcileBaton();
+    baton->callback.Reset(info[0].As<Napi::Function>(), 1);
+
+    napi_value resource_name;
+    napi_create_string_utf8(env, "USBDetection:Reconcile", NAPI_AUTO_LENGTH, &resource_name);
+
+    napi_create_async_work(
+        env,
+        nullptr,
+        resource_name,
+        EIO_Reconcile,
+        EIO_AfterReconcile,
+        baton,
+        &baton->work
+    );
+
+    napi_queue_async_work(env, baton->work);
+}
+
+static bool MatchesWaitFor(WaitForMatcher* matcher, ListResultItem_t* item) {
+    return (!matcher->vid || item->vendorId == matcher->vid)
+        && (!matcher->pid || item->productId == matcher->pid)
+        && (!matcher->hasSerial || item->serialNumber == matcher->serial);
+}
+
+static void ReleaseWaitFor(WaitForMatcher* matcher) {
+    if (--matcher->pendingReleases == 0) {
+        delete matcher;
+    }
+}
+
+static void CleanupWaitFor(void* arg);
+
+// Tear down the subscription and the timer. The TSFN is left to the caller.
+static void UnsubscribeWaitFor(WaitForMatcher* matcher) {
+    matcher->settled = true;
+    RemoveDeviceEventHandler(matcher->handlerId);
+    ReleaseMonitor();
+    if (matcher->hasTimer) {
+        uv_timer_stop(&matcher->timer);
+        uv_close(reinterpret_cast<uv_handle_t*>(&matcher->timer), [](uv_handle_t* handle) {
+            ReleaseWaitFor(static_cast<WaitForMatcher*>(handle->data));
+        });
+    }
+}
+
+// Resolve or reject exactly once, then tear down the subscription and timer.
+// Runs on the JS thread, always inside a callback scope.
+static void SettleWaitFor(Napi::Env env, WaitForMatcher* matcher) {
+    if (matcher->settled) {
+        return;
+    }
+
+    napi_remove_env_cleanup_hook(env, CleanupWaitFor, matcher);
+    UnsubscribeWaitFor(matcher);
+
+    ListResultItem_t* result;
+    {
+        std::lock_guard<std::mutex> lock(matcher->mutex);
+        result = matcher->result;
+        matcher->result = nullptr;
+    }
+    if (result) {
+        matcher->deferred.Resolve(CreateDeviceObject(env, result, GetExtraFieldMask()));
+        delete result;
+    } else {
+        matcher->deferred.Reject(Napi::Error::New(env, "Timed out waiting for device").Value());
+    }
+
+    matcher->tsFunc.Release();
+}
+
+static void SettleWaitForFromTsfn(Napi::Env env, Napi::Function, WaitForMatcher* matcher) {
+    SettleWaitFor(env, matcher);
+}
+
+// If the environment goes away while waiting; the promise is moot by then,
+// but the timer must not outlive the event loop
+static void CleanupWaitFor(void* arg) {
+    WaitForMatcher* matcher = static_cast<WaitForMatcher*>(arg);
+    if (matcher->settled) {
+        return;
+    }
+
+    UnsubscribeWaitFor(matcher);
+    matcher->tsFunc.Release();
+}
+
+// One-shot matcher on the monitor thread: no JS crossing for other devices
+static void HandleWaitForEvent(DeviceEvent_t event, ListResultItem_t* item, void* context) {
+    WaitForMatcher* matcher = static_cast<WaitForMatcher*>(context);
+    if (event != DeviceEvent_Added || !MatchesWaitFor(matcher, item)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(matcher->mutex);
+    if (matcher->matched) {
+        return;
+    }
+    matcher->matched = true;
+    matcher->result = CopyElement(item);
+    matcher->tsFunc.NonBlockingCall(matcher, SettleWaitForFromTsfn);
+}
+
+static void EIO_WaitForCheck(napi_env env, void* data) {
+    WaitForMatcher* matcher = static_cast<WaitForMatcher*>(data);
+    LazyInit();
+
+    std::list<ListResultItem_t*> devices;
+    CreateFilteredList(&devices, matcher->vid, matcher->pid);
+    for (auto item : devices) {
+        if (MatchesWaitFor(matcher, item)) {
+            std::lock_guard<std::mutex> lock(matcher->mutex);
+            if (!matcher->matched) {
+                matcher->matched = true;
+                matcher->result = item;
+                item = nullptr;
+            }
+        }
+        delete item;
+    }
+}
+
+static void EIO_AfterWaitForCheck(napi_env env, napi_status status, void* data) {
+    WaitForMatcher* matcher = static_cast<WaitForMatcher*>(data);
+    Napi::HandleScope scope(env);
+
+    bool matched;
+    {
+        std::lock_guard<std::mutex> lock(matcher->mutex);
+        matched = matcher->matched;
+    }
+    if (matched) {
+        SettleWaitFor(Napi::Env(env), matcher);
+    }
+
+    napi_delete_async_work(env, matcher->work);
+    ReleaseWaitFor(matcher);
+}
+
+// waitFor({ vendorId, productId, serialNumber }, timeoutMs) -> Promise<device>.
+// Resolves with a matching device that is already attached or the next one to
+// be; rejects after `timeoutMs` (0 or omitted waits indefinitely).
+Napi::Value WaitFor(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsObject()) {
+        throw Napi::Error::New(env, "A query object needs to be passed in.");
+    }
+
+    Napi::Object query = info[0].As<Napi::Object>();
+    double timeoutMs = 0;
+    if (info.Length() > 1 && info[1].IsNumber()) {
+        timeoutMs = info[1].As<Napi::Number>().DoubleValue();
+    }
+
+    WaitForMatcher* matcher = new WaitForMatcher(env);
+    if (query.Get("vendorId").IsNumber()) {
+        matcher->vid = query.Get("vendorId").As<Napi::Number>().Int32Value();
+    }
+    if (query.Get("productId").IsNumber()) {
+        matcher->pid = query.Get("productId").As<Napi::Number>().Int32Value();
+    }
+    if (query.Get("serialNumber").IsString()) {
+        matcher->hasSerial = true;
+        matcher->serial = query.Get("serialNumber").As<Napi::String>().Utf8Value();
+    }
+    Napi::Promise promise = matcher->deferred.Promise();
+
+    // The TSFN only wakes the JS thread; its function is never called
+    matcher->tsFunc = Napi::ThreadSafeFunction::New(env, Napi::Function::New(env, [](const Napi::CallbackInfo&) {}), "WaitFor", 0, 1, matcher,
+        [](Napi::Env, WaitForMatcher* matcher) { ReleaseWaitFor(matcher); });
+    matcher->pendingReleases = 2;
+
+    // Subscribe first, then look at the registry: a device added in between
+    // is seen by at least one of the two
+    matcher->handlerId = AddDeviceEventHandler(HandleWaitForEvent, matcher);
+    napi_add_env_cleanup_hook(env, CleanupWaitFor, matcher);
+    AcquireMonitor();
+
+    if (timeoutMs > 0) {
+        uv_loop_t* loop;
+        napi_get_uv_event_loop(env, &loop);
+        uv_timer_init(loop, &matcher->timer);
+        matcher->timer.data = matcher;
+        matcher->hasTimer = true;
+        matcher->pendingReleases++;
+        // Post through the TSFN so the rejection runs inside a callback scope
+        uv_timer_start(&matcher->timer, [](uv_timer_t* timer) {
+            WaitForMatcher* matcher = static_cast<WaitForMatcher*>(timer->data);
+            matcher->tsFunc.NonBlockingCall(matcher, SettleWaitForFromTsfn);
+        }, (uint64_t)timeoutMs, 0);
+    }
+
+    napi_value resource_name;
+    napi_create_string_utf8(env, "USBDetection:WaitFor", NAPI_AUTO_LENGTH, &resource_name);
+
+    napi_create_async_work(
+        env,
+        nullptr,
+        resource_name,
+        EIO_WaitForCheck,
+        EIO_AfterWaitForCheck,
+        matcher,
+        &matcher->work
     );
 
-    napi_queue_async_work(env, work);
+    napi_queue_async_work(env, matcher->work);
+
+    return promise;
 }
 
 // After find operation
@@ -125,11 +1334,14 @@ void EIO_AfterFind(napi_env env, napi_status status, void* data) {
     ListBaton* baton = static_cast<ListBaton*>(data);
     Napi::HandleScope scope(env);
     Napi::Env napiEnv = Napi::Env(env);  // 将 napi_env 转换为 Napi::Env
-    printf("EIO_AfterFind\n");
+    TRACE_EVENT(find_done, baton->results.size(), baton->errorString[0] != '\0');
+    if (baton->startedAt) {
+        MetricsObserveFind(NowNs() - baton->startedAt);
+    }
     if (baton->errorString[0]) {
         Napi::Error error = Napi::Error::New(napiEnv, baton->errorString);
-        if (baton->callback.IsEmpty()) {
-            baton->deferred.Reject(error.Value());
+        if (baton->deferred) {
+            napi_reject_deferred(env, baton->deferred, error.Value());
         } else {
             baton->callback.Call({error.Value()});
         }
@@ -137,46 +1349,286 @@ void EIO_AfterFind(napi_env env, napi_status status, void* data) {
         Napi::Array result = Napi::Array::New(napiEnv, baton->results.size());
         int i = 0;
         for (auto& item : baton->results) {
-            Napi::Object obj = Napi::Object::New(napiEnv);
-            obj.Set(OBJECT_ITEM_VENDOR_ID, item->vendorId);
-            obj.Set(OBJECT_ITEM_PRODUCT_ID, item->productId);
-            obj.Set(OBJECT_ITEM_SERIAL_NUMBER, item->serialNumber);
-            obj.Set(OBJECT_ITEM_DEVICE_NAME, item->deviceName);
-            obj.Set(OBJECT_ITEM_MANUFACTURER, item->manufacturer);
-            result[i++] = obj;
+            result[i++] = CreateDeviceObject(napiEnv, item, baton->fieldMask);
             delete item;
         }
 
-        if (baton->callback.IsEmpty()) {
-            baton->deferred.Resolve(result);
+        if (baton->deferred) {
+            napi_resolve_deferred(env, baton->deferred, result);
         } else {
             baton->callback.Call({napiEnv.Null(), result});
         }
     }
 
+    napi_delete_async_work(env, baton->work);
     delete baton;
+    SyncExternalMemory(napiEnv, false);
 }
 
 void StartMonitoring(const Napi::CallbackInfo& args) {
-    printf("StartMonitoring\n");
-    LazyInit();
-    Start();
+    TRACE_EVENT(start_monitoring, 0, 0);
+    Napi::Env env = args.Env();
+    AddonData* data = GetAddonData(env);
+    if (data->isMonitoring) return;
+
+    data->isMonitoring = true;
+    if (data->addedTsFunc) data->addedTsFunc.Ref(env);
+    if (data->removedTsFunc) data->removedTsFunc.Ref(env);
+    if (data->changedTsFunc) data->changedTsFunc.Ref(env);
+    data->handlerId = AddDeviceEventHandler(HandleDeviceEvent, data);
+    napi_add_env_cleanup_hook(env, CleanupMonitoring, data);
+
+    AcquireMonitor();
 }
 
 void StopMonitoring(const Napi::CallbackInfo& args) {
-    printf("StopMonitoring\n");
-    Stop();
+    TRACE_EVENT(stop_monitoring, 0, 0);
+    Napi::Env env = args.Env();
+    AddonData* data = GetAddonData(env);
+    if (!data->isMonitoring) return;
+
+    napi_remove_env_cleanup_hook(env, CleanupMonitoring, data);
+    Unsubscribe(data);
+
+    // Events held back by pause() belong to this monitoring session
+    {
+        std::lock_guard<std::mutex> lock(data->pauseMutex);
+        AccountQueuedEvents(-(int64_t)data->pausedEvents.size());
+        for (auto& queued : data->pausedEvents) {
+            delete queued.item;
+        }
+        data->pausedEvents.clear();
+    }
+
+    // Let the process exit; the callbacks stay registered for the next start
+    if (data->addedTsFunc) data->addedTsFunc.Unref(env);
+    if (data->removedTsFunc) data->removedTsFunc.Unref(env);
+    if (data->changedTsFunc) data->changedTsFunc.Unref(env);
+}
+
+// Called with queue->mutex held
+static void EnqueueEvent(EventQueue* queue, DeviceEvent_t event, ListResultItem_t* item) {
+    if (queue->events.size() >= queue->highWaterMark) {
+        // Over the limit: fold into the newest pending event for the same device
+        if (CoalesceEvent(queue->events, event, item)) {
+            return;
+        }
+
+        delete queue->events.front().item;
+        queue->events.pop_front();
+        queue->dropped++;
+        METRICS_INCREMENT(Metric_EventsDropped);
+        AccountQueuedEvents(-1);
+    }
+
+    queue->events.push_back({event, CopyElement(item)});
+    AccountQueuedEvents(1);
+}
+
+// Hand the queued events to JS as one batch. Runs on the JS thread.
+static void DeliverEvents(Napi::Env env, Napi::Function onEvents, EventQueue* queue) {
+    std::deque<QueuedEvent> events;
+    unsigned int dropped;
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->wakePending = false;
+        if (queue->closed || !queue->waiting || queue->events.empty()) {
+            return;
+        }
+        queue->waiting = false;
+        events.swap(queue->events);
+        dropped = queue->dropped;
+        queue->dropped = 0;
+    }
+    // Nobody is waiting any more, so don't hold the process open
+    queue->tsFunc.Unref(env);
+    AccountQueuedEvents(-(int64_t)events.size());
+    MetricsAdd(Metric_EventsDelivered, events.size());
 
-    if(addedTsFunc) addedTsFunc.Release();
-    if(removedTsFunc) removedTsFunc.Release();
+    unsigned int fieldMask = GetExtraFieldMask();
+    Napi::Array result = Napi::Array::New(env, events.size());
+    uint32_t i = 0;
+    for (auto& queued : events) {
+        Napi::Object entry = Napi::Object::New(env);
+        entry.Set("type", EventTypeName(queued.event));
+        entry.Set("device", CreateDeviceObject(env, queued.item, fieldMask));
+        if (queued.event == DeviceEvent_Changed) {
+            entry.Set("changedFields", Napi::Number::New(env, queued.item->changedFieldMask));
+        }
+        result[i++] = entry;
+        delete queued.item;
+    }
+    SyncExternalMemory(env, false);
+
+    onEvents.Call({ result, Napi::Number::New(env, dropped) });
+}
+
+// Called with queue->mutex held
+static void WakeConsumer(EventQueue* queue) {
+    if (!queue->waiting || queue->wakePending || queue->events.empty()) {
+        return;
+    }
+    if (queue->tsFunc.NonBlockingCall(queue, DeliverEvents) == napi_ok) {
+        queue->wakePending = true;
+    }
+}
+
+// Subscriber on the shared monitor for one queue. Never blocks the monitor thread.
+static void HandleQueuedEvent(DeviceEvent_t event, ListResultItem_t* item, void* context) {
+    EventQueue* queue = static_cast<EventQueue*>(context);
+    if ((queue->vid && item->vendorId != queue->vid) || (queue->pid && item->productId != queue->pid)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    EnqueueEvent(queue, event, item);
+    WakeConsumer(queue);
+}
+
+static void ShutdownEventQueue(EventQueue* queue) {
+    RemoveDeviceEventHandler(queue->handlerId);
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->closed = true;
+    }
+    ReleaseMonitor();
+
+    // The finalizer frees the queue once any pending delivery has run
+    queue->tsFunc.Release();
+}
+
+static void CleanupEventQueue(void* arg) {
+    ShutdownEventQueue(static_cast<EventQueue*>(arg));
+}
+
+static EventQueue* GetEventQueue(const Napi::CallbackInfo& info) {
+    if (info.Length() < 1 || !info[0].IsNumber()) {
+        throw Napi::Error::New(info.Env(), "An event queue id needs to be passed in.");
+    }
+
+    AddonData* data = GetAddonData(info.Env());
+    auto it = data->eventQueues.find(info[0].As<Napi::Number>().Int32Value());
+    return it == data->eventQueues.end() ? nullptr : it->second;
+}
+
+// openEventQueue({ vendorId, productId, highWaterMark }, onEvents) -> id.
+// `onEvents(events, dropped)` is called once per RequestEvents() with a
+// non-empty batch of `{ type, device }`. Monitoring runs while it is open.
+Napi::Value OpenEventQueue(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 2 || !info[0].IsObject() || !info[1].IsFunction()) {
+        throw Napi::Error::New(env, "An options object and a callback need to be passed in.");
+    }
+
+    Napi::Object options = info[0].As<Napi::Object>();
+    int vid = 0;
+    int pid = 0;
+    int highWaterMark = EVENT_QUEUE_DEFAULT_HIGH_WATER_MARK;
+    if (options.Has("vendorId") && options.Get("vendorId").IsNumber()) {
+        vid = options.Get("vendorId").As<Napi::Number>().Int32Value();
+    }
+    if (options.Has("productId") && options.Get("productId").IsNumber()) {
+        pid = options.Get("productId").As<Napi::Number>().Int32Value();
+    }
+    if (options.Has("highWaterMark") && !options.Get("highWaterMark").IsUndefined()) {
+        highWaterMark = options.Get("highWaterMark").ToNumber().Int32Value();
+        if (highWaterMark < 1) {
+            throw Napi::Error::New(env, "highWaterMark must be at least 1.");
+        }
+    }
+
+    AddonData* data = GetAddonData(env);
+    EventQueue* queue = new EventQueue();
+    queue->highWaterMark = highWaterMark;
+    queue->vid = vid;
+    queue->pid = pid;
+    queue->id = data->nextQueueId++;
+    queue->env = env;
+    queue->tsFunc = Napi::ThreadSafeFunction::New(env, info[1].As<Napi::Function>(), "EventQueue", 0, 1, queue,
+        [](Napi::Env, EventQueue* queue) { delete queue; });
+    // Only keep the process alive while the consumer is waiting for a batch
+    queue->tsFunc.Unref(env);
+
+    data->eventQueues[queue->id] = queue;
+    queue->handlerId = AddDeviceEventHandler(HandleQueuedEvent, queue);
+    napi_add_env_cleanup_hook(env, CleanupEventQueue, queue);
+    AcquireMonitor();
+
+    return Napi::Number::New(env, queue->id);
+}
+
+// Ask for the next batch. This is the only credit the monitor side gets:
+// nothing is sent to JS until the consumer asks again.
+void RequestEvents(const Napi::CallbackInfo& info) {
+    EventQueue* queue = GetEventQueue(info);
+    if (!queue) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (queue->waiting) {
+        return;
+    }
+    queue->waiting = true;
+    queue->tsFunc.Ref(info.Env());
+    WakeConsumer(queue);
+}
+
+void CloseEventQueue(const Napi::CallbackInfo& info) {
+    EventQueue* queue = GetEventQueue(info);
+    if (!queue) {
+        return;
+    }
+
+    GetAddonData(info.Env())->eventQueues.erase(queue->id);
+    napi_remove_env_cleanup_hook(info.Env(), CleanupEventQueue, queue);
+    ShutdownEventQueue(queue);
 }
 
 Napi::Object Init(Napi::Env env, Napi::Object exports) {
+    // Each environment (main thread or worker) gets its own callbacks and
+    // subscription; the registry and the monitor itself are shared
+    env.SetInstanceData(new AddonData());
+
+    exports.Set("closeEventQueue", Napi::Function::New(env, CloseEventQueue));
     exports.Set("find", Napi::Function::New(env, Find));
+    exports.Set("findByNode", Napi::Function::New(env, FindByNode));
+    exports.Set("getDevice", Napi::Function::New(env, GetDevice));
+    exports.Set("findCached", Napi::Function::New(env, FindCached));
+    exports.Set("findSync", Napi::Function::New(env, FindSync));
+    exports.Set("findUnder", Napi::Function::New(env, FindUnder));
+    exports.Set("getMemoryUsage", Napi::Function::New(env, GetMemoryUsage));
+    exports.Set("getMetrics", Napi::Function::New(env, GetMetrics));
+    exports.Set("getStats", Napi::Function::New(env, GetStats));
+    exports.Set("getTopology", Napi::Function::New(env, GetTopology));
+    exports.Set("getTrace", Napi::Function::New(env, GetTrace));
+    exports.Set("openEventQueue", Napi::Function::New(env, OpenEventQueue));
+    exports.Set("pause", Napi::Function::New(env, Pause));
+    exports.Set("publishRegistry", Napi::Function::New(env, PublishRegistry));
+    exports.Set("ready", Napi::Function::New(env, Ready));
+    exports.Set("reconcile", Napi::Function::New(env, Reconcile));
+    exports.Set("requestEvents", Napi::Function::New(env, RequestEvents));
+    exports.Set("resume", Napi::Function::New(env, Resume));
+    exports.Set("setCacheFile", Napi::Function::New(env, SetCacheFile));
+    exports.Set("setExtraFields", Napi::Function::New(env, SetExtraFields));
+    exports.Set("setResolveNames", Napi::Function::New(env, SetResolveNames));
+    exports.Set("setMonitorOptions", Napi::Function::New(env, SetMonitorOptions));
     exports.Set("registerAdded", Napi::Function::New(env, RegisterAdded));
     exports.Set("registerRemoved", Napi::Function::New(env, RegisterRemoved));
+    exports.Set("registerChanged", Napi::Function::New(env, RegisterChanged));
+    exports.Set("fieldBits", CreateFieldBits(env));
+    exports.Set("startEventHub", Napi::Function::New(env, StartEventHub));
     exports.Set("startMonitoring", Napi::Function::New(env, StartMonitoring));
+    exports.Set("stopEventHub", Napi::Function::New(env, StopEventHub));
     exports.Set("stopMonitoring", Napi::Function::New(env, StopMonitoring));
+    exports.Set("stopPublishingRegistry", Napi::Function::New(env, StopPublishingRegistry));
+    exports.Set("useEventHub", Napi::Function::New(env, UseEventHub));
+    exports.Set("useInotifyMonitor", Napi::Function::New(env, UseInotifyMonitor));
+    exports.Set("useSharedRegistry", Napi::Function::New(env, UseSharedRegistry));
+    exports.Set("waitFor", Napi::Function::New(env, WaitFor));
+#ifdef USB_DETECTION_BENCH
+    InitBenchHooks(env, exports);
+#endif
 
 	// InitDetection();
     return exports;
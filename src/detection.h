@@ -2,19 +2,58 @@
 #define _USB_DETECTION_H
 
 #include <napi.h>
+#include <uv.h>
+#include <deque>
 #include <list>
+#include <map>
+#include <mutex>
 #include <string>
+#include <vector>
+#include "detectionCore.h"
+#include "deviceEvents.h"
 #include "deviceList.h"
+#include "eventHub.h"
+#include "inotifyMonitor.h"
+#include "memoryUsage.h"
+#include "metrics.h"
+#include "sharedRegistry.h"
+#include "topology.h"
+#include "trace.h"
 
 // Function declarations
-void Find(const Napi::CallbackInfo& info);
-void EIO_Find(napi_env env, void* data);
+void CloseEventQueue(const Napi::CallbackInfo& info);
+Napi::Value Find(const Napi::CallbackInfo& info);
+void FindByNode(const Napi::CallbackInfo& info);
+Napi::Value GetDevice(const Napi::CallbackInfo& info);
+Napi::Value FindCached(const Napi::CallbackInfo& info);
+Napi::Value FindSync(const Napi::CallbackInfo& info);
 void EIO_AfterFind(napi_env env, napi_status status, void* data);
-void InitDetection();
+void FindUnder(const Napi::CallbackInfo& info);
+Napi::Value GetMemoryUsage(const Napi::CallbackInfo& info);
+Napi::Value GetMetrics(const Napi::CallbackInfo& info);
+Napi::Value GetStats(const Napi::CallbackInfo& info);
+void GetTopology(const Napi::CallbackInfo& info);
+Napi::Value GetTrace(const Napi::CallbackInfo& info);
+Napi::Value OpenEventQueue(const Napi::CallbackInfo& info);
+void Pause(const Napi::CallbackInfo& info);
+void PublishRegistry(const Napi::CallbackInfo& info);
+Napi::Value Ready(const Napi::CallbackInfo& info);
+void Reconcile(const Napi::CallbackInfo& info);
+void RequestEvents(const Napi::CallbackInfo& info);
+void Resume(const Napi::CallbackInfo& info);
+void SetCacheFile(const Napi::CallbackInfo& info);
+void SetExtraFields(const Napi::CallbackInfo& info);
+void SetResolveNames(const Napi::CallbackInfo& info);
+void SetMonitorOptions(const Napi::CallbackInfo& info);
+void StartEventHub(const Napi::CallbackInfo& info);
 void StartMonitoring(const Napi::CallbackInfo& info);
+void StopEventHub(const Napi::CallbackInfo& info);
 void StopMonitoring(const Napi::CallbackInfo& info);
-void Start();
-void Stop();
+void StopPublishingRegistry(const Napi::CallbackInfo& info);
+void UseSharedRegistry(const Napi::CallbackInfo& info);
+void UseEventHub(const Napi::CallbackInfo& info);
+void UseInotifyMonitor(const Napi::CallbackInfo& info);
+Napi::Value WaitFor(const Napi::CallbackInfo& info);
 
 // ListBaton struct for passing data in asynchronous operations
 struct ListBaton {
@@ -23,30 +62,174 @@ struct ListBaton {
     char errorString[1024];
     int vid;
     int pid;
+    // From MakeInterfaceQuery(); 0 matches any device
+    uint32_t interfaceQuery;
+    std::string portPath;
+    // For findByNode()
+    std::string node;
+    // Optional fields to marshal (see SetExtraFieldMask)
+    unsigned int fieldMask;
+    // When the call was made, for the find latency metric
+    uint64_t startedAt;
 
     Napi::Env env;
-    Napi::Promise::Deferred deferred;
+    // Only created when no callback is given
+    napi_deferred deferred;
+    napi_async_work work;
 
-    ListBaton(Napi::Env env) : vid(0), pid(0), env(env), deferred(Napi::Promise::Deferred::New(env)) {
+    ListBaton(Napi::Env env) : vid(0), pid(0), interfaceQuery(0), fieldMask(GetExtraFieldMask()), startedAt(0), env(env), deferred(nullptr), work(nullptr) {
         errorString[0] = '\0';
+        MemoryAccount(MemoryCategory_Batons, 1, sizeof(ListBaton));
+    }
+    ~ListBaton() {
+        MemoryAccount(MemoryCategory_Batons, -1, -(int64_t)sizeof(ListBaton));
+    }
+};
+
+// TopologyBaton struct for getTopology()
+struct TopologyBaton {
+    Napi::FunctionReference callback;
+    std::vector<TopologyEntry_t> entries;
+    napi_async_work work;
+
+    TopologyBaton() : work(nullptr) {
+        MemoryAccount(MemoryCategory_Batons, 1, sizeof(TopologyBaton));
+    }
+    ~TopologyBaton() {
+        MemoryAccount(MemoryCategory_Batons, -1, -(int64_t)sizeof(TopologyBaton));
+    }
+};
+
+// Backing store for one `events()` iterator. The monitor thread appends to
+// `events` and never blocks; once `highWaterMark` is reached, further events
+// for a device already in the queue are coalesced into it, and otherwise the
+// oldest entry is dropped. The JS side only receives a batch after asking for
+// one with RequestEvents(), so at most one batch is in flight.
+struct QueuedEvent {
+    DeviceEvent_t event;
+    ListResultItem_t* item;
+};
+
+// Keeps the queue depth metric and the memory accounting of queued events in step
+inline void AccountQueuedEvents(int64_t count) {
+    MetricsAdd(Metric_QueueDepth, count);
+    MemoryAccount(MemoryCategory_Events, count, count * (int64_t)(sizeof(QueuedEvent) + sizeof(ListResultItem_t)));
+}
+
+struct EventQueue {
+    std::mutex mutex;
+    std::deque<QueuedEvent> events;
+    size_t highWaterMark;
+    int vid;
+    int pid;
+    // Events discarded since the last delivered batch
+    unsigned int dropped;
+    // The consumer asked for a batch and has not received it yet
+    bool waiting;
+    // A delivery is already queued on `tsFunc`
+    bool wakePending;
+    bool closed;
+    int id;
+    int handlerId;
+    Napi::ThreadSafeFunction tsFunc;
+    napi_env env;
+
+    EventQueue() : highWaterMark(0), vid(0), pid(0), dropped(0), waiting(false), wakePending(false), closed(false), id(0), handlerId(0), env(nullptr) {}
+    ~EventQueue() {
+        AccountQueuedEvents(-(int64_t)events.size());
+        for (auto& queued : events) {
+            delete queued.item;
+        }
+    }
+};
+
+// ReconcileBaton struct for reconcile()
+struct ReconcileBaton {
+    Napi::FunctionReference callback;
+    std::list<ListResultItem_t*> added;
+    std::list<ListResultItem_t*> removed;
+    std::list<ListResultItem_t*> changed;
+    char errorString[1024];
+    napi_async_work work;
+
+    ReconcileBaton() : work(nullptr) {
+        errorString[0] = '\0';
+        MemoryAccount(MemoryCategory_Batons, 1, sizeof(ReconcileBaton));
+    }
+    ~ReconcileBaton() {
+        MemoryAccount(MemoryCategory_Batons, -1, -(int64_t)sizeof(ReconcileBaton));
+    }
+};
+
+// State of one waitFor() call. It is matched from two sides: a one-shot
+// handler on the monitor thread, and a registry check on the threadpool that
+// starts after the handler is registered, so no device can slip in between.
+struct WaitForMatcher {
+    int vid;
+    int pid;
+    bool hasSerial;
+    std::string serial;
+
+    // Set by whichever side matches first
+    std::mutex mutex;
+    bool matched;
+    ListResultItem_t* result;
+
+    // Everything below is only touched on the JS thread
+    napi_env env;
+    int handlerId;
+    bool settled;
+    Napi::Promise::Deferred deferred;
+    Napi::ThreadSafeFunction tsFunc;
+    uv_timer_t timer;
+    bool hasTimer;
+    napi_async_work work;
+    // The TSFN finalizer, the timer close callback and the registry check
+    // completion each drop one; the last one frees the matcher
+    int pendingReleases;
+
+    WaitForMatcher(Napi::Env env) : vid(0), pid(0), hasSerial(false), matched(false), result(nullptr), env(env), handlerId(0), settled(false),
+        deferred(Napi::Promise::Deferred::New(env)), hasTimer(false), work(nullptr), pendingReleases(0) {
+        MemoryAccount(MemoryCategory_Batons, 1, sizeof(WaitForMatcher));
+    }
+    ~WaitForMatcher() {
+        delete result;
+        MemoryAccount(MemoryCategory_Batons, -1, -(int64_t)sizeof(WaitForMatcher));
+    }
+};
+
+// Per-environment state, stored as instance data so the addon can be loaded
+// from several worker threads at once
+struct AddonData {
+    Napi::ThreadSafeFunction addedTsFunc;
+    Napi::ThreadSafeFunction removedTsFunc;
+    Napi::ThreadSafeFunction changedTsFunc;
+    bool isMonitoring;
+    int handlerId;
+    std::map<int, EventQueue*> eventQueues;
+    int nextQueueId;
+
+    // While paused the add/remove callbacks are held back and coalesced per
+    // device in `pausedEvents`; the monitor and the registry keep running.
+    // Also keeps the TSFNs above from being replaced while events are posted.
+    std::mutex pauseMutex;
+    bool isPaused;
+    std::deque<QueuedEvent> pausedEvents;
+
+    // Native memory last reported to this environment's V8 heap
+    int64_t externalMemory;
+
+    AddonData() : isMonitoring(false), handlerId(0), nextQueueId(1), isPaused(false), externalMemory(0) {}
+    ~AddonData() {
+        AccountQueuedEvents(-(int64_t)pausedEvents.size());
+        for (auto& queued : pausedEvents) {
+            delete queued.item;
+        }
     }
 };
 
 void RegisterAdded(const Napi::CallbackInfo& info);
-void NotifyAdded(ListResultItem_t* it);
 void RegisterRemoved(const Napi::CallbackInfo& info);
-void NotifyRemoved(ListResultItem_t* it);
-
-// Thread-safe callbacks
-extern Napi::ThreadSafeFunction addedTsFunc;
-extern Napi::ThreadSafeFunction removedTsFunc;
+void RegisterChanged(const Napi::CallbackInfo& info);
 
 #endif
-
-#ifdef DEBUG
-  #define DEBUG_HEADER fprintf(stderr, "node-usb-detection [%s:%s() %d]: ", __FILE__, __FUNCTION__, __LINE__);
-  #define DEBUG_FOOTER fprintf(stderr, "\n");
-  #define DEBUG_LOG(...) DEBUG_HEADER fprintf(stderr, __VA_ARGS__); DEBUG_FOOTER
-#else
-  #define DEBUG_LOG(...)
-#endif
\ No newline at end of file
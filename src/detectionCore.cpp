@@ -0,0 +1,318 @@
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include "detectionCore.h"
+#include "eventHub.h"
+#include "metrics.h"
+#include "sharedRegistry.h"
+#include "trace.h"
+
+using namespace std;
+
+/**********************************
+ * Local defines
+ **********************************/
+// A scan that races with live hotplug events is retried this many times
+#define RECONCILE_ATTEMPTS 3
+
+/**********************************
+ * Local Variables
+ **********************************/
+static atomic<bool> isInitialized{false};
+static mutex initMutex;
+
+// Number of users of the monitor (Node.js environments, waitFor() calls,
+// subscriptions). The native monitor runs while this is non-zero.
+static mutex monitorMutex;
+static int monitorUsers = 0;
+// Where the running monitor gets its events from
+typedef enum
+{
+	MonitorSource_Platform,
+	MonitorSource_SharedRegistry,
+	MonitorSource_EventHub,
+} MonitorSource_t;
+static MonitorSource_t monitorSource = MonitorSource_Platform;
+
+// Keeps the generations of the shared and the local device list apart
+#define SHARED_GENERATION_BIT (1ull << 63)
+
+/**********************************
+ * Local Helper Functions
+ **********************************/
+static uint64_t NowNs()
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**********************************
+ * Public Functions
+ **********************************/
+void LazyInit()
+{
+	if (isInitialized.load(memory_order_acquire))
+	{
+		return;
+	}
+
+	lock_guard<mutex> lock(initMutex);
+	if (!isInitialized.load(memory_order_relaxed))
+	{
+		uint64_t startedAt = NowNs();
+		TRACE_EVENT(init_start, 0, 0);
+		InitDetection();
+		TRACE_EVENT(init_done, 0, 0);
+		MetricsSet(Metric_EnumerationNs, NowNs() - startedAt);
+		isInitialized.store(true, memory_order_release);
+	}
+}
+
+bool IsInitialized()
+{
+	return isInitialized.load(memory_order_acquire);
+}
+
+void NotifyAdded(ListResultItem_t *it)
+{
+	if (!it)
+	{
+		return;
+	}
+	TRACE_EVENT(device_added, it->vendorId, it->productId);
+	DispatchDeviceEvent(DeviceEvent_Added, it);
+}
+
+void NotifyRemoved(ListResultItem_t *it)
+{
+	if (!it)
+	{
+		return;
+	}
+	TRACE_EVENT(device_removed, it->vendorId, it->productId);
+	DispatchDeviceEvent(DeviceEvent_Removed, it);
+}
+
+void NotifyChanged(ListResultItem_t *it)
+{
+	if (!it)
+	{
+		return;
+	}
+	TRACE_EVENT(device_changed, it->vendorId, it->changedFieldMask);
+	DispatchDeviceEvent(DeviceEvent_Changed, it);
+}
+
+// Must hold monitorMutex
+static void StopMonitorSource()
+{
+	switch (monitorSource)
+	{
+	case MonitorSource_EventHub:
+		EventHubStopReceiving();
+		break;
+	case MonitorSource_SharedRegistry:
+		SharedRegistryStopWatching();
+		break;
+	default:
+		Stop();
+		break;
+	}
+}
+
+// process.exit() skips the environment cleanup hooks, and a monitor thread
+// still joinable when the statics are destroyed would abort the process.
+// Registered after those statics are constructed, so it runs before.
+static void StopMonitorAtExit()
+{
+	lock_guard<mutex> lock(monitorMutex);
+	if (monitorUsers > 0)
+	{
+		StopMonitorSource();
+		monitorUsers = 0;
+	}
+}
+
+void AcquireMonitor()
+{
+	static once_flag atExitRegistered;
+	call_once(atExitRegistered, []() { atexit(StopMonitorAtExit); });
+
+	lock_guard<mutex> lock(monitorMutex);
+	if (monitorUsers++ == 0)
+	{
+		if (EventHubIsConnected())
+		{
+			monitorSource = MonitorSource_EventHub;
+			EventHubStartReceiving();
+		}
+		else if (SharedRegistryIsOpen())
+		{
+			monitorSource = MonitorSource_SharedRegistry;
+			SharedRegistryStartWatching();
+		}
+		else
+		{
+			monitorSource = MonitorSource_Platform;
+			Start();
+		}
+	}
+}
+
+void ReleaseMonitor()
+{
+	lock_guard<mutex> lock(monitorMutex);
+	if (--monitorUsers == 0)
+	{
+		StopMonitorSource();
+	}
+}
+
+bool IsMonitorRunning()
+{
+	lock_guard<mutex> lock(monitorMutex);
+	return monitorUsers > 0;
+}
+
+void RestartMonitor()
+{
+	lock_guard<mutex> lock(monitorMutex);
+	if (monitorUsers > 0 && monitorSource == MonitorSource_Platform)
+	{
+		Stop();
+		Start();
+	}
+}
+
+bool SnapshotDevices(int vid, int pid, vector<ListResultItem_t> *devices, uint64_t *generation, uint32_t interfaceQuery)
+{
+	if (SharedRegistryIsOpen())
+	{
+		if (!SharedRegistryRead(vid, pid, devices, generation, interfaceQuery))
+		{
+			return false;
+		}
+		*generation |= SHARED_GENERATION_BIT;
+		return true;
+	}
+
+	*generation = CreateFilteredSnapshot(devices, vid, pid, interfaceQuery);
+	return true;
+}
+
+uint64_t GetDevicesGeneration()
+{
+	if (SharedRegistryIsOpen())
+	{
+		return SharedRegistryGeneration() | SHARED_GENERATION_BIT;
+	}
+	return GetListGeneration();
+}
+
+void FindDevices(int vid, int pid, vector<ListResultItem_t> *devices, uint32_t interfaceQuery)
+{
+	uint64_t generation;
+	if (!SharedRegistryIsOpen())
+	{
+		LazyInit();
+	}
+	SnapshotDevices(vid, pid, devices, &generation, interfaceQuery);
+}
+
+bool ReconcileDevices(list<ListResultItem_t *> *added, list<ListResultItem_t *> *removed, list<ListResultItem_t *> *changed, string *error)
+{
+	// find() and the events come from elsewhere then; the local list and a
+	// local scan mean nothing to their users
+	if (EventHubIsConnected() || SharedRegistryIsOpen())
+	{
+		*error = "reconcile() is not supported with a shared device list or an event hub";
+		return false;
+	}
+	LazyInit();
+
+	bool supported = true;
+	bool reconciled = false;
+	function<void()> reconcile = [&]() {
+		for (int attempt = 0; attempt < RECONCILE_ATTEMPTS && !reconciled; attempt++)
+		{
+			uint64_t generation = GetListGeneration();
+			list<DeviceItem_t *> scanned;
+			if (!ScanDeviceList(&scanned))
+			{
+				supported = false;
+				return;
+			}
+			// Fails if the monitor changed the registry while scanning; the
+			// scan may predate it
+			reconciled = ReconcileList(&scanned, generation, added, removed, changed);
+		}
+		if (!reconciled)
+		{
+			return;
+		}
+		// Synthetic events for every environment that is monitoring
+		for (ListResultItem_t *item : *removed)
+		{
+			NotifyRemoved(item);
+		}
+		for (ListResultItem_t *item : *added)
+		{
+			NotifyAdded(item);
+		}
+		for (ListResultItem_t *item : *changed)
+		{
+			NotifyChanged(item);
+		}
+	};
+
+	// A running monitor applies and reports the difference between two of
+	// its own events, so no handler sees a synthetic add after the live
+	// remove of the same device or the other way round
+	bool done = false;
+	{
+		lock_guard<mutex> lock(monitorMutex);
+		if (monitorUsers > 0 && monitorSource != MonitorSource_Platform)
+		{
+			*error = "reconcile() is not supported with a shared device list or an event hub";
+			return false;
+		}
+		if (monitorUsers == 0)
+		{
+			// Nothing else reports events, and the monitor can't start
+			// meanwhile
+			reconcile();
+			done = true;
+		}
+	}
+	if (!done && !RunOnMonitorThread(reconcile))
+	{
+		// Not in its event loop yet (or any more), so not reporting either
+		reconcile();
+	}
+
+	if (!supported)
+	{
+		*error = "reconcile() is not supported on this platform";
+		return false;
+	}
+	if (!reconciled)
+	{
+		*error = "Devices kept changing during reconcile(); try again";
+		return false;
+	}
+	return true;
+}
+
+int SubscribeDeviceEvents(DeviceEventHandler_t handler, void *context)
+{
+	int subscriptionId = AddDeviceEventHandler(handler, context);
+	AcquireMonitor();
+	return subscriptionId;
+}
+
+void UnsubscribeDeviceEvents(int subscriptionId)
+{
+	RemoveDeviceEventHandler(subscriptionId);
+	ReleaseMonitor();
+}
@@ -0,0 +1,81 @@
+#ifndef _DETECTION_CORE_H
+#define _DETECTION_CORE_H
+
+#include <functional>
+#include <list>
+#include <string>
+#include <vector>
+#include "deviceEvents.h"
+#include "deviceList.h"
+
+// The hotplug engine without Node.js: the device list, the platform monitor
+// and the event fan-out. Built as the `usbdetect_core` static library, which
+// the `detection` addon wraps; nothing here depends on N-API.
+
+/**********************************
+ * Platform backend
+ * (detection_linux.cpp, detection_mac.cpp, detection_win.cpp)
+ **********************************/
+// Builds the initial device list. Only ever called through LazyInit().
+void InitDetection();
+// Start/stop the monitor thread; use AcquireMonitor()/ReleaseMonitor() instead
+void Start();
+void Stop();
+// A fresh enumeration into new, keyed items, for reconcile(). Safe to call
+// from any thread; returns false where the platform does not support it.
+bool ScanDeviceList(std::list<DeviceItem_t *> *items);
+// Runs `task` on the monitor thread between two of its events and waits for
+// it. Returns false without running it if the thread isn't in its event loop
+// or stops first.
+bool RunOnMonitorThread(const std::function<void()> &task);
+
+/**********************************
+ * Core
+ **********************************/
+// Runs InitDetection() exactly once, blocking until the initial device list
+// is built
+void LazyInit();
+bool IsInitialized();
+// Called by the backends to fan an event out to every handler. The caller
+// keeps ownership of `it`.
+void NotifyAdded(ListResultItem_t *it);
+void NotifyRemoved(ListResultItem_t *it);
+// `it->changedFieldMask` must say what changed
+void NotifyChanged(ListResultItem_t *it);
+// The monitor runs while at least one user holds it. Connected to an event
+// hub (see eventHub.h) or with a shared device list open (see
+// sharedRegistry.h), that means receiving from it instead of the OS.
+void AcquireMonitor();
+void ReleaseMonitor();
+bool IsMonitorRunning();
+// Restarts a running monitor, e.g. to apply new thread options
+void RestartMonitor();
+
+// Copies of the devices matching `vid`/`pid` (0 matches any) and an interface
+// query (see usbDescriptors.h), and the generation they belong to, from the
+// shared device list when one is open and the local one otherwise. Does not
+// build the local list; returns false if no consistent copy could be taken.
+bool SnapshotDevices(int vid, int pid, std::vector<ListResultItem_t> *devices, uint64_t *generation, uint32_t interfaceQuery = 0);
+// What SnapshotDevices() would return as the generation right now
+uint64_t GetDevicesGeneration();
+
+/**********************************
+ * Plain C++ API
+ **********************************/
+// Devices matching `vid`/`pid` (0 matches any) and an interface query,
+// building the device list first if needed (unless a shared device list is
+// open)
+void FindDevices(int vid, int pid, std::vector<ListResultItem_t> *devices, uint32_t interfaceQuery = 0);
+// Rescans, applies the difference to the local device list and reports it to
+// every handler, ordered with the monitor's own events. Fills in copies of
+// what was added, removed and changed in place. Returns false and sets `error` where
+// unsupported, with a shared device list or event hub in use, or if the
+// devices kept changing during every attempt.
+bool ReconcileDevices(std::list<ListResultItem_t *> *added, std::list<ListResultItem_t *> *removed, std::list<ListResultItem_t *> *changed, std::string *error);
+// Calls `handler` on the monitor thread for every add/remove/change, and keeps the
+// monitor running until the subscription is removed
+int SubscribeDeviceEvents(DeviceEventHandler_t handler, void *context);
+// Once this returns the handler is not running and will not be called again
+void UnsubscribeDeviceEvents(int subscriptionId);
+
+#endif
@@ -1,8 +1,29 @@
+#include <errno.h>
+#include <fcntl.h>
 #include <libudev.h>
 #include <poll.h>
+#include <unistd.h>
 
-#include "detection.h"
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "detectionCore.h"
 #include "deviceList.h"
+#include "deviceCache.h"
+#include "inotifyMonitor.h"
+#include "metrics.h"
+#include "nameDatabase.h"
+#include "nodeIndex.h"
+#include "threadPolicy.h"
+#include "trace.h"
+#include "usbDescriptors.h"
 
 using namespace std;
 
@@ -13,179 +34,405 @@ using namespace std;
  **********************************/
 #define DEVICE_ACTION_ADDED "add"
 #define DEVICE_ACTION_REMOVED "remove"
+#define DEVICE_ACTION_CHANGED "change"
+#define DEVICE_ACTION_BOUND "bind"
+#define DEVICE_ACTION_UNBOUND "unbind"
 
+#define DEVICE_SUBSYSTEM_USB "usb"
 #define DEVICE_TYPE_DEVICE "usb_device"
 
-#define DEVICE_PROPERTY_NAME "ID_MODEL"
-#define DEVICE_PROPERTY_SERIAL "ID_SERIAL_SHORT"
-#define DEVICE_PROPERTY_VENDOR "ID_VENDOR"
+#define DEVICE_PROPERTY_PATH "ID_PATH"
+#define DEVICE_PROPERTY_DRIVER "DRIVER"
+
+// Must be a power of two. The static_assert below checks the table is collision-free.
+#define PROPERTY_TABLE_SIZE 8
 
 
 /**********************************
  * Local typedefs
  **********************************/
+typedef enum _PropertyTarget_t {
+	PropertyTarget_None,
+	PropertyTarget_Path,
+	PropertyTarget_Driver,
+} PropertyTarget_t;
+
+typedef struct {
+	const char* name;
+	PropertyTarget_t target;
+} PropertySlot_t;
+
+typedef struct {
+	const char* sysattr;
+	DeviceField_t field;
+} ExtraSysattr_t;
+
+// A RunOnMonitorThread() call; `finished` says whether `task` ran
+typedef struct {
+	const std::function<void()>* task;
+	std::promise<bool>* finished;
+} MonitorTask_t;
+
+/**********************************
+ * Property lookup table
+ **********************************/
+// FNV-1a. Each udev property name is hashed once and looked up in a
+// compile-time table, instead of being strcmp'd against every known name.
+static constexpr uint32_t PropertyHash(const char* name) {
+	uint32_t hash = 2166136261u;
+	for(; *name; name++) {
+		hash = (hash ^ (uint8_t)*name) * 16777619u;
+	}
+	return hash;
+}
+
+static constexpr PropertySlot_t knownProperties[] = {
+	{ DEVICE_PROPERTY_PATH, PropertyTarget_Path },
+	{ DEVICE_PROPERTY_DRIVER, PropertyTarget_Driver },
+};
+
+struct PropertyTable {
+	PropertySlot_t slots[PROPERTY_TABLE_SIZE];
+	bool isPerfect;
+
+	constexpr PropertyTable() : slots(), isPerfect(true) {
+		for(PropertySlot_t& slot : slots) {
+			slot = { nullptr, PropertyTarget_None };
+		}
+		for(const PropertySlot_t& property : knownProperties) {
+			PropertySlot_t& slot = slots[PropertyHash(property.name) & (PROPERTY_TABLE_SIZE - 1)];
+			if(slot.name != nullptr) {
+				isPerfect = false;
+			}
+			slot = property;
+		}
+	}
+};
+
+static constexpr PropertyTable propertyTable;
+static_assert(propertyTable.isPerfect, "udev property names collide in the lookup table; change PROPERTY_TABLE_SIZE");
+
+// Subsystems whose device nodes are recorded against their usb_device
+static const char* const childSubsystems[] = {
+	"tty",
+	"hidraw",
+	"block",
+	"input",
+	"scsi_generic",
+};
+
+static const ExtraSysattr_t extraSysattrs[] = {
+	{ "speed", DeviceField_Speed },
+	{ "bDeviceClass", DeviceField_DeviceClass },
+	{ "bcdDevice", DeviceField_BcdDevice },
+};
 
 
 
 /**********************************
  * Local Variables
  **********************************/
-static ListResultItem_t* currentItem;
-static bool isAdded;
-
 static udev *udev;
-static udev_enumerate *enumerate;
-static udev_list_entry *devices, *dev_list_entry;
-static udev_device *dev;
 
 static udev_monitor *mon;
 static int fd;
 
-static uv_work_t work_req;
-static uv_signal_t term_signal;
-static uv_signal_t int_signal;
+// Dedicated monitor thread, shared by every environment that is monitoring.
+// `udev` and `mon` outlive it, so it can be stopped and started again freely.
+static std::thread monitorThread;
+static std::atomic<bool> isRunning{false};
+// Written to by Stop() to wake the thread out of poll()
+static int wakePipe[2] = {-1, -1};
 
-static uv_async_t async_handler;
-static uv_mutex_t notify_mutex;
-static uv_cond_t notifyDeviceHandled;
+static std::mutex rescan_mutex;
+static std::condition_variable rescanDone;
+static bool isRescanning = false;
 
-static bool deviceHandled = true;
-
-static bool isRunning = false;
+// Tasks for the monitor thread, accepted only while it is in its event loop
+static std::mutex taskMutex;
+static std::deque<MonitorTask_t> monitorTasks;
+static bool isServingTasks = false;
 
 /**********************************
  * Local Helper Functions protoypes
  **********************************/
 static void BuildInitialDeviceList();
+static void ScanDevices(struct udev* context, list<DeviceItem_t*>* items);
+static void RescanFromCache();
+static void WaitForRescan();
+static void ServeMonitorTasks(bool serving);
+static bool OnMonitorWake();
 
-static void WaitForDeviceHandled();
-static void SignalDeviceHandled();
-static void cbTerminate(uv_signal_t *handle, int signum);
-static void cbWork(uv_work_t *req);
-static void cbAfter(uv_work_t *req, int status);
-static void cbAsync(uv_async_t *handle);
+static void MonitorLoop();
 
 /**********************************
  * Public Functions
  **********************************/
 void Start() {
-	if(isRunning) {
+	if(wakePipe[0] < 0 && pipe2(wakePipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+		fprintf(stderr, "Can't create the monitor wake pipe\n");
+		return;
+	}
+	if(isRunning.exchange(true)) {
 		return;
 	}
 
-	isRunning = true;
-
-	uv_mutex_init(&notify_mutex);
-	uv_async_init(uv_default_loop(), &async_handler, cbAsync);
-	uv_signal_init(uv_default_loop(), &term_signal);
-	uv_signal_init(uv_default_loop(), &int_signal);
-	uv_cond_init(&notifyDeviceHandled);
-
-	uv_queue_work(uv_default_loop(), &work_req, cbWork, cbAfter);
+	monitorThread = std::thread(MonitorLoop);
 }
 
 void Stop() {
-	if(!isRunning) {
+	if(!isRunning.exchange(false)) {
 		return;
 	}
 
-	isRunning = false;
+	char byte = 0;
+	if(write(wakePipe[1], &byte, 1) < 0) {
+		fprintf(stderr, "Can't wake the monitor thread\n");
+	}
+	{
+		// In case it is still waiting for the rescan from the cache
+		std::lock_guard<std::mutex> lock(rescan_mutex);
+		rescanDone.notify_all();
+	}
+	if(monitorThread.joinable()) {
+		monitorThread.join();
+	}
+
+	// Drain the wake-up so the next Start() doesn't return from poll() at once
+	char buffer[16];
+	while(read(wakePipe[0], buffer, sizeof(buffer)) > 0) {
+	}
 }
 
 void InitDetection() {
-	/* Create the udev object */
-	udev = udev_new();
-	if (!udev)
-	{
-		printf("Can't create udev\n");
+	if(!InotifyMonitorIsEnabled()) {
+		/* Create the udev object */
+		udev = udev_new();
+
+		/* Set up a monitor to monitor devices */
+		mon = udev ? udev_monitor_new_from_netlink(udev, "udev") : NULL;
+		if(!mon) {
+			/* No udev or no netlink access, as in some containers: fall back
+			   to watching usbfs */
+			string error;
+			InotifyMonitorEnable(NULL, NULL, &error);
+		}
+	}
+	if(InotifyMonitorIsEnabled()) {
+		list<DeviceItem_t*> items;
+		InotifyMonitorScan(&items);
+		ReplaceList(&items);
 		return;
 	}
 
-	/* Set up a monitor to monitor devices */
-	mon = udev_monitor_new_from_netlink(udev, "udev");
 	udev_monitor_enable_receiving(mon);
 
 	/* Get the file descriptor (fd) for the monitor.
 	   This fd will get passed to select() */
 	fd = udev_monitor_get_fd(mon);
 
+	/* Serve the registry from the on-disk snapshot if it still matches
+	   /dev/bus/usb, and bring it fully up to date in the background */
+	list<DeviceItem_t*> cached;
+	if(IsDeviceCacheEnabled() && LoadDeviceCache(&cached)) {
+		ReplaceList(&cached);
+
+		isRescanning = true;
+		std::thread(RescanFromCache).detach();
+		return;
+	}
+
 	BuildInitialDeviceList();
+	SaveDeviceCache();
+}
+
+
+bool RunOnMonitorThread(const std::function<void()>& task) {
+	std::promise<bool> finished;
+	{
+		std::lock_guard<std::mutex> lock(taskMutex);
+		if(!isServingTasks) {
+			return false;
+		}
+		monitorTasks.push_back({&task, &finished});
+	}
+	// If the pipe is full the thread is due to wake up anyway
+	char byte = 0;
+	if(write(wakePipe[1], &byte, 1) < 0 && errno != EAGAIN) {
+		fprintf(stderr, "Can't wake the monitor thread\n");
+	}
+	return finished.get_future().get();
 }
 
+bool ScanDeviceList(list<DeviceItem_t*>* items) {
+	if(InotifyMonitorIsEnabled()) {
+		InotifyMonitorScan(items);
+		return true;
+	}
 
-void EIO_Find(uv_work_t* req) {
-	ListBaton* data = static_cast<ListBaton*>(req->data);
+	/* libudev contexts are not thread-safe, so every scan off the monitor
+	   thread gets its own */
+	struct udev* context = udev_new();
+	if(!context) {
+		return false;
+	}
 
-	CreateFilteredList(&data->results, data->vid, data->pid);
+	ScanDevices(context, items);
+	udev_unref(context);
+	return true;
 }
 
 /**********************************
  * Local Functions
  **********************************/
-static void WaitForDeviceHandled() {
-	uv_mutex_lock(&notify_mutex);
-	if(deviceHandled == false) {
-		uv_cond_wait(&notifyDeviceHandled, &notify_mutex);
+static PropertyTarget_t LookupProperty(const char* name) {
+	const PropertySlot_t& slot = propertyTable.slots[PropertyHash(name) & (PROPERTY_TABLE_SIZE - 1)];
+	if(slot.name == NULL || strcmp(slot.name, name) != 0) {
+		return PropertyTarget_None;
+	}
+	return slot.target;
+}
+
+static string* PropertyTargetString(ListResultItem_t* item, PropertyTarget_t target, unsigned int mask) {
+	switch(target) {
+		case PropertyTarget_Path:
+			return (mask & DEVICE_FIELD_BIT(DeviceField_Path)) ? &item->extraFields[DeviceField_Path] : NULL;
+		case PropertyTarget_Driver:
+			return (mask & DEVICE_FIELD_BIT(DeviceField_Driver)) ? &item->extraFields[DeviceField_Driver] : NULL;
+		default:
+			return NULL;
+	}
+}
+
+static int GetSysattrInt(struct udev_device* dev, const char* sysattr, int base) {
+	const char* value = udev_device_get_sysattr_value(dev, sysattr);
+	return value ? strtol(value, NULL, base) : 0;
+}
+
+// Reads the requested sysattr-backed extra fields. Property-backed ones are
+// filled in by whoever walks the property list.
+static void GetExtraSysattrs(struct udev_device* dev, ListResultItem_t* item, unsigned int mask) {
+	for(const ExtraSysattr_t& extra : extraSysattrs) {
+		if(!(mask & DEVICE_FIELD_BIT(extra.field))) {
+			continue;
+		}
+		const char* value = udev_device_get_sysattr_value(dev, extra.sysattr);
+		if(value) {
+			item->extraFields[extra.field] = value;
+		}
+	}
+	item->extraFieldMask = mask;
+}
+
+// The sysfs name of a usb_device is its port chain ("2-1.4.3", or "usb2" for
+// a root hub). It is always recorded since it keys the topology index.
+static void GetPortPath(struct udev_device* dev, ListResultItem_t* item) {
+	const char* sysname = udev_device_get_sysname(dev);
+	if(sysname) {
+		item->extraFields[DeviceField_PortPath] = sysname;
+		item->extraFieldMask |= DEVICE_FIELD_BIT(DeviceField_PortPath);
 	}
-	deviceHandled = false;
-	uv_mutex_unlock(&notify_mutex);
 }
 
-static void SignalDeviceHandled() {
-	uv_mutex_lock(&notify_mutex);
-	deviceHandled = true;
-	uv_cond_signal(&notifyDeviceHandled);
-	uv_mutex_unlock(&notify_mutex);
+// The string descriptors, as the raw sysattrs rather than the ID_MODEL,
+// ID_VENDOR and ID_SERIAL_SHORT properties: udev sanitises those and falls
+// back to the hex ids, so they would differ from what enumeration and the
+// inotify monitor read. Names missing there come from the hwdb, if enabled.
+static void GetDeviceStrings(struct udev_device* dev, ListResultItem_t* item) {
+	const char* value = udev_device_get_sysattr_value(dev, "product");
+	item->deviceName = value ? value : "";
+	value = udev_device_get_sysattr_value(dev, "manufacturer");
+	item->manufacturer = value ? value : "";
+	value = udev_device_get_sysattr_value(dev, "serial");
+	item->serialNumber = value ? value : "";
+	ResolveDeviceNames(item);
+}
+
+static bool IsChildSubsystem(const char* subsystem) {
+	if(subsystem == NULL) {
+		return false;
+	}
+	for(const char* child : childSubsystems) {
+		if(strcmp(subsystem, child) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// The registry key (devnode) of the usb_device a child device belongs to, or
+// NULL. Only works while the device is still in sysfs, i.e. not on remove.
+static const char* GetParentDeviceNode(struct udev_device* dev) {
+	struct udev_device* parent = udev_device_get_parent_with_subsystem_devtype(dev, DEVICE_SUBSYSTEM_USB, DEVICE_TYPE_DEVICE);
+	return parent ? udev_device_get_devnode(parent) : NULL;
 }
 
 static ListResultItem_t* GetProperties(struct udev_device* dev, ListResultItem_t* item) {
 	struct udev_list_entry* sysattrs;
 	struct udev_list_entry* entry;
+	unsigned int mask = GetExtraFieldMask();
+
 	sysattrs = udev_device_get_properties_list_entry(dev);
 	udev_list_entry_foreach(entry, sysattrs) {
-		const char *name, *value;
-		name = udev_list_entry_get_name(entry);
-		value = udev_list_entry_get_value(entry);
-
-		if(strcmp(name, DEVICE_PROPERTY_NAME) == 0) {
-			item->deviceName = value;
-		}
-		else if(strcmp(name, DEVICE_PROPERTY_SERIAL) == 0) {
-			item->serialNumber = value;
-		}
-		else if(strcmp(name, DEVICE_PROPERTY_VENDOR) == 0) {
-			item->manufacturer = value;
+		string* target = PropertyTargetString(item, LookupProperty(udev_list_entry_get_name(entry)), mask);
+		if(target) {
+			*target = udev_list_entry_get_value(entry);
 		}
 	}
-	item->vendorId = strtol(udev_device_get_sysattr_value(dev,"idVendor"), NULL, 16);
-	item->productId = strtol(udev_device_get_sysattr_value(dev,"idProduct"), NULL, 16);
-	item->deviceAddress = strtol(udev_device_get_sysattr_value(dev,"devnum"), NULL, 10);
-	item->locationId = strtol(udev_device_get_sysattr_value(dev,"busnum"), NULL, 10);
+	item->vendorId = GetSysattrInt(dev, "idVendor", 16);
+	item->productId = GetSysattrInt(dev, "idProduct", 16);
+	item->deviceAddress = GetSysattrInt(dev, "devnum", 10);
+	item->locationId = GetSysattrInt(dev, "busnum", 10);
+	GetDeviceStrings(dev, item);
+	GetExtraSysattrs(dev, item, mask);
+	GetPortPath(dev, item);
+	// Children bind after the device itself and are attached as they arrive
+	item->extraFieldMask |= DEVICE_FIELD_BIT(DeviceField_Nodes);
 
 	return item;
 }
 
-static void DeviceAdded(struct udev_device* dev) {
+// add, change, bind and unbind all describe the device as it is now, so each
+// is applied as an upsert. Returns false if nothing changed.
+static bool DeviceUpserted(struct udev_device* dev) {
 	DeviceItem_t* item = new DeviceItem_t();
 	GetProperties(dev, &item->deviceParams);
+	item->deviceState = DeviceState_Connect;
+	// A change of configuration changes the interfaces; it is one small
+	// sysfs read either way
+	ReadInterfaceTypes(udev_device_get_syspath(dev), &item->deviceParams);
+
+	ListResultItem_t stored;
+	ListResultItem_t replaced;
+	switch(UpsertItemInList((char *)udev_device_get_devnode(dev), item, &stored, &replaced)) {
+		case UpsertResult_Added:
+			NotifyAdded(&stored);
+			return true;
+		case UpsertResult_Replaced:
+			NotifyRemoved(&replaced);
+			NotifyAdded(&stored);
+			return true;
+		case UpsertResult_Changed:
+			NotifyChanged(&stored);
+			return true;
+		default:
+			return false;
+	}
+}
 
-	AddItemToList((char *)udev_device_get_devnode(dev), item);
-
-	currentItem = &item->deviceParams;
-	isAdded = true;
-
-	uv_async_send(&async_handler);
+static bool IsUpsertAction(const char* action) {
+	return strcmp(action, DEVICE_ACTION_ADDED) == 0 ||
+		strcmp(action, DEVICE_ACTION_CHANGED) == 0 ||
+		strcmp(action, DEVICE_ACTION_BOUND) == 0 ||
+		strcmp(action, DEVICE_ACTION_UNBOUND) == 0;
 }
 
 static void DeviceRemoved(struct udev_device* dev) {
 	ListResultItem_t* item = NULL;
 
-	if(IsItemAlreadyStored((char *)udev_device_get_devnode(dev))) {
-		DeviceItem_t* deviceItem = GetItemFromList((char *)udev_device_get_devnode(dev));
-		if(deviceItem) {
-			item = CopyElement(&deviceItem->deviceParams);
-		}
-		RemoveItemFromList(deviceItem);
+	DeviceItem_t* deviceItem = TakeItemFromList((char *)udev_device_get_devnode(dev));
+	if(deviceItem) {
+		item = CopyElement(&deviceItem->deviceParams);
 		delete deviceItem;
 	}
 
@@ -194,88 +441,200 @@ static void DeviceRemoved(struct udev_device* dev) {
 		GetProperties(dev, item);
 	}
 
-	currentItem = item;
-	isAdded = false;
+	NotifyRemoved(item);
+	delete item;
+}
+
+// Keeps the child node list of the parent usb_device up to date and reports
+// it as a change of the parent. Returns false if the event changed nothing.
+static bool ChildNodeChanged(struct udev_device* dev) {
+	const char* node = udev_device_get_devnode(dev);
+	const char* action = udev_device_get_action(dev);
+	ListResultItem_t parent;
+	bool changed = false;
+	if(strcmp(action, DEVICE_ACTION_ADDED) == 0) {
+		const char* parentNode = GetParentDeviceNode(dev);
+		changed = parentNode != NULL && AttachDeviceNode(parentNode, node, &parent);
+	}
+	else if(strcmp(action, DEVICE_ACTION_REMOVED) == 0) {
+		changed = DetachDeviceNode(node, &parent);
+	}
 
-	uv_async_send(&async_handler);
+	if(changed) {
+		NotifyChanged(&parent);
+	}
+	return changed;
 }
 
 
-static void cbWork(uv_work_t *req) {
-	// We have this check in case we `Stop` before this thread starts,
-	// otherwise the process will hang
-	if(!isRunning) {
+static void MonitorLoop() {
+	ApplyMonitorThreadOptions();
+	// Build the initial device list here rather than on the JS thread. It
+	// can't be interrupted, but only takes one scan of sysfs.
+	LazyInit();
+	// Hotplug events stay queued on the netlink socket until the registry
+	// has been reconciled with the system. Stop() cuts that wait short.
+	WaitForRescan();
+	if (!isRunning) {
+		return;
+	}
+	if (InotifyMonitorIsEnabled()) {
+		ServeMonitorTasks(true);
+		InotifyMonitorLoop(wakePipe[0], OnMonitorWake);
+		ServeMonitorTasks(false);
+		return;
+	}
+	if (!mon) {
 		return;
 	}
 
-	uv_signal_start(&int_signal, cbTerminate, SIGINT);
-	uv_signal_start(&term_signal, cbTerminate, SIGTERM);
-
-	pollfd fds = {fd, POLLIN, 0};
+	// Anything that arrived while stopped is still queued on the netlink
+	// socket and is applied to the registry first
+	ServeMonitorTasks(true);
+	pollfd fds[2] = {{fd, POLLIN, 0}, {wakePipe[0], POLLIN, 0}};
 	while (isRunning) {
-		int ret = poll(&fds, 1, 100);
-		if (!ret) continue;
+		int ret = poll(fds, 2, -1);
+		if (ret < 0 && errno == EINTR) continue;
 		if (ret < 0) break;
+		if (fds[1].revents) {
+			if (!OnMonitorWake()) break;
+			continue;
+		}
+		if (!fds[0].revents) continue;
 
-		dev = udev_monitor_receive_device(mon);
+		struct udev_device* dev = udev_monitor_receive_device(mon);
 		if (dev) {
+			METRICS_INCREMENT(Metric_UeventsReceived);
+			bool handled = false;
 			if(udev_device_get_devtype(dev) && strcmp(udev_device_get_devtype(dev), DEVICE_TYPE_DEVICE) == 0) {
-				if(strcmp(udev_device_get_action(dev), DEVICE_ACTION_ADDED) == 0) {
-					WaitForDeviceHandled();
-					DeviceAdded(dev);
+				if(IsUpsertAction(udev_device_get_action(dev))) {
+					handled = DeviceUpserted(dev);
 				}
 				else if(strcmp(udev_device_get_action(dev), DEVICE_ACTION_REMOVED) == 0) {
-					WaitForDeviceHandled();
 					DeviceRemoved(dev);
+					handled = true;
 				}
 			}
+			else if(udev_device_get_devnode(dev) && IsChildSubsystem(udev_device_get_subsystem(dev))) {
+				handled = ChildNodeChanged(dev);
+			}
+			if(!handled) {
+				METRICS_INCREMENT(Metric_UeventsFiltered);
+			}
 			udev_device_unref(dev);
 		}
 	}
-
-	// After the loop stops running, clean up all of our references and close gracefully
-	udev_monitor_unref(mon);
-	udev_unref(udev);
-	uv_mutex_destroy(&notify_mutex);
-	uv_signal_stop(&int_signal);
-	uv_signal_stop(&term_signal);
-	uv_close((uv_handle_t *) &async_handler, NULL);
-	uv_cond_destroy(&notifyDeviceHandled);
+	ServeMonitorTasks(false);
 }
 
-static void cbAfter(uv_work_t *req, int status) {
-	Stop();
+// Tasks queued before the thread stops serving them are run in order with
+// its events; the rest are turned away
+static void ServeMonitorTasks(bool serving) {
+	std::lock_guard<std::mutex> lock(taskMutex);
+	isServingTasks = serving;
+	if(!serving) {
+		for(MonitorTask_t& task : monitorTasks) {
+			task.finished->set_value(false);
+		}
+		monitorTasks.clear();
+	}
 }
 
-static void cbAsync(uv_async_t *handle) {
+// Woken through the pipe by Stop() or RunOnMonitorThread(). Returns false
+// if the thread should stop.
+static bool OnMonitorWake() {
+	char buffer[16];
+	while(read(wakePipe[0], buffer, sizeof(buffer)) > 0) {
+	}
 	if(!isRunning) {
-		return;
+		return false;
 	}
 
-	if (isAdded) {
-		NotifyAdded(currentItem);
+	std::deque<MonitorTask_t> tasks;
+	{
+		std::lock_guard<std::mutex> lock(taskMutex);
+		tasks.swap(monitorTasks);
 	}
-	else {
-		NotifyRemoved(currentItem);
+	for(MonitorTask_t& task : tasks) {
+		(*task.task)();
+		task.finished->set_value(true);
 	}
+	return true;
+}
 
-	// Delete Item in case of removal
-	if(isAdded == false) {
-		delete currentItem;
-	}
 
-	SignalDeviceHandled();
+static void BuildInitialDeviceList() {
+	list<DeviceItem_t*> items;
+	ScanDevices(udev, &items);
+
+	list<DeviceItem_t*>::iterator it;
+	for(it = items.begin(); it != items.end(); ++it) {
+		if(AddItemToList((*it)->GetKey(), *it) == 0) {
+			delete *it;
+		}
+	}
 }
 
+static void RescanFromCache() {
+	list<DeviceItem_t*> items;
+	if(ScanDeviceList(&items)) {
+		ReplaceList(&items);
+		SaveDeviceCache();
+	}
+
+	std::lock_guard<std::mutex> lock(rescan_mutex);
+	isRescanning = false;
+	rescanDone.notify_all();
+}
 
-static void cbTerminate(uv_signal_t *handle, int signum) {
-	Stop();
+static void WaitForRescan() {
+	std::unique_lock<std::mutex> lock(rescan_mutex);
+	rescanDone.wait(lock, [] { return !isRescanning || !isRunning; });
 }
 
+// Fills in the child node lists of freshly scanned items
+static void ScanChildNodes(struct udev* context, list<DeviceItem_t*>* items) {
+	map<string, DeviceItem_t*> byKey;
+	for(DeviceItem_t* item : *items) {
+		byKey[item->GetKey()] = item;
+	}
 
-static void BuildInitialDeviceList() {
-	/* Create a list of the devices */
-	enumerate = udev_enumerate_new(udev);
+	struct udev_enumerate* enumerate = udev_enumerate_new(context);
+	for(const char* subsystem : childSubsystems) {
+		udev_enumerate_add_match_subsystem(enumerate, subsystem);
+	}
+	udev_enumerate_scan_devices(enumerate);
+
+	struct udev_list_entry* entry;
+	udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(enumerate)) {
+		struct udev_device* dev = udev_device_new_from_syspath(context, udev_list_entry_get_name(entry));
+		if(dev == NULL) {
+			continue;
+		}
+		const char* node = udev_device_get_devnode(dev);
+		const char* parentNode = node ? GetParentDeviceNode(dev) : NULL;
+		if(parentNode) {
+			map<string, DeviceItem_t*>::iterator it = byKey.find(parentNode);
+			if(it != byKey.end()) {
+				AddToNodeList(&it->second->deviceParams.extraFields[DeviceField_Nodes], node);
+			}
+		}
+		udev_device_unref(dev);
+	}
+	udev_enumerate_unref(enumerate);
+}
+
+static void ScanDevices(struct udev* context, list<DeviceItem_t*>* items) {
+	struct udev_enumerate* enumerate;
+	struct udev_list_entry *devices, *dev_list_entry;
+	struct udev_device* dev;
+	unsigned int mask = GetExtraFieldMask();
+
+	/* Create a list of the devices. Only USB devices are walked, so the
+	   cost follows the number of USB devices rather than all of sysfs */
+	enumerate = udev_enumerate_new(context);
+	udev_enumerate_add_match_subsystem(enumerate, DEVICE_SUBSYSTEM_USB);
+	udev_enumerate_add_match_property(enumerate, "DEVTYPE", DEVICE_TYPE_DEVICE);
 	udev_enumerate_scan_devices(enumerate);
 	devices = udev_enumerate_get_list_entry(enumerate);
 	/* For each item enumerated, print out its information.
@@ -289,11 +648,12 @@ static void BuildInitialDeviceList() {
 		/* Get the filename of the /sys entry for the device
 		   and create a udev_device object (dev) representing it */
 		path = udev_list_entry_get_name(dev_list_entry);
-		dev = udev_device_new_from_syspath(udev, path);
+		dev = udev_device_new_from_syspath(context, path);
 
 		/* usb_device_get_devnode() returns the path to the device node
 		   itself in /dev. */
 		if(udev_device_get_devnode(dev) == NULL || udev_device_get_sysattr_value(dev,"idVendor") == NULL) {
+			udev_device_unref(dev);
 			continue;
 		}
 
@@ -308,24 +668,31 @@ static void BuildInitialDeviceList() {
 		DeviceItem_t* item = new DeviceItem_t();
 		item->deviceParams.vendorId = strtol (udev_device_get_sysattr_value(dev,"idVendor"), NULL, 16);
 		item->deviceParams.productId = strtol (udev_device_get_sysattr_value(dev,"idProduct"), NULL, 16);
-		if(udev_device_get_sysattr_value(dev,"product") != NULL) {
-			item->deviceParams.deviceName = udev_device_get_sysattr_value(dev,"product");
-		}
-		if(udev_device_get_sysattr_value(dev,"manufacturer") != NULL) {
-			item->deviceParams.manufacturer = udev_device_get_sysattr_value(dev,"manufacturer");
-		}
-		if(udev_device_get_sysattr_value(dev,"serial") != NULL) {
-			item->deviceParams.serialNumber = udev_device_get_sysattr_value(dev, "serial");
-		}
 		item->deviceParams.deviceAddress = strtol(udev_device_get_sysattr_value(dev,"devnum"), NULL, 10);
 		item->deviceParams.locationId = strtol(udev_device_get_sysattr_value(dev,"busnum"), NULL, 10);
+		GetDeviceStrings(dev, &item->deviceParams);
+		if(mask & DEVICE_FIELD_BIT(DeviceField_Path)) {
+			const char* value = udev_device_get_property_value(dev, DEVICE_PROPERTY_PATH);
+			item->deviceParams.extraFields[DeviceField_Path] = value ? value : "";
+		}
+		if(mask & DEVICE_FIELD_BIT(DeviceField_Driver)) {
+			const char* value = udev_device_get_property_value(dev, DEVICE_PROPERTY_DRIVER);
+			item->deviceParams.extraFields[DeviceField_Driver] = value ? value : "";
+		}
+		GetExtraSysattrs(dev, &item->deviceParams, mask);
+		GetPortPath(dev, &item->deviceParams);
+		ReadInterfaceTypes(path, &item->deviceParams);
+		item->deviceParams.extraFieldMask |= DEVICE_FIELD_BIT(DeviceField_Nodes);
 
 		item->deviceState = DeviceState_Connect;
+		item->SetKey((char *)udev_device_get_devnode(dev));
 
-		AddItemToList((char *)udev_device_get_devnode(dev), item);
+		items->push_back(item);
 
 		udev_device_unref(dev);
 	}
 	/* Free the enumerator object */
 	udev_enumerate_unref(enumerate);
+
+	ScanChildNodes(context, items);
 }
@@ -1,6 +1,9 @@
 
-#include "detection.h"
+#include "detectionCore.h"
 #include "deviceList.h"
+#include "metrics.h"
+#include "threadPolicy.h"
+#include "trace.h"
 
 #include <CoreFoundation/CoreFoundation.h>
 #include <IOKit/IOKitLib.h>
@@ -9,7 +12,6 @@
 #include <IOKit/usb/IOUSBLib.h>
 
 #include <sys/param.h>
-#include <napi.h>
 #include <atomic>
 #include <thread>
 #include <mutex>
@@ -28,12 +30,15 @@ typedef struct DeviceListItem {
  * Local Variables
  **********************************/
 static std::atomic<bool> gInitialDeviceImport{true};
+// Created once by InitDetection() and kept for the life of the process, so
+// that monitoring can be stopped and started again
 static IONotificationPortRef gNotifyPort;
 static io_iterator_t gAddedIter;
-static CFRunLoopRef gRunLoop;
+// Retained by the run loop thread; whoever takes it out releases it
+static std::atomic<CFRunLoopRef> gRunLoop{nullptr};
 static CFMutableDictionaryRef gMatchingDict;
-static CFRunLoopSourceRef gRunLoopSource;
 static std::atomic<bool> gIsRunning{false};
+static std::thread gRunLoopThread;
 
 /**********************************
  * Local Helper Functions prototypes
@@ -58,11 +63,15 @@ static void RunLoopThread();
 static void DeviceRemoved(void *refCon, io_service_t service, natural_t messageType, void *messageArgument) {
     stDeviceListItem* deviceListItem = (stDeviceListItem *) refCon;
     DeviceItem_t* deviceItem = deviceListItem->deviceItem;
+    METRICS_INCREMENT(Metric_UeventsReceived);
+    if(messageType != kIOMessageServiceIsTerminated) {
+        METRICS_INCREMENT(Metric_UeventsFiltered);
+    }
     if(messageType == kIOMessageServiceIsTerminated) {
         if(deviceListItem->deviceInterface) {
             (*deviceListItem->deviceInterface)->Release(deviceListItem->deviceInterface);
         }
-        printf("[DEBUG]  DeviceRemoved kIOMessageServiceIsTerminated %x  %s\n", messageType, deviceItem->GetKey());
+        DEBUG_LOG("DeviceRemoved kIOMessageServiceIsTerminated %x  %s", messageType, deviceItem->GetKey());
         IOObjectRelease(deviceListItem->notification);
 
         ListResultItem_t* item = nullptr;
@@ -74,16 +83,8 @@ static void DeviceRemoved(void *refCon, io_service_t service, natural_t messageT
             item = new ListResultItem_t();
         }
 
-        removedTsFunc.NonBlockingCall(item, [](Napi::Env env, Napi::Function callback, ListResultItem_t* data) {
-            Napi::Object obj = Napi::Object::New(env);
-            obj.Set("vendorId", data->vendorId);
-            obj.Set("productId", data->productId);
-            obj.Set("serialNumber", data->serialNumber);
-            obj.Set("deviceName", data->deviceName);
-            obj.Set("manufacturer", data->manufacturer);
-            callback.Call({obj});
-            delete data;
-        });
+        NotifyRemoved(item);
+        delete item;
     }
 }
 
@@ -107,8 +108,11 @@ static void DeviceAdded(void *refCon, io_iterator_t iterator) {
     IOCFPlugInInterface **plugInInterface = nullptr;
     SInt32 score;
     HRESULT res;
-    printf("[DEBUG]  DeviceAdded\n");
+    DEBUG_LOG("DeviceAdded");
     while((usbDevice = IOIteratorNext(iterator))) {
+        if(!gInitialDeviceImport.load()) {
+            METRICS_INCREMENT(Metric_UeventsReceived);
+        }
         io_name_t deviceName;
         CFStringRef deviceNameAsCFString;
         UInt32 locationID;
@@ -246,15 +250,7 @@ static void DeviceAdded(void *refCon, io_iterator_t iterator) {
         deviceListItem->deviceItem = deviceItem;
 
         if(!gInitialDeviceImport.load()) {
-            addedTsFunc.NonBlockingCall( &deviceItem->deviceParams, [](Napi::Env env, Napi::Function callback, ListResultItem_t* data) {
-                Napi::Object obj = Napi::Object::New(env);
-                obj.Set("vendorId", data->vendorId);
-                obj.Set("productId", data->productId);
-                obj.Set("serialNumber", data->serialNumber);
-                obj.Set("deviceName", data->deviceName);
-                obj.Set("manufacturer", data->manufacturer);
-                callback.Call({obj});
-            });
+            NotifyAdded(&deviceItem->deviceParams);
         }
 
         // Register for an interest notification of this device being removed. Use a reference to our
@@ -268,7 +264,7 @@ static void DeviceAdded(void *refCon, io_iterator_t iterator) {
             &deviceListItem->notification
         );
         if(kr != KERN_SUCCESS) {
-            printf("[DEBUG]  IOServiceAddInterestNotification kr != KERN_SUCCESS\n");
+            DEBUG_LOG("IOServiceAddInterestNotification kr != KERN_SUCCESS");
         }
         IOObjectRelease(usbDevice);
     }
@@ -276,16 +272,27 @@ static void DeviceAdded(void *refCon, io_iterator_t iterator) {
 
 void Start() {
     if(gIsRunning.exchange(true)) return;
-    std::thread(RunLoopThread).detach();
+    gRunLoopThread = std::thread(RunLoopThread);
 }
 
 void Stop() {
     if(!gIsRunning.exchange(false)) return;
-    if(gRunLoop) {
-        CFRunLoopPerformBlock(gRunLoop, kCFRunLoopCommonModes, ^{
-            CFRunLoopStop(gRunLoop);
+    // Taking the reference keeps the run loop alive even if its thread
+    // exits before it is woken up
+    CFRunLoopRef runLoop = gRunLoop.exchange(nullptr);
+    if(runLoop) {
+        CFRunLoopPerformBlock(runLoop, kCFRunLoopCommonModes, ^{
+            CFRunLoopStop(runLoop);
         });
-        CFRunLoopWakeUp(gRunLoop);
+        CFRunLoopWakeUp(runLoop);
+    }
+    // The run loop also checks gIsRunning every second, in case it had not
+    // started yet
+    if(gRunLoopThread.joinable()) {
+        gRunLoopThread.join();
+    }
+    if(runLoop) {
+        CFRelease(runLoop);
     }
 }
 
@@ -312,6 +319,7 @@ void InitDetection() {
 
     if(kr != KERN_SUCCESS) {
         IONotificationPortDestroy(gNotifyPort);
+        gNotifyPort = nullptr;
         return;
     }
 
@@ -319,27 +327,40 @@ void InitDetection() {
     gInitialDeviceImport.store(false);
 }
 
-void EIO_Find(napi_env env, void* data) {
-    ListBaton* baton = static_cast<ListBaton*>(data);
-    try {
-        CreateFilteredList(&baton->results, baton->vid, baton->pid);
-    } catch (const std::exception &e) {
-        strncpy(baton->errorString, e.what(), sizeof(baton->errorString)-1);
-    }
+// Fresh enumeration for reconcile() is not implemented for IOKit yet
+bool ScanDeviceList(std::list<DeviceItem_t*>* items) {
+    return false;
+}
+
+bool RunOnMonitorThread(const std::function<void()>& task) {
+    return false;
 }
 
 static void RunLoopThread() {
-    gRunLoopSource = IONotificationPortGetRunLoopSource(gNotifyPort);
-    gRunLoop = CFRunLoopGetCurrent();
-    CFRunLoopAddSource(gRunLoop, gRunLoopSource, kCFRunLoopDefaultMode);
+    ApplyMonitorThreadOptions();
+    // Build the initial device list here rather than on the JS thread
+    LazyInit();
+    if(!gNotifyPort) {
+        return;
+    }
+
+    // The source belongs to the notification port, which outlives this
+    // thread; only detach it from this thread's run loop on the way out.
+    // Notifications that arrive meanwhile wait on the port.
+    CFRunLoopSourceRef runLoopSource = IONotificationPortGetRunLoopSource(gNotifyPort);
+    CFRunLoopRef runLoop = CFRunLoopGetCurrent();
+    CFRunLoopAddSource(runLoop, runLoopSource, kCFRunLoopDefaultMode);
+    CFRetain(runLoop);
+    gRunLoop.store(runLoop);
 
     while(gIsRunning.load()) {
         CFRunLoopRunInMode(kCFRunLoopDefaultMode, 1.0, true);
     }
 
-    // Clean up
-    CFRunLoopRemoveSource(gRunLoop, gRunLoopSource, kCFRunLoopDefaultMode);
-    CFRelease(gRunLoopSource);
-    IOObjectRelease(gAddedIter);
-    IONotificationPortDestroy(gNotifyPort);
+    // Unless Stop() already took the reference
+    CFRunLoopRef retained = gRunLoop.exchange(nullptr);
+    if(retained) {
+        CFRelease(retained);
+    }
+    CFRunLoopRemoveSource(runLoop, runLoopSource, kCFRunLoopDefaultMode);
 }
\ No newline at end of file
@@ -1,4 +1,3 @@
-#include <napi.h>
 #include <windows.h>
 #include <dbt.h>
 #include <setupapi.h>
@@ -10,9 +9,10 @@
 #include <memory>
 #include <string>
 #include <tchar.h>
-#include "detection.h"
-
-using namespace Napi;
+#include "detectionCore.h"
+#include "metrics.h"
+#include "threadPolicy.h"
+#include "trace.h"
 
 // Macro definitions
 #define VID_TAG "VID_"
@@ -58,7 +58,6 @@ namespace
 static std::string WideToUTF8(const std::wstring &wstr);
 static std::wstring UTF8ToWide(const std::string &str);
 static void ExtractDeviceInfo(HDEVINFO hDevInfo, SP_DEVINFO_DATA *pspDevInfoData, TCHAR *buf, DWORD buffSize, ListResultItem_t *resultItem);
-static void NotifyJsCallback(bool isAdded, const WinDeviceInfo &device);
 static std::string Utf8Encode(const std::string &str);
 static void UpdateDevice(PDEV_BROADCAST_DEVICEINTERFACE pDevInf, WPARAM wParam, DeviceState_t state);
 static void ExtractVidPid(const std::string &deviceStr, ListResultItem_t *item);
@@ -122,11 +121,16 @@ LRESULT CALLBACK DetectCallback(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lPara
             PDEV_BROADCAST_HDR pHdr = (PDEV_BROADCAST_HDR)lParam;
             PDEV_BROADCAST_DEVICEINTERFACE pDevInf;
 
+            METRICS_INCREMENT(Metric_UeventsReceived);
             if (pHdr->dbch_devicetype == DBT_DEVTYP_DEVICEINTERFACE)
             {
                 pDevInf = (PDEV_BROADCAST_DEVICEINTERFACE)pHdr;
                 UpdateDevice(pDevInf, wParam, (DBT_DEVICEARRIVAL == wParam) ? DeviceState_Connect : DeviceState_Disconnect);
             }
+            else
+            {
+                METRICS_INCREMENT(Metric_UeventsFiltered);
+            }
         }
     }
 
@@ -137,7 +141,7 @@ DWORD WINAPI ListenerThread()
 {
     char className[MAX_THREAD_WINDOW_NAME];
     _snprintf_s(className, MAX_THREAD_WINDOW_NAME, "ListnerThreadUsbDetection_%d", GetCurrentThreadId());
-    printf("Registering window class\n");
+    DEBUG_LOG("Registering window class");
     WNDCLASSA wincl = {0};
     wincl.hInstance = GetModuleHandle(0);
     wincl.lpszClassName = className;
@@ -254,8 +258,14 @@ void BuildInitialDeviceList()
             DllSetupDiGetDeviceRegistryProperty(hDevInfo, pspDevInfoData, SPDRP_LOCATION_INFORMATION, &DataT, (PBYTE)buf, MAX_PATH, &nSize);
             DllSetupDiGetDeviceRegistryProperty(hDevInfo, pspDevInfoData, SPDRP_HARDWAREID, &DataT, (PBYTE)(buf + nSize - 1), MAX_PATH - nSize, &nSize);
 
-            AddItemToList(buf, item);
+            // Fill the item in before storing it: the registry indexes and
+            // accounts for it on insert. `buf` is scratch space from here.
+            tstring key = buf;
             ExtractDeviceInfo(hDevInfo, pspDevInfoData, buf, MAX_PATH, &item->deviceParams);
+            if (!AddItemToList((char *)key.c_str(), item))
+            {
+                delete item;
+            }
         }
 
         HeapFree(GetProcessHeap(), 0, pspDevInfoData);
@@ -321,16 +331,22 @@ void UpdateDevice(PDEV_BROADCAST_DEVICEINTERFACE pDevInf, WPARAM wParam, DeviceS
 
                 WinDeviceInfo deviceInfoChange;
                 deviceInfoChange.deviceId = buf;
-                printf("Device change: %s\n", buf);
+                DEBUG_LOG("Device change: %s", buf);
 
                 if (state == DeviceState_Connect)
                 {
                     DeviceItem_t *device = new DeviceItem_t();
 
-                    AddItemToList(buf, device);
+                    // Fill the item in before storing it, as in
+                    // BuildInitialDeviceList()
+                    tstring key = buf;
                     ExtractDeviceInfo(hDevInfo, pspDevInfoData, buf, MAX_PATH, &device->deviceParams);
-
                     deviceInfoChange.deviceData = device->deviceParams;
+                    deviceInfoChange.deviceData.handle = AddItemToList((char *)key.c_str(), device);
+                    if (deviceInfoChange.deviceData.handle == 0)
+                    {
+                        delete device;
+                    }
                 }
                 else
                 {
@@ -354,9 +370,17 @@ void UpdateDevice(PDEV_BROADCAST_DEVICEINTERFACE pDevInf, WPARAM wParam, DeviceS
                     }
 
                     deviceInfoChange.deviceData = *item;
+                    delete item;
                 }
 
-                NotifyJsCallback(wParam == DBT_DEVICEARRIVAL, deviceInfoChange);
+                if (wParam == DBT_DEVICEARRIVAL)
+                {
+                    NotifyAdded(&deviceInfoChange.deviceData);
+                }
+                else
+                {
+                    NotifyRemoved(&deviceInfoChange.deviceData);
+                }
                 break;
             }
         }
@@ -377,19 +401,15 @@ void InitDetection()
     BuildInitialDeviceList();
 }
 
-// Find operation
-void EIO_Find(napi_env env, void *data)
+// Fresh enumeration for reconcile() is not implemented for SetupAPI yet
+bool ScanDeviceList(std::list<DeviceItem_t *> *items)
 {
-    ListBaton *baton = static_cast<ListBaton *>(data);
+    return false;
+}
 
-    try
-    {
-        CreateFilteredList(&baton->results, baton->vid, baton->pid);
-    }
-    catch (const std::exception &e)
-    {
-        strncpy(baton->errorString, e.what(), sizeof(baton->errorString) - 1);
-    }
+bool RunOnMonitorThread(const std::function<void()> &task)
+{
+    return false;
 }
 
 // Start monitoring
@@ -398,14 +418,16 @@ void Start()
     if (isMonitoring.exchange(true))
         return;
 
-    printf("Starting monitoring\n");
+    DEBUG_LOG("Starting monitoring");
     listenerThread = std::thread([]
                                  {
         CoInitializeEx(nullptr, COINIT_MULTITHREADED);
-        printf("Starting listener thread\n");
+        ApplyMonitorThreadOptions();
+        LazyInit();
+        DEBUG_LOG("Starting listener thread");
         ListenerThread();
         // ListenerThreadMain();
-        printf("Listener thread stopped\n");
+        DEBUG_LOG("Listener thread stopped");
         CoUninitialize(); });
 }
 
@@ -435,25 +457,6 @@ void Stop()
 }
 
 
-static void NotifyJsCallback(bool isAdded, const WinDeviceInfo &device)
-{
-    auto tsFunc = isAdded ? addedTsFunc : removedTsFunc;
-    if (!tsFunc)
-        return;
-
-    auto deviceData = std::make_shared<ListResultItem_t>(device.deviceData);
-
-    tsFunc.BlockingCall(deviceData.get(), [deviceData](Napi::Env env, Napi::Function callback, ListResultItem_t *data)
-                        {
-        Napi::Object obj = Napi::Object::New(env);
-        obj.Set("vendorId", data->vendorId);
-        obj.Set("productId", data->productId);
-        obj.Set("serialNumber", data->serialNumber);
-        obj.Set("deviceName", data->deviceName);
-        obj.Set("manufacturer", data->manufacturer);
-        callback.Call({ obj }); });
-}
-
 std::string TrimNullTerminator(const std::string &str)
 {
     size_t end = str.find('\0');
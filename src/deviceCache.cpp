@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include <set>
+#include <string>
+#ifdef __linux__
+#include <dirent.h>
+#endif
+#include "deviceCache.h"
+
+using namespace std;
+
+/**********************************
+ * Local defines
+ **********************************/
+#define CACHE_MAGIC 0x44425355 // "USBD"
+#define CACHE_VERSION 4
+
+#define USB_DEV_ROOT "/dev/bus/usb"
+
+/**********************************
+ * Local typedefs
+ **********************************/
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t extraFieldMask;
+	uint32_t count;
+} CacheHeader_t;
+
+/**********************************
+ * Local Variables
+ **********************************/
+static mutex cachePathMutex;
+static string cachePath;
+
+/**********************************
+ * Local Helper Functions
+ **********************************/
+static bool WriteString(FILE *file, const string &value)
+{
+	uint16_t length = value.size() > 0xFFFF ? 0xFFFF : (uint16_t)value.size();
+	return fwrite(&length, sizeof(length), 1, file) == 1 &&
+		   fwrite(value.data(), 1, length, file) == length;
+}
+
+static bool ReadString(FILE *file, string *value)
+{
+	uint16_t length;
+	if (fread(&length, sizeof(length), 1, file) != 1)
+	{
+		return false;
+	}
+	value->resize(length);
+	return length == 0 || fread(&(*value)[0], 1, length, file) == length;
+}
+
+static bool WriteInt(FILE *file, int value)
+{
+	int32_t raw = value;
+	return fwrite(&raw, sizeof(raw), 1, file) == 1;
+}
+
+static bool ReadInt(FILE *file, int *value)
+{
+	int32_t raw;
+	if (fread(&raw, sizeof(raw), 1, file) != 1)
+	{
+		return false;
+	}
+	*value = raw;
+	return true;
+}
+
+static bool WriteInterfaces(FILE *file, const ListResultItem_t *params)
+{
+	uint8_t count = params->interfaceTypeCount;
+	return fwrite(&count, sizeof(count), 1, file) == 1 &&
+		   fwrite(params->interfaceTypes, sizeof(InterfaceType_t), count, file) == count;
+}
+
+static bool ReadInterfaces(FILE *file, ListResultItem_t *params)
+{
+	uint8_t count;
+	if (fread(&count, sizeof(count), 1, file) != 1 || count > MAX_INTERFACE_TYPES)
+	{
+		return false;
+	}
+	params->interfaceTypeCount = count;
+	return fread(params->interfaceTypes, sizeof(InterfaceType_t), count, file) == count;
+}
+
+static bool WriteItem(FILE *file, DeviceItem_t *item)
+{
+	ListResultItem_t *params = &item->deviceParams;
+	unsigned int mask = params->extraFieldMask;
+	bool ok = WriteInt(file, (int)mask) &&
+			  WriteString(file, item->GetKey()) &&
+			  WriteInt(file, params->locationId) &&
+			  WriteInt(file, params->vendorId) &&
+			  WriteInt(file, params->productId) &&
+			  WriteInt(file, params->deviceAddress) &&
+			  WriteString(file, params->deviceName) &&
+			  WriteString(file, params->manufacturer) &&
+			  WriteString(file, params->serialNumber) &&
+			  WriteInterfaces(file, params);
+
+	for (int field = 0; ok && field < DeviceField_Count; field++)
+	{
+		if (mask & DEVICE_FIELD_BIT(field))
+		{
+			ok = WriteString(file, params->extraFields[field]);
+		}
+	}
+
+	return ok;
+}
+
+static DeviceItem_t *ReadItem(FILE *file)
+{
+	string key;
+	int mask = 0;
+	DeviceItem_t *item = new DeviceItem_t();
+	ListResultItem_t *params = &item->deviceParams;
+
+	bool ok = ReadInt(file, &mask) &&
+			  ReadString(file, &key) &&
+			  ReadInt(file, &params->locationId) &&
+			  ReadInt(file, &params->vendorId) &&
+			  ReadInt(file, &params->productId) &&
+			  ReadInt(file, &params->deviceAddress) &&
+			  ReadString(file, &params->deviceName) &&
+			  ReadString(file, &params->manufacturer) &&
+			  ReadString(file, &params->serialNumber) &&
+			  ReadInterfaces(file, params);
+
+	for (int field = 0; ok && field < DeviceField_Count; field++)
+	{
+		if (mask & DEVICE_FIELD_BIT(field))
+		{
+			ok = ReadString(file, &params->extraFields[field]);
+		}
+	}
+
+	if (!ok)
+	{
+		delete item;
+		return NULL;
+	}
+
+	params->extraFieldMask = (unsigned int)mask;
+	item->deviceState = DeviceState_Connect;
+	item->SetKey((char *)key.c_str());
+	return item;
+}
+
+static void FreeItems(list<DeviceItem_t *> *items)
+{
+	list<DeviceItem_t *>::iterator it;
+	for (it = (*items).begin(); it != (*items).end(); ++it)
+	{
+		delete *it;
+	}
+	(*items).clear();
+}
+
+#ifdef __linux__
+// The cache is keyed by devnode (/dev/bus/usb/BBB/DDD). It is only trusted if
+// exactly the same nodes exist now and each one's bus/device number matches.
+static bool IsCacheCurrent(list<DeviceItem_t *> *items)
+{
+	set<string> present;
+	DIR *root = opendir(USB_DEV_ROOT);
+	if (root == NULL)
+	{
+		return false;
+	}
+
+	struct dirent *bus;
+	while ((bus = readdir(root)) != NULL)
+	{
+		if (bus->d_name[0] == '.')
+		{
+			continue;
+		}
+
+		string busPath = string(USB_DEV_ROOT "/") + bus->d_name;
+		DIR *busDir = opendir(busPath.c_str());
+		if (busDir == NULL)
+		{
+			continue;
+		}
+
+		struct dirent *node;
+		while ((node = readdir(busDir)) != NULL)
+		{
+			if (node->d_name[0] != '.')
+			{
+				present.insert(busPath + "/" + node->d_name);
+			}
+		}
+		closedir(busDir);
+	}
+	closedir(root);
+
+	if (present.size() != (*items).size())
+	{
+		return false;
+	}
+
+	list<DeviceItem_t *>::iterator it;
+	for (it = (*items).begin(); it != (*items).end(); ++it)
+	{
+		const char *key = (*it)->GetKey();
+		if (present.find(key) == present.end())
+		{
+			return false;
+		}
+
+		int busnum, devnum;
+		if (sscanf(key, USB_DEV_ROOT "/%d/%d", &busnum, &devnum) != 2 ||
+			busnum != (*it)->deviceParams.locationId ||
+			devnum != (*it)->deviceParams.deviceAddress)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+#else
+// No cheap way to validate a snapshot on this platform yet
+static bool IsCacheCurrent(list<DeviceItem_t *> *items)
+{
+	return false;
+}
+#endif
+
+/**********************************
+ * Public Functions
+ **********************************/
+void SetDeviceCachePath(const char *path)
+{
+	lock_guard<mutex> lock(cachePathMutex);
+	cachePath = path ? path : "";
+}
+
+bool IsDeviceCacheEnabled()
+{
+	lock_guard<mutex> lock(cachePathMutex);
+	return !cachePath.empty();
+}
+
+bool SaveDeviceCache()
+{
+	string path;
+	{
+		lock_guard<mutex> lock(cachePathMutex);
+		path = cachePath;
+	}
+	if (path.empty())
+	{
+		return false;
+	}
+
+	list<DeviceItem_t *> items;
+	CreateSnapshot(&items);
+
+	string tmpPath = path + ".tmp";
+	FILE *file = fopen(tmpPath.c_str(), "wb");
+	if (file == NULL)
+	{
+		FreeItems(&items);
+		return false;
+	}
+
+	unsigned int mask = GetExtraFieldMask();
+	CacheHeader_t header = {CACHE_MAGIC, CACHE_VERSION, (uint16_t)mask, (uint32_t)items.size()};
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+	list<DeviceItem_t *>::iterator it;
+	for (it = items.begin(); ok && it != items.end(); ++it)
+	{
+		ok = WriteItem(file, *it);
+	}
+	FreeItems(&items);
+
+	ok = fclose(file) == 0 && ok;
+	if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0)
+	{
+		remove(tmpPath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool LoadDeviceCache(list<DeviceItem_t *> *items)
+{
+	string path;
+	{
+		lock_guard<mutex> lock(cachePathMutex);
+		path = cachePath;
+	}
+	if (path.empty())
+	{
+		return false;
+	}
+
+	FILE *file = fopen(path.c_str(), "rb");
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	CacheHeader_t header;
+	// Snapshots taken with a different set of extra fields are not reused
+	bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+			  header.magic == CACHE_MAGIC &&
+			  header.version == CACHE_VERSION &&
+			  header.extraFieldMask == GetExtraFieldMask();
+
+	for (uint32_t i = 0; ok && i < header.count; i++)
+	{
+		DeviceItem_t *item = ReadItem(file);
+		ok = item != NULL;
+		if (ok)
+		{
+			(*items).push_back(item);
+		}
+	}
+	fclose(file);
+
+	if (!ok || !IsCacheCurrent(items))
+	{
+		FreeItems(items);
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,19 @@
+#ifndef _DEVICE_CACHE_H
+#define _DEVICE_CACHE_H
+
+#include <list>
+#include "deviceList.h"
+
+// On-disk snapshot of the device registry, used to answer `find()` straight
+// away on warm starts while a background rescan brings the registry up to date.
+
+void SetDeviceCachePath(const char *path);
+bool IsDeviceCacheEnabled();
+
+// Writes every stored item to the cache file (via a temporary file + rename)
+bool SaveDeviceCache();
+// Reads the cache file into `items` if it is well-formed and still matches the
+// devices currently present. Returns false (and leaves `items` empty) otherwise.
+bool LoadDeviceCache(std::list<DeviceItem_t *> *items);
+
+#endif
@@ -0,0 +1,280 @@
+#include <stdint.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include <unordered_map>
+#include <vector>
+#include "deviceColumns.h"
+#include "memoryUsage.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define COLUMNS_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+// Compiled with a target attribute and only used if the CPU reports AVX2, so
+// the addon keeps running on any x86-64
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define COLUMNS_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+/**********************************
+ * Local defines
+ **********************************/
+// The columns are padded with zero ids to a multiple of this, so every kernel
+// reads whole blocks. A zero vendor id never matches, since `vid` is non-zero.
+#define COLUMN_BLOCK 32
+
+// Estimated size of a slotOf node: the key/value pair, the chain link and its
+// bucket slot
+#define SLOT_ENTRY_BYTES (sizeof(unordered_map<DeviceItem_t *, uint32_t>::value_type) + 2 * sizeof(void *))
+// Per stored item: both ids, the item pointer and its slot entry
+#define COLUMN_ENTRY_BYTES (2 * sizeof(uint16_t) + sizeof(DeviceItem_t *) + SLOT_ENTRY_BYTES)
+
+/**********************************
+ * Local typedefs
+ **********************************/
+// Appends the items of every slot in [0, padded) whose ids match
+typedef void (*ColumnsKernel_f)(const uint16_t *vendorIds, const uint16_t *productIds, size_t padded, uint16_t vid, uint16_t pid, bool matchPid, vector<DeviceItem_t *> *matches, const vector<DeviceItem_t *> &items);
+
+/**********************************
+ * Local Variables
+ **********************************/
+// Dense: slots [0, items.size()) are in use and removal moves the last item
+// into the hole
+static vector<uint16_t> vendorIds;
+static vector<uint16_t> productIds;
+static vector<DeviceItem_t *> items;
+static unordered_map<DeviceItem_t *, uint32_t> slotOf;
+
+// Resolved on first use: CPU feature checks are not reliable during static
+// initialisation
+static ColumnsKernel_t currentKernel = ColumnsKernel_Auto;
+
+/**********************************
+ * Local Helper Functions
+ **********************************/
+static inline unsigned int LowestSetBit(uint32_t mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+// Appends the items of the set bits of a block's match mask
+static inline void CollectMatches(uint32_t mask, size_t base, vector<DeviceItem_t *> *matches, const vector<DeviceItem_t *> &stored)
+{
+	while (mask != 0)
+	{
+		size_t slot = base + LowestSetBit(mask);
+		mask &= mask - 1;
+		(*matches).push_back(stored[slot]);
+	}
+}
+
+static void MatchScalar(const uint16_t *vendors, const uint16_t *products, size_t padded, uint16_t vid, uint16_t pid, bool matchPid, vector<DeviceItem_t *> *matches, const vector<DeviceItem_t *> &stored)
+{
+	for (size_t slot = 0; slot < padded; slot++)
+	{
+		if (vendors[slot] == vid && (!matchPid || products[slot] == pid))
+		{
+			(*matches).push_back(stored[slot]);
+		}
+	}
+}
+
+#ifdef COLUMNS_HAVE_SSE2
+// 16 slots per step: two 8-lane compares packed into one byte mask
+static void MatchSSE2(const uint16_t *vendors, const uint16_t *products, size_t padded, uint16_t vid, uint16_t pid, bool matchPid, vector<DeviceItem_t *> *matches, const vector<DeviceItem_t *> &stored)
+{
+	const __m128i vidLanes = _mm_set1_epi16((short)vid);
+	const __m128i pidLanes = _mm_set1_epi16((short)pid);
+	for (size_t base = 0; base < padded; base += 16)
+	{
+		__m128i low = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(vendors + base)), vidLanes);
+		__m128i high = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(vendors + base + 8)), vidLanes);
+		if (matchPid)
+		{
+			low = _mm_and_si128(low, _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(products + base)), pidLanes));
+			high = _mm_and_si128(high, _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(products + base + 8)), pidLanes));
+		}
+		uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(low, high));
+		CollectMatches(mask, base, matches, stored);
+	}
+}
+#endif
+
+#ifdef COLUMNS_HAVE_AVX2
+// 32 slots per step. packs works per 128-bit lane, so the 64-bit quarters
+// are put back in slot order before taking the byte mask.
+__attribute__((target("avx2"))) static void MatchAVX2(const uint16_t *vendors, const uint16_t *products, size_t padded, uint16_t vid, uint16_t pid, bool matchPid, vector<DeviceItem_t *> *matches, const vector<DeviceItem_t *> &stored)
+{
+	const __m256i vidLanes = _mm256_set1_epi16((short)vid);
+	const __m256i pidLanes = _mm256_set1_epi16((short)pid);
+	for (size_t base = 0; base < padded; base += 32)
+	{
+		__m256i low = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)(vendors + base)), vidLanes);
+		__m256i high = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)(vendors + base + 16)), vidLanes);
+		if (matchPid)
+		{
+			low = _mm256_and_si256(low, _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)(products + base)), pidLanes));
+			high = _mm256_and_si256(high, _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)(products + base + 16)), pidLanes));
+		}
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(low, high), 0xd8);
+		uint32_t mask = (uint32_t)_mm256_movemask_epi8(packed);
+		CollectMatches(mask, base, matches, stored);
+	}
+}
+#endif
+
+static bool IsKernelSupported(ColumnsKernel_t kernel)
+{
+	switch (kernel)
+	{
+	case ColumnsKernel_Scalar:
+		return true;
+#ifdef COLUMNS_HAVE_SSE2
+	case ColumnsKernel_SSE2:
+		return true;
+#endif
+#ifdef COLUMNS_HAVE_AVX2
+	case ColumnsKernel_AVX2:
+		return __builtin_cpu_supports("avx2");
+#endif
+	default:
+		return false;
+	}
+}
+
+static ColumnsKernel_t BestKernel()
+{
+	if (IsKernelSupported(ColumnsKernel_AVX2))
+	{
+		return ColumnsKernel_AVX2;
+	}
+	if (IsKernelSupported(ColumnsKernel_SSE2))
+	{
+		return ColumnsKernel_SSE2;
+	}
+	return ColumnsKernel_Scalar;
+}
+
+static ColumnsKernel_f KernelFunction(ColumnsKernel_t kernel)
+{
+	switch (kernel)
+	{
+#ifdef COLUMNS_HAVE_AVX2
+	case ColumnsKernel_AVX2:
+		return MatchAVX2;
+#endif
+#ifdef COLUMNS_HAVE_SSE2
+	case ColumnsKernel_SSE2:
+		return MatchSSE2;
+#endif
+	default:
+		return MatchScalar;
+	}
+}
+
+/**********************************
+ * Public Functions
+ **********************************/
+void DeviceColumnsInsert(DeviceItem_t *item)
+{
+	if (!slotOf.insert(pair<DeviceItem_t *, uint32_t>(item, (uint32_t)items.size())).second)
+	{
+		return;
+	}
+
+	size_t slot = items.size();
+	if (slot == vendorIds.size())
+	{
+		vendorIds.resize(slot + COLUMN_BLOCK, 0);
+		productIds.resize(slot + COLUMN_BLOCK, 0);
+	}
+	vendorIds[slot] = (uint16_t)item->deviceParams.vendorId;
+	productIds[slot] = (uint16_t)item->deviceParams.productId;
+	items.push_back(item);
+	MemoryAccount(MemoryCategory_Registry, 1, COLUMN_ENTRY_BYTES);
+}
+
+void DeviceColumnsRemove(DeviceItem_t *item)
+{
+	unordered_map<DeviceItem_t *, uint32_t>::iterator it = slotOf.find(item);
+	if (it == slotOf.end())
+	{
+		return;
+	}
+
+	size_t slot = it->second;
+	size_t last = items.size() - 1;
+	slotOf.erase(it);
+	if (slot != last)
+	{
+		vendorIds[slot] = vendorIds[last];
+		productIds[slot] = productIds[last];
+		items[slot] = items[last];
+		slotOf[items[slot]] = (uint32_t)slot;
+	}
+	vendorIds[last] = 0;
+	productIds[last] = 0;
+	items.pop_back();
+	MemoryAccount(MemoryCategory_Registry, -1, -(int64_t)COLUMN_ENTRY_BYTES);
+}
+
+void DeviceColumnsClear()
+{
+	MemoryAccount(MemoryCategory_Registry, -(int64_t)items.size(), -(int64_t)(items.size() * COLUMN_ENTRY_BYTES));
+	vendorIds.clear();
+	productIds.clear();
+	items.clear();
+	slotOf.clear();
+}
+
+void DeviceColumnsMatch(int vid, int pid, vector<DeviceItem_t *> *matches)
+{
+	// Whole blocks only; the padding never matches
+	size_t padded = (items.size() + COLUMN_BLOCK - 1) / COLUMN_BLOCK * COLUMN_BLOCK;
+	if (currentKernel == ColumnsKernel_Auto)
+	{
+		currentKernel = BestKernel();
+	}
+	KernelFunction(currentKernel)(vendorIds.data(), productIds.data(), padded, (uint16_t)vid, (uint16_t)pid, pid != 0, matches, items);
+}
+
+bool DeviceColumnsSetKernel(ColumnsKernel_t kernel)
+{
+	if (kernel == ColumnsKernel_Auto)
+	{
+		kernel = BestKernel();
+	}
+	if (!IsKernelSupported(kernel))
+	{
+		return false;
+	}
+	currentKernel = kernel;
+	return true;
+}
+
+const char *DeviceColumnsKernelName()
+{
+	if (currentKernel == ColumnsKernel_Auto)
+	{
+		currentKernel = BestKernel();
+	}
+	switch (currentKernel)
+	{
+	case ColumnsKernel_AVX2:
+		return "avx2";
+	case ColumnsKernel_SSE2:
+		return "sse2";
+	default:
+		return "scalar";
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef _DEVICE_COLUMNS_H
+#define _DEVICE_COLUMNS_H
+
+#include <vector>
+#include "deviceList.h"
+
+// Structure-of-arrays mirror of the registry for filtered queries: the
+// vendor and product ids of every stored item in packed 16-bit columns, so
+// a vid/pid filter is a vector compare over contiguous memory (AVX2 or SSE2
+// where available, scalar otherwise) rather than a walk over map nodes.
+// The registry keeps it in sync under its own lock; none of these functions
+// lock.
+
+typedef enum _ColumnsKernel_t
+{
+	// The widest one the CPU supports
+	ColumnsKernel_Auto,
+	ColumnsKernel_Scalar,
+	ColumnsKernel_SSE2,
+	ColumnsKernel_AVX2,
+} ColumnsKernel_t;
+
+void DeviceColumnsInsert(DeviceItem_t *item);
+void DeviceColumnsRemove(DeviceItem_t *item);
+void DeviceColumnsClear();
+// Appends the stored items with vendor `vid` and, unless 0, product `pid`,
+// in no particular order. Both must be 16-bit ids and `vid` non-zero.
+void DeviceColumnsMatch(int vid, int pid, std::vector<DeviceItem_t *> *matches);
+
+// Selects the compare kernel, e.g. for benchmarks. Returns false (and keeps
+// the current one) if the CPU or the build does not support it.
+bool DeviceColumnsSetKernel(ColumnsKernel_t kernel);
+const char *DeviceColumnsKernelName();
+
+#endif
@@ -0,0 +1,43 @@
+#include <map>
+#include <mutex>
+#include "deviceEvents.h"
+
+using namespace std;
+
+typedef struct
+{
+	DeviceEventHandler_t handler;
+	void *context;
+} HandlerEntry_t;
+
+// Handlers run with this held, which is what lets RemoveDeviceEventHandler()
+// guarantee that a handler is not mid-call when it returns.
+static mutex handlersMutex;
+static map<int, HandlerEntry_t> handlers;
+static int nextHandlerId = 1;
+
+int AddDeviceEventHandler(DeviceEventHandler_t handler, void *context)
+{
+	lock_guard<mutex> lock(handlersMutex);
+	int handlerId = nextHandlerId++;
+	HandlerEntry_t entry = {handler, context};
+	handlers[handlerId] = entry;
+	return handlerId;
+}
+
+void RemoveDeviceEventHandler(int handlerId)
+{
+	lock_guard<mutex> lock(handlersMutex);
+	handlers.erase(handlerId);
+}
+
+void DispatchDeviceEvent(DeviceEvent_t event, ListResultItem_t *item)
+{
+	lock_guard<mutex> lock(handlersMutex);
+	map<int, HandlerEntry_t>::iterator it;
+
+	for (it = handlers.begin(); it != handlers.end(); ++it)
+	{
+		it->second.handler(event, item, it->second.context);
+	}
+}
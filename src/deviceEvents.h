@@ -0,0 +1,26 @@
+#ifndef _DEVICE_EVENTS_H
+#define _DEVICE_EVENTS_H
+
+#include "deviceList.h"
+
+// Fan-out of hotplug events from the single native monitor to any number of
+// consumers (one per Node.js environment, plus anything else that listens).
+
+typedef enum _DeviceEvent_t
+{
+	DeviceEvent_Added,
+	DeviceEvent_Removed,
+	// A stored device's details changed; see ListResultItem_t::changedFieldMask
+	DeviceEvent_Changed,
+} DeviceEvent_t;
+
+// Called on the monitor thread. `item` is only valid for the duration of the
+// call, so handlers must copy what they keep and must not block.
+typedef void (*DeviceEventHandler_t)(DeviceEvent_t event, ListResultItem_t *item, void *context);
+
+int AddDeviceEventHandler(DeviceEventHandler_t handler, void *context);
+// Once this returns the handler is not running and will not be called again
+void RemoveDeviceEventHandler(int handlerId);
+void DispatchDeviceEvent(DeviceEvent_t event, ListResultItem_t *item);
+
+#endif
@@ -1,25 +1,245 @@
+#include <algorithm>
+#include <atomic>
 #include <map>
+#include <mutex>
+#include <vector>
 #include <string.h>
 #include <stdio.h>
+#include "deviceColumns.h"
 #include "deviceList.h"
+#include "handleIndex.h"
+#include "memoryUsage.h"
+#include "nodeIndex.h"
+#include "topology.h"
+#include "usbDescriptors.h"
 
 using namespace std;
 
+// Column matches are only used if at most 1 in this many devices matched
+#define COLUMN_FILTER_MAX_SHARE 8
+
+// Estimated size of a deviceMap node: the key/value pair plus the tree links
+#define MAP_NODE_BYTES (sizeof(map<string, DeviceItem_t *>::value_type) + 4 * sizeof(void *))
+
 map<string, DeviceItem_t *> deviceMap;
 
-void AddItemToList(char *key, DeviceItem_t *item)
+// Guards deviceMap. The monitor thread, find work items and the cache rescan
+// all touch the registry concurrently; results are always copied out under it.
+static mutex deviceMapMutex;
+
+static atomic<unsigned int> extraFieldMask(0);
+
+// Bumped (under deviceMapMutex) on every change to the registry
+static atomic<uint64_t> generation(0);
+
+// Filtered queries over at least this many devices go through the id columns
+static atomic<size_t> columnFilterThreshold(DEFAULT_COLUMN_FILTER_THRESHOLD);
+
+// Adds (sign 1) or removes (sign -1) a stored item from the memory
+// accounting. Stored items are only modified between a removal and a re-add,
+// so both sides agree.
+static void AccountStoredItem(const string &mapKey, DeviceItem_t *item, int sign)
+{
+	int64_t stringCount;
+	int64_t stringBytes;
+	DeviceStringUsage(&item->deviceParams, &stringCount, &stringBytes);
+	size_t mapKeyBytes = StringHeapBytes(mapKey);
+	stringCount += mapKeyBytes > 0;
+	stringBytes += mapKeyBytes;
+
+	MemoryAccount(MemoryCategory_Registry, sign, sign * (int64_t)(sizeof(DeviceItem_t) + strlen(item->GetKey()) + 1 + MAP_NODE_BYTES));
+	MemoryAccount(MemoryCategory_Strings, sign * stringCount, sign * stringBytes);
+}
+
+// Adds a stored item to (or drops it from) everything that points at it.
+// Must hold deviceMapMutex.
+static void IndexItem(DeviceItem_t *item)
+{
+	TopologyInsert(item);
+	NodeIndexInsert(item);
+	HandleIndexInsert(item);
+	DeviceColumnsInsert(item);
+}
+
+static void UnindexItem(DeviceItem_t *item)
+{
+	TopologyRemove(item);
+	NodeIndexRemove(item);
+	HandleIndexRemove(item);
+	DeviceColumnsRemove(item);
+}
+
+uint64_t AddItemToList(char *key, DeviceItem_t *item)
 {
+	lock_guard<mutex> lock(deviceMapMutex);
 	item->SetKey(key);
-	deviceMap.insert(pair<string, DeviceItem_t *>(item->GetKey(), item));
+	pair<map<string, DeviceItem_t *>::iterator, bool> inserted = deviceMap.insert(pair<string, DeviceItem_t *>(item->GetKey(), item));
+	if (!inserted.second)
+	{
+		return 0;
+	}
+
+	item->deviceParams.handle = NewDeviceHandle();
+	AccountStoredItem(inserted.first->first, item, 1);
+	IndexItem(item);
+	generation++;
+	return item->deviceParams.handle;
+}
+
+// What an update of the same device changes. Child nodes are tracked by the
+// registry itself, so they are never part of an update.
+static unsigned int DiffDeviceFields(const ListResultItem_t *stored, const ListResultItem_t *update)
+{
+	const string empty;
+	unsigned int changed = 0;
+	if (stored->deviceName != update->deviceName)
+	{
+		changed |= DEVICE_CHANGED_DEVICE_NAME;
+	}
+	if (stored->manufacturer != update->manufacturer)
+	{
+		changed |= DEVICE_CHANGED_MANUFACTURER;
+	}
+	for (int field = 0; field < DeviceField_Count; field++)
+	{
+		unsigned int bit = DEVICE_FIELD_BIT(field);
+		if (field == DeviceField_Nodes || !((stored->extraFieldMask | update->extraFieldMask) & bit))
+		{
+			continue;
+		}
+		const string &before = (stored->extraFieldMask & bit) ? stored->extraFields[field] : empty;
+		const string &after = (update->extraFieldMask & bit) ? update->extraFields[field] : empty;
+		if (before != after)
+		{
+			changed |= bit;
+		}
+	}
+	return changed;
+}
+
+// What a rescan of the same device changes, its child nodes included
+static unsigned int DiffScannedFields(const ListResultItem_t *stored, const ListResultItem_t *scanned)
+{
+	const unsigned int nodesBit = DEVICE_FIELD_BIT(DeviceField_Nodes);
+	unsigned int changed = DiffDeviceFields(stored, scanned);
+	if ((stored->extraFieldMask & nodesBit) != (scanned->extraFieldMask & nodesBit) ||
+		stored->extraFields[DeviceField_Nodes] != scanned->extraFields[DeviceField_Nodes])
+	{
+		changed |= nodesBit;
+	}
+	return changed;
+}
+
+// Whether a rescan of the same device found anything the stored copy lacks
+static bool HasNewDetails(const ListResultItem_t *stored, const ListResultItem_t *scanned)
+{
+	return DiffScannedFields(stored, scanned) != 0 ||
+		   stored->interfaceTypeCount != scanned->interfaceTypeCount ||
+		   memcmp(stored->interfaceTypes, scanned->interfaceTypes, stored->interfaceTypeCount * sizeof(InterfaceType_t)) != 0;
+}
+
+UpsertResult_t UpsertItemInList(char *key, DeviceItem_t *item, ListResultItem_t *stored, ListResultItem_t *replaced)
+{
+	lock_guard<mutex> lock(deviceMapMutex);
+	item->SetKey(key);
+	map<string, DeviceItem_t *>::iterator it = deviceMap.find(item->GetKey());
+	if (it == deviceMap.end())
+	{
+		item->deviceParams.handle = NewDeviceHandle();
+		it = deviceMap.insert(pair<string, DeviceItem_t *>(item->GetKey(), item)).first;
+		AccountStoredItem(it->first, item, 1);
+		IndexItem(item);
+		generation++;
+		*stored = item->deviceParams;
+		return UpsertResult_Added;
+	}
+
+	DeviceItem_t *current = it->second;
+	if (!IsSameDevice(&current->deviceParams, &item->deviceParams))
+	{
+		// The node was reused by another device without a remove in between
+		*replaced = current->deviceParams;
+		AccountStoredItem(it->first, current, -1);
+		UnindexItem(current);
+		delete current;
+		it->second = item;
+		item->deviceParams.handle = NewDeviceHandle();
+		AccountStoredItem(it->first, item, 1);
+		IndexItem(item);
+		generation++;
+		*stored = item->deviceParams;
+		return UpsertResult_Replaced;
+	}
+
+	unsigned int changed = DiffDeviceFields(&current->deviceParams, &item->deviceParams);
+	// Every device has at least one interface, so no types means they could
+	// not be read; keep the stored ones then
+	ListResultItem_t &params = item->deviceParams;
+	if (params.interfaceTypeCount == 0)
+	{
+		params.interfaceTypeCount = current->deviceParams.interfaceTypeCount;
+		memcpy(params.interfaceTypes, current->deviceParams.interfaceTypes, sizeof(params.interfaceTypes));
+	}
+	bool interfacesChanged = params.interfaceTypeCount != current->deviceParams.interfaceTypeCount ||
+							 memcmp(params.interfaceTypes, current->deviceParams.interfaceTypes, params.interfaceTypeCount * sizeof(InterfaceType_t)) != 0;
+	if (changed != 0 || interfacesChanged)
+	{
+		// Update in place; the topology and the indexes point at this item
+		AccountStoredItem(it->first, current, -1);
+		params.handle = current->deviceParams.handle;
+		params.extraFields[DeviceField_Nodes].swap(current->deviceParams.extraFields[DeviceField_Nodes]);
+		params.extraFieldMask |= current->deviceParams.extraFieldMask & DEVICE_FIELD_BIT(DeviceField_Nodes);
+		current->deviceParams = params;
+		AccountStoredItem(it->first, current, 1);
+		generation++;
+	}
+	delete item;
+
+	*stored = current->deviceParams;
+	stored->changedFieldMask = changed;
+	return changed != 0 ? UpsertResult_Changed : UpsertResult_Unchanged;
 }
 
 void RemoveItemFromList(DeviceItem_t *item)
 {
-	deviceMap.erase(item->GetKey());
+	if (item == NULL)
+	{
+		return;
+	}
+
+	lock_guard<mutex> lock(deviceMapMutex);
+	UnindexItem(item);
+	map<string, DeviceItem_t *>::iterator it = deviceMap.find(item->GetKey());
+	if (it != deviceMap.end())
+	{
+		AccountStoredItem(it->first, it->second, -1);
+		deviceMap.erase(it);
+	}
+	generation++;
+}
+
+DeviceItem_t *TakeItemFromList(char *key)
+{
+	lock_guard<mutex> lock(deviceMapMutex);
+	map<string, DeviceItem_t *>::iterator it;
+
+	it = deviceMap.find(key);
+	if (it == deviceMap.end())
+	{
+		return NULL;
+	}
+
+	DeviceItem_t *item = it->second;
+	AccountStoredItem(it->first, item, -1);
+	UnindexItem(item);
+	deviceMap.erase(it);
+	generation++;
+	return item;
 }
 
 DeviceItem_t *GetItemFromList(char *key)
 {
+	lock_guard<mutex> lock(deviceMapMutex);
 	map<string, DeviceItem_t *>::iterator it;
 
 	it = deviceMap.find(key);
@@ -35,6 +255,7 @@ DeviceItem_t *GetItemFromList(char *key)
 
 bool IsItemAlreadyStored(char *key)
 {
+	lock_guard<mutex> lock(deviceMapMutex);
 	map<string, DeviceItem_t *>::iterator it;
 
 	it = deviceMap.find(key);
@@ -60,22 +281,436 @@ ListResultItem_t *CopyElement(ListResultItem_t *item)
 	dst->manufacturer = item->manufacturer;
 	dst->serialNumber = item->serialNumber;
 	dst->deviceAddress = item->deviceAddress;
+	dst->handle = item->handle;
+	dst->extraFieldMask = item->extraFieldMask;
+	dst->changedFieldMask = item->changedFieldMask;
+	dst->interfaceTypeCount = item->interfaceTypeCount;
+	memcpy(dst->interfaceTypes, item->interfaceTypes, item->interfaceTypeCount * sizeof(InterfaceType_t));
+	for (int field = 0; field < DeviceField_Count; field++)
+	{
+		if (item->extraFieldMask & DEVICE_FIELD_BIT(field))
+		{
+			dst->extraFields[field] = item->extraFields[field];
+		}
+	}
 
 	return dst;
 }
 
-void CreateFilteredList(list<ListResultItem_t *> *filteredList, int vid, int pid)
+bool IsSameDevice(const ListResultItem_t *a, const ListResultItem_t *b)
+{
+	return a->locationId == b->locationId &&
+		   a->deviceAddress == b->deviceAddress &&
+		   a->vendorId == b->vendorId &&
+		   a->productId == b->productId &&
+		   a->serialNumber == b->serialNumber;
+}
+
+static bool MatchesFilter(DeviceItem_t *item, int vid, int pid)
+{
+	return ((vid != 0 && pid != 0) && (vid == item->deviceParams.vendorId && pid == item->deviceParams.productId)) || ((vid != 0 && pid == 0) && vid == item->deviceParams.vendorId) || (vid == 0 && pid == 0);
+}
+
+static bool IsKeyOrdered(DeviceItem_t *a, DeviceItem_t *b)
+{
+	return strcmp(a->GetKey(), b->GetKey()) < 0;
+}
+
+// The stored items matching a filter, in key order either way. Must hold
+// deviceMapMutex.
+static void CollectFiltered(int vid, int pid, uint32_t interfaceQuery, vector<DeviceItem_t *> *matches)
+{
+	// The columns hold 16-bit ids and only answer vendor filters
+	bool isColumnFilter = vid > 0 && vid <= 0xffff && pid >= 0 && pid <= 0xffff;
+	if (isColumnFilter && deviceMap.size() >= columnFilterThreshold.load())
+	{
+		DeviceColumnsMatch(vid, pid, matches);
+		if (interfaceQuery != 0)
+		{
+			size_t kept = 0;
+			for (size_t i = 0; i < (*matches).size(); i++)
+			{
+				if (MatchesInterfaceQuery(&(*matches)[i]->deviceParams, interfaceQuery))
+				{
+					(*matches)[kept++] = (*matches)[i];
+				}
+			}
+			(*matches).resize(kept);
+		}
+		if ((*matches).size() <= deviceMap.size() / COLUMN_FILTER_MAX_SHARE)
+		{
+			sort((*matches).begin(), (*matches).end(), IsKeyOrdered);
+			return;
+		}
+		// Broad filters: sorting most of the registry by key costs more than
+		// the walk, which yields key order for free
+		(*matches).clear();
+	}
+
+	map<string, DeviceItem_t *>::iterator it;
+	for (it = deviceMap.begin(); it != deviceMap.end(); ++it)
+	{
+		if (MatchesFilter(it->second, vid, pid) && MatchesInterfaceQuery(&it->second->deviceParams, interfaceQuery))
+		{
+			(*matches).push_back(it->second);
+		}
+	}
+}
+
+void CreateFilteredList(list<ListResultItem_t *> *filteredList, int vid, int pid, uint32_t interfaceQuery)
+{
+	lock_guard<mutex> lock(deviceMapMutex);
+	vector<DeviceItem_t *> matches;
+
+	CollectFiltered(vid, pid, interfaceQuery, &matches);
+	for (size_t i = 0; i < matches.size(); i++)
+	{
+		(*filteredList).push_back(CopyElement(&matches[i]->deviceParams));
+	}
+}
+
+uint64_t CreateFilteredSnapshot(vector<ListResultItem_t> *snapshot, int vid, int pid, uint32_t interfaceQuery)
+{
+	lock_guard<mutex> lock(deviceMapMutex);
+	vector<DeviceItem_t *> matches;
+
+	CollectFiltered(vid, pid, interfaceQuery, &matches);
+	(*snapshot).reserve((*snapshot).size() + matches.size());
+	for (size_t i = 0; i < matches.size(); i++)
+	{
+		(*snapshot).push_back(matches[i]->deviceParams);
+	}
+
+	return generation.load();
+}
+
+void CreateSubtreeList(list<ListResultItem_t *> *subtreeList, const string &portPath)
+{
+	lock_guard<mutex> lock(deviceMapMutex);
+	vector<DeviceItem_t *> items;
+
+	TopologyCollectUnder(portPath, &items);
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		(*subtreeList).push_back(CopyElement(&items[i]->deviceParams));
+	}
+}
+
+void CreateTopologySnapshot(vector<TopologyEntry_t> *entries)
+{
+	lock_guard<mutex> lock(deviceMapMutex);
+
+	TopologyCollectAll(entries);
+	// Hand out copies; the registry may drop the originals at any time
+	for (size_t i = 0; i < (*entries).size(); i++)
+	{
+		DeviceItem_t *original = (*entries)[i].item;
+		if (original != NULL)
+		{
+			DeviceItem_t *copy = new DeviceItem_t();
+			copy->deviceParams = original->deviceParams;
+			copy->deviceState = original->deviceState;
+			copy->SetKey(original->GetKey());
+			(*entries)[i].item = copy;
+		}
+	}
+}
+
+size_t GetDeviceCount()
+{
+	lock_guard<mutex> lock(deviceMapMutex);
+	return deviceMap.size();
+}
+
+void SetExtraFieldMask(unsigned int mask)
+{
+	extraFieldMask.store(mask);
+}
+
+unsigned int GetExtraFieldMask()
+{
+	return extraFieldMask.load();
+}
+
+void SetColumnFilterThreshold(size_t threshold)
+{
+	columnFilterThreshold.store(threshold);
+}
+
+void CreateSnapshot(list<DeviceItem_t *> *snapshot)
 {
+	lock_guard<mutex> lock(deviceMapMutex);
 	map<string, DeviceItem_t *>::iterator it;
 
 	for (it = deviceMap.begin(); it != deviceMap.end(); ++it)
 	{
-		DeviceItem_t *item = it->second;
+		DeviceItem_t *copy = new DeviceItem_t();
+		copy->deviceParams = it->second->deviceParams;
+		copy->deviceState = it->second->deviceState;
+		copy->SetKey(it->second->GetKey());
+		(*snapshot).push_back(copy);
+	}
+}
+
+void ReplaceList(list<DeviceItem_t *> *items)
+{
+	map<string, DeviceItem_t *> replaced;
+	list<DeviceItem_t *>::iterator it;
 
-		if (
-				((vid != 0 && pid != 0) && (vid == item->deviceParams.vendorId && pid == item->deviceParams.productId)) || ((vid != 0 && pid == 0) && vid == item->deviceParams.vendorId) || (vid == 0 && pid == 0))
+	for (it = (*items).begin(); it != (*items).end(); ++it)
+	{
+		if (!replaced.insert(pair<string, DeviceItem_t *>((*it)->GetKey(), *it)).second)
 		{
-			(*filteredList).push_back(CopyElement(&item->deviceParams));
+			delete *it;
 		}
 	}
+	(*items).clear();
+
+	{
+		lock_guard<mutex> lock(deviceMapMutex);
+		// Devices that are still there keep their handles
+		map<string, DeviceItem_t *>::iterator item;
+		for (item = replaced.begin(); item != replaced.end(); ++item)
+		{
+			map<string, DeviceItem_t *>::iterator stored = deviceMap.find(item->first);
+			if (stored != deviceMap.end() && IsSameDevice(&stored->second->deviceParams, &item->second->deviceParams))
+			{
+				item->second->deviceParams.handle = stored->second->deviceParams.handle;
+			}
+			else
+			{
+				item->second->deviceParams.handle = NewDeviceHandle();
+			}
+		}
+
+		deviceMap.swap(replaced);
+		generation++;
+
+		TopologyClear();
+		NodeIndexClear();
+		HandleIndexClear();
+		DeviceColumnsClear();
+		for (item = deviceMap.begin(); item != deviceMap.end(); ++item)
+		{
+			AccountStoredItem(item->first, item->second, 1);
+			IndexItem(item->second);
+		}
+	}
+
+	map<string, DeviceItem_t *>::iterator old;
+	for (old = replaced.begin(); old != replaced.end(); ++old)
+	{
+		AccountStoredItem(old->first, old->second, -1);
+		delete old->second;
+	}
+}
+
+uint64_t GetListGeneration()
+{
+	return generation.load();
+}
+
+// Rewrites a stored item's child nodes, and copies the result to `updated` if
+// given. Must hold deviceMapMutex.
+static void SetStoredNodes(map<string, DeviceItem_t *>::iterator it, const string &nodes, ListResultItem_t *updated)
+{
+	DeviceItem_t *item = it->second;
+	AccountStoredItem(it->first, item, -1);
+	NodeIndexRemove(item);
+	item->deviceParams.extraFields[DeviceField_Nodes] = nodes;
+	item->deviceParams.extraFieldMask |= DEVICE_FIELD_BIT(DeviceField_Nodes);
+	NodeIndexInsert(item);
+	AccountStoredItem(it->first, item, 1);
+	generation++;
+
+	if (updated != NULL)
+	{
+		*updated = item->deviceParams;
+		updated->changedFieldMask = DEVICE_FIELD_BIT(DeviceField_Nodes);
+	}
+}
+
+// Must hold deviceMapMutex
+static bool DetachStoredNode(const string &node, ListResultItem_t *updated)
+{
+	DeviceItem_t *owner = NodeIndexFind(node);
+	if (owner == NULL)
+	{
+		return false;
+	}
+
+	map<string, DeviceItem_t *>::iterator it = deviceMap.find(owner->GetKey());
+	string nodes = owner->deviceParams.extraFields[DeviceField_Nodes];
+	if (it == deviceMap.end() || !RemoveFromNodeList(&nodes, node))
+	{
+		return false;
+	}
+	SetStoredNodes(it, nodes, updated);
+	return true;
+}
+
+bool AttachDeviceNode(const char *key, const char *node, ListResultItem_t *owner)
+{
+	lock_guard<mutex> lock(deviceMapMutex);
+	map<string, DeviceItem_t *>::iterator it = deviceMap.find(key);
+	if (it == deviceMap.end() || NodeIndexFind(node) == it->second)
+	{
+		return false;
+	}
+
+	// A node name left behind by a device that went away without a remove
+	DetachStoredNode(node, NULL);
+	string nodes = it->second->deviceParams.extraFields[DeviceField_Nodes];
+	if (!AddToNodeList(&nodes, node))
+	{
+		return false;
+	}
+	SetStoredNodes(it, nodes, owner);
+	return true;
+}
+
+bool DetachDeviceNode(const char *node, ListResultItem_t *owner)
+{
+	lock_guard<mutex> lock(deviceMapMutex);
+	return DetachStoredNode(node, owner);
+}
+
+ListResultItem_t *FindItemByNode(const char *node)
+{
+	lock_guard<mutex> lock(deviceMapMutex);
+	DeviceItem_t *owner = NodeIndexFind(node);
+	return owner != NULL ? CopyElement(&owner->deviceParams) : NULL;
+}
+
+ListResultItem_t *FindItemByHandle(uint64_t handle)
+{
+	lock_guard<mutex> lock(deviceMapMutex);
+	DeviceItem_t *item = HandleIndexFind(handle);
+	return item != NULL ? CopyElement(&item->deviceParams) : NULL;
+}
+
+bool ReconcileList(list<DeviceItem_t *> *scanned, uint64_t expectedGeneration, list<ListResultItem_t *> *added, list<ListResultItem_t *> *removed, list<ListResultItem_t *> *updated)
+{
+	// Sort the scan by key, the same order deviceMap iterates in
+	vector<DeviceItem_t *> sorted((*scanned).begin(), (*scanned).end());
+	(*scanned).clear();
+	sort(sorted.begin(), sorted.end(), [](DeviceItem_t *a, DeviceItem_t *b) {
+		return strcmp(a->GetKey(), b->GetKey()) < 0;
+	});
+	vector<DeviceItem_t *> unique;
+	unique.reserve(sorted.size());
+	for (DeviceItem_t *item : sorted)
+	{
+		if (!unique.empty() && strcmp(unique.back()->GetKey(), item->GetKey()) == 0)
+		{
+			delete item;
+			continue;
+		}
+		unique.push_back(item);
+	}
+	sorted.swap(unique);
+
+	lock_guard<mutex> lock(deviceMapMutex);
+	if (generation.load() != expectedGeneration)
+	{
+		for (DeviceItem_t *item : sorted)
+		{
+			delete item;
+		}
+		return false;
+	}
+
+	bool changed = false;
+	map<string, DeviceItem_t *>::iterator it = deviceMap.begin();
+	size_t i = 0;
+	while (it != deviceMap.end() || i < sorted.size())
+	{
+		int order;
+		if (it == deviceMap.end())
+		{
+			order = 1;
+		}
+		else if (i == sorted.size())
+		{
+			order = -1;
+		}
+		else
+		{
+			order = strcmp(it->first.c_str(), sorted[i]->GetKey());
+		}
+
+		if (order < 0)
+		{
+			// Stored but no longer present
+			changed = true;
+			(*removed).push_back(CopyElement(&it->second->deviceParams));
+			AccountStoredItem(it->first, it->second, -1);
+			UnindexItem(it->second);
+			delete it->second;
+			it = deviceMap.erase(it);
+		}
+		else if (order > 0)
+		{
+			// Present but never stored
+			DeviceItem_t *item = sorted[i++];
+			changed = true;
+			map<string, DeviceItem_t *>::iterator inserted = deviceMap.insert(it, pair<string, DeviceItem_t *>(item->GetKey(), item));
+			item->deviceParams.handle = NewDeviceHandle();
+			AccountStoredItem(inserted->first, item, 1);
+			IndexItem(item);
+			(*added).push_back(CopyElement(&item->deviceParams));
+		}
+		else if (IsSameDevice(&it->second->deviceParams, &sorted[i]->deviceParams) && !HasNewDetails(&it->second->deviceParams, &sorted[i]->deviceParams))
+		{
+			delete sorted[i++];
+			++it;
+		}
+		else if (IsSameDevice(&it->second->deviceParams, &sorted[i]->deviceParams))
+		{
+			// Refresh the stored details in place; the topology and the
+			// handle index point at this item
+			changed = true;
+			unsigned int fields = DiffScannedFields(&it->second->deviceParams, &sorted[i]->deviceParams);
+			uint64_t handle = it->second->deviceParams.handle;
+			AccountStoredItem(it->first, it->second, -1);
+			NodeIndexRemove(it->second);
+			it->second->deviceParams = sorted[i]->deviceParams;
+			it->second->deviceParams.handle = handle;
+			NodeIndexInsert(it->second);
+			AccountStoredItem(it->first, it->second, 1);
+			// Like an upsert, only reported if a field users see differs
+			if (fields != 0)
+			{
+				ListResultItem_t *copy = CopyElement(&it->second->deviceParams);
+				copy->changedFieldMask = fields;
+				(*updated).push_back(copy);
+			}
+			delete sorted[i++];
+			++it;
+		}
+		else
+		{
+			// The node was reused by another device
+			DeviceItem_t *item = sorted[i++];
+			changed = true;
+			(*removed).push_back(CopyElement(&it->second->deviceParams));
+			AccountStoredItem(it->first, it->second, -1);
+			UnindexItem(it->second);
+			delete it->second;
+			it->second = item;
+			item->deviceParams.handle = NewDeviceHandle();
+			AccountStoredItem(it->first, item, 1);
+			IndexItem(item);
+			(*added).push_back(CopyElement(&item->deviceParams));
+			++it;
+		}
+	}
+
+	// An unchanged registry keeps its generation, so a rescan racing with
+	// nothing never invalidates anyone else's scan
+	if (changed)
+	{
+		generation++;
+	}
+	return true;
 }
@@ -1,19 +1,69 @@
 #ifndef _DEVICE_LIST_H
 #define _DEVICE_LIST_H
 
+#include <stdint.h>
+#include <string.h>
 #include <string>
 #include <list>
+#include <vector>
+
+// Optional fields. They are only read from the system and marshalled to JS
+// when requested through SetExtraFieldMask().
+typedef enum _DeviceField_t
+{
+	DeviceField_Path,
+	DeviceField_Driver,
+	DeviceField_Speed,
+	DeviceField_DeviceClass,
+	DeviceField_BcdDevice,
+	// Always recorded where known (it keys the topology index), but only
+	// marshalled when requested
+	DeviceField_PortPath,
+	// Newline-separated device nodes of the device's children (tty, hidraw,
+	// block, input, sg). Tracked where supported, but only marshalled when
+	// requested.
+	DeviceField_Nodes,
+	DeviceField_Count
+} DeviceField_t;
+
+#define DEVICE_FIELD_BIT(field) (1u << (field))
+// Bits of ListResultItem_t::changedFieldMask besides the DEVICE_FIELD_BIT()s
+#define DEVICE_CHANGED_DEVICE_NAME DEVICE_FIELD_BIT(DeviceField_Count)
+#define DEVICE_CHANGED_MANUFACTURER DEVICE_FIELD_BIT(DeviceField_Count + 1)
+
+// Distinct interface types kept per device; further ones are dropped
+#define MAX_INTERFACE_TYPES 8
+
+typedef struct
+{
+	uint8_t interfaceClass;
+	uint8_t interfaceSubclass;
+	uint8_t protocol;
+} InterfaceType_t;
 
 typedef struct
 {
 public:
-	int locationId;
-	int vendorId;
-	int productId;
+	int locationId = 0;
+	int vendorId = 0;
+	int productId = 0;
 	std::string deviceName;
 	std::string manufacturer;
 	std::string serialNumber;
-	int deviceAddress;
+	int deviceAddress = 0;
+	// Session handle, assigned when the device is stored in the registry and
+	// unique per connection for the life of the process. 0 if never stored.
+	uint64_t handle = 0;
+	// Bitmask of DEVICE_FIELD_BIT()s populated in extraFields
+	unsigned int extraFieldMask = 0;
+	// On change events, the DEVICE_FIELD_BIT()s and DEVICE_CHANGED_*s that
+	// differ from the device as it was stored. 0 otherwise.
+	unsigned int changedFieldMask = 0;
+	std::string extraFields[DeviceField_Count];
+	// The distinct types of the interfaces in any configuration, read once
+	// from the device's descriptors (see usbDescriptors.h). Linux only.
+	uint8_t interfaceTypeCount = 0;
+	InterfaceType_t interfaceTypes[MAX_INTERFACE_TYPES] = {};
 } ListResultItem_t;
 
 typedef enum _DeviceState_t
@@ -40,18 +90,21 @@ public:
 	{
 		if (this->key != NULL)
 		{
-			delete this->key;
+			delete[] this->key;
 		}
 	}
 
 	void SetKey(char *key)
 	{
+		// Copy first: `key` may be this item's own key
+		size_t size = strlen(key) + 1;
+		char *copy = new char[size];
+		memcpy(copy, key, size);
 		if (this->key != NULL)
 		{
-			delete this->key;
+			delete[] this->key;
 		}
-		this->key = new char[strlen(key) + 1];
-		memcpy(this->key, key, strlen(key) + 1);
+		this->key = copy;
 	}
 
 	char *GetKey()
@@ -60,11 +113,74 @@ public:
 	}
 } DeviceItem_t;
 
-void AddItemToList(char *key, DeviceItem_t *item);
+// Stores `item` under `key` and returns the handle assigned to it, or 0 if
+// `key` is already stored (the caller then still owns `item`)
+uint64_t AddItemToList(char *key, DeviceItem_t *item);
+
+typedef enum _UpsertResult_t
+{
+	// Nothing was stored under the key
+	UpsertResult_Added,
+	// The same device was stored; `stored->changedFieldMask` says what differs
+	UpsertResult_Changed,
+	UpsertResult_Unchanged,
+	// Another device was stored under the key and has been dropped
+	UpsertResult_Replaced,
+} UpsertResult_t;
+
+// Stores `item` under `key`, or merges it into the same device already stored
+// there, keeping its handle and child nodes. `item` is always consumed.
+// `stored` receives a copy of what is stored afterwards, and `replaced` the
+// device that was dropped for UpsertResult_Replaced. New interface types
+// are stored too, but only other fields count as a change; an `item`
+// without any keeps the stored ones.
+UpsertResult_t UpsertItemInList(char *key, DeviceItem_t *item, ListResultItem_t *stored, ListResultItem_t *replaced);
 void RemoveItemFromList(DeviceItem_t *item);
+// Unlinks the item stored under `key` and hands it to the caller, or returns NULL
+DeviceItem_t *TakeItemFromList(char *key);
 bool IsItemAlreadyStored(char *identifier);
 DeviceItem_t *GetItemFromList(char *key);
 ListResultItem_t *CopyElement(ListResultItem_t *item);
-void CreateFilteredList(std::list<ListResultItem_t *> *filteredList, int vid, int pid);
+// Same physical device (address, ids and serial), ignoring descriptive fields
+bool IsSameDevice(const ListResultItem_t *a, const ListResultItem_t *b);
+// Copies of the devices matching `vid`/`pid` and, unless 0, an interface
+// query from MakeInterfaceQuery() (see usbDescriptors.h)
+void CreateFilteredList(std::list<ListResultItem_t *> *filteredList, int vid, int pid, uint32_t interfaceQuery = 0);
+// Same filter, as plain values; returns the generation the snapshot belongs to
+uint64_t CreateFilteredSnapshot(std::vector<ListResultItem_t> *snapshot, int vid, int pid, uint32_t interfaceQuery = 0);
+// Filtered queries over at least this many stored devices match against the
+// id columns (see deviceColumns.h) instead of walking the map; see the filter
+// crossover table of bench/coreBench.cpp.
+#define DEFAULT_COLUMN_FILTER_THRESHOLD 16
+void SetColumnFilterThreshold(size_t threshold);
+// Copies of the devices at or below a port path (see topology.h)
+void CreateSubtreeList(std::list<ListResultItem_t *> *subtreeList, const std::string &portPath);
+size_t GetDeviceCount();
+void SetExtraFieldMask(unsigned int mask);
+unsigned int GetExtraFieldMask();
+// Deep copies of every stored item, keys included
+void CreateSnapshot(std::list<DeviceItem_t *> *snapshot);
+// Swap the whole registry for `items` (which must already carry their keys)
+void ReplaceList(std::list<DeviceItem_t *> *items);
+// Changes on every add, remove, replace or child node change
+uint64_t GetListGeneration();
+// Records `node` as a child device node of the item stored under `key`, taking
+// it from any other item. Returns false if there is no such item or it
+// already has the node. `owner` receives a copy of the updated item, with
+// DeviceField_Nodes in its changedFieldMask.
+bool AttachDeviceNode(const char *key, const char *node, ListResultItem_t *owner = NULL);
+// Drops `node` from whichever item has it; returns false if none does
+bool DetachDeviceNode(const char *node, ListResultItem_t *owner = NULL);
+// A copy of the item with `node` as a child device node, or NULL
+ListResultItem_t *FindItemByNode(const char *node);
+// A copy of the stored item with `handle`, or NULL
+ListResultItem_t *FindItemByHandle(uint64_t handle);
+// Merge-diffs a fresh scan (items with keys) against the registry and applies
+// the difference, returning copies of what was added and removed, and of what
+// was updated in place with their changedFieldMask. `scanned` is always
+// consumed. Returns false without changing anything if the registry has
+// changed since `expectedGeneration`, i.e. the scan may already be stale.
+// The generation only advances if the scan differed from the registry.
+bool ReconcileList(std::list<DeviceItem_t *> *scanned, uint64_t expectedGeneration, std::list<ListResultItem_t *> *added, std::list<ListResultItem_t *> *removed, std::list<ListResultItem_t *> *updated);
 
 #endif
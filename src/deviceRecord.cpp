@@ -0,0 +1,71 @@
+#include <string.h>
+#include "deviceRecord.h"
+#include "usbDescriptors.h"
+
+using namespace std;
+
+/**********************************
+ * Public Functions
+ **********************************/
+void CopyRecordString(char *dst, const string &src)
+{
+	size_t length = src.size() < DEVICE_RECORD_STRING_SIZE - 1 ? src.size() : DEVICE_RECORD_STRING_SIZE - 1;
+	memcpy(dst, src.data(), length);
+	memset(dst + length, 0, DEVICE_RECORD_STRING_SIZE - length);
+}
+
+string ReadRecordString(const char *src)
+{
+	return string(src, strnlen(src, DEVICE_RECORD_STRING_SIZE));
+}
+
+void EncodeDeviceRecord(const ListResultItem_t *item, DeviceRecord_t *record)
+{
+	// Records leave the process, so no stale bytes in the padding either
+	memset(record, 0, sizeof(DeviceRecord_t));
+	record->locationId = item->locationId;
+	record->vendorId = item->vendorId;
+	record->productId = item->productId;
+	record->deviceAddress = item->deviceAddress;
+	record->extraFieldMask = item->extraFieldMask;
+	CopyRecordString(record->deviceName, item->deviceName);
+	CopyRecordString(record->manufacturer, item->manufacturer);
+	CopyRecordString(record->serialNumber, item->serialNumber);
+	for (int field = 0; field < DeviceField_Count; field++)
+	{
+		CopyRecordString(record->extraFields[field], item->extraFields[field]);
+	}
+	record->interfaceTypeCount = item->interfaceTypeCount;
+	memcpy(record->interfaceTypes, item->interfaceTypes, sizeof(record->interfaceTypes));
+}
+
+void DecodeDeviceRecord(const DeviceRecord_t *record, ListResultItem_t *item)
+{
+	item->locationId = record->locationId;
+	item->vendorId = record->vendorId;
+	item->productId = record->productId;
+	item->deviceAddress = record->deviceAddress;
+	item->deviceName = ReadRecordString(record->deviceName);
+	item->manufacturer = ReadRecordString(record->manufacturer);
+	item->serialNumber = ReadRecordString(record->serialNumber);
+	item->extraFieldMask = record->extraFieldMask;
+	for (int field = 0; field < DeviceField_Count; field++)
+	{
+		if (record->extraFieldMask & DEVICE_FIELD_BIT(field))
+		{
+			item->extraFields[field] = ReadRecordString(record->extraFields[field]);
+		}
+		else
+		{
+			item->extraFields[field].clear();
+		}
+	}
+	item->interfaceTypeCount = record->interfaceTypeCount < MAX_INTERFACE_TYPES ? record->interfaceTypeCount : MAX_INTERFACE_TYPES;
+	memcpy(item->interfaceTypes, record->interfaceTypes, sizeof(item->interfaceTypes));
+}
+
+bool DeviceRecordMatches(const DeviceRecord_t *record, int vid, int pid, uint32_t interfaceQuery)
+{
+	return (vid == 0 || record->vendorId == vid) && (pid == 0 || record->productId == pid) &&
+		   InterfaceTypesMatch(record->interfaceTypes, record->interfaceTypeCount, interfaceQuery);
+}
@@ -0,0 +1,39 @@
+#ifndef _DEVICE_RECORD_H
+#define _DEVICE_RECORD_H
+
+#include <stdint.h>
+#include <string>
+#include "deviceList.h"
+
+// Fixed-size, pointer-free copy of a ListResultItem_t for handing devices to
+// other processes on the same host (the shared device list, the event hub).
+// Native byte order; both ends must be built from the same layout.
+
+// Longer strings are truncated
+#define DEVICE_RECORD_STRING_SIZE 128
+
+typedef struct
+{
+	int32_t locationId;
+	int32_t vendorId;
+	int32_t productId;
+	int32_t deviceAddress;
+	uint32_t extraFieldMask;
+	char deviceName[DEVICE_RECORD_STRING_SIZE];
+	char manufacturer[DEVICE_RECORD_STRING_SIZE];
+	char serialNumber[DEVICE_RECORD_STRING_SIZE];
+	char extraFields[DeviceField_Count][DEVICE_RECORD_STRING_SIZE];
+	uint8_t interfaceTypeCount;
+	InterfaceType_t interfaceTypes[MAX_INTERFACE_TYPES];
+} DeviceRecord_t;
+
+// Overwrites the whole record, padding included
+void EncodeDeviceRecord(const ListResultItem_t *item, DeviceRecord_t *record);
+void DecodeDeviceRecord(const DeviceRecord_t *record, ListResultItem_t *item);
+bool DeviceRecordMatches(const DeviceRecord_t *record, int vid, int pid, uint32_t interfaceQuery = 0);
+
+// NUL-terminated, truncated copy into a DEVICE_RECORD_STRING_SIZE buffer
+void CopyRecordString(char *dst, const std::string &src);
+std::string ReadRecordString(const char *src);
+
+#endif
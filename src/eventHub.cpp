@@ -0,0 +1,778 @@
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include "detectionCore.h"
+#include "eventHub.h"
+#include "memoryUsage.h"
+#include "metrics.h"
+
+using namespace std;
+
+#ifndef _WIN32
+
+/**********************************
+ * Local defines
+ **********************************/
+// Records queued per subscriber before further events are dropped for it
+#define EVENT_HUB_QUEUE_LIMIT 256
+// How often the receiver checks whether it should stop, and retries a hub
+// that went away; also how long the hub backs off after a failed poll()
+#define EVENT_HUB_RETRY_MS 250
+#define EVENT_HUB_SOCKET_NAME "usb-detection.sock"
+
+#ifndef MSG_NOSIGNAL
+// macOS sets SO_NOSIGPIPE on the socket instead
+#define MSG_NOSIGNAL 0
+#endif
+
+/**********************************
+ * Local typedefs
+ **********************************/
+typedef struct
+{
+	int fd;
+	int vid;
+	int pid;
+	deque<EventHubRecord_t> queue;
+	// Bytes of queue.front() already sent
+	size_t sent;
+	// Events missed since the last queued record
+	uint32_t dropped;
+	// Filter message being received
+	EventHubFilter_t filter;
+	size_t received;
+} HubSubscriber_t;
+
+/**********************************
+ * Local Variables
+ **********************************/
+// Serialises listen/close/connect
+static mutex stateMutex;
+
+// Server side. `hubMutex` guards the subscriber list and every subscriber's
+// filter and queue, which the monitor thread fills and the hub thread drains.
+static mutex hubMutex;
+static list<HubSubscriber_t *> subscribers;
+static int listenFd = -1;
+// Written to by the monitor thread and EventHubClose() to wake the hub thread
+static int wakeFds[2] = {-1, -1};
+static string listenPath;
+static int hubSubscription = 0;
+static thread hubThread;
+static atomic<bool> isListening{false};
+
+// Client side; fixed once connected
+static string hubPath;
+static int filterVid = 0;
+static int filterPid = 0;
+static atomic<bool> isConnected{false};
+static thread receiveThread;
+static atomic<bool> isReceiving{false};
+
+/**********************************
+ * Local Helper Functions
+ **********************************/
+static void SetSocketOptions(int fd)
+{
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+}
+
+static void SetNonBlocking(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+static bool WouldBlock()
+{
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+static bool MakeAddress(const char *path, struct sockaddr_un *address, string *error)
+{
+	memset(address, 0, sizeof(*address));
+	if (strlen(path) >= sizeof(address->sun_path))
+	{
+		*error = "The event hub socket path is too long";
+		return false;
+	}
+	address->sun_family = AF_UNIX;
+	strncpy(address->sun_path, path, sizeof(address->sun_path) - 1);
+	return true;
+}
+
+// Whether the process at the other end of `fd` runs as this user or root
+static bool IsTrustedPeer(int fd)
+{
+	uid_t uid;
+#ifdef SO_PEERCRED
+	struct ucred credentials;
+	socklen_t length = sizeof(credentials);
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0)
+	{
+		return false;
+	}
+	uid = credentials.uid;
+#else
+	gid_t gid;
+	if (getpeereid(fd, &uid, &gid) != 0)
+	{
+		return false;
+	}
+#endif
+	return uid == geteuid() || uid == 0;
+}
+
+// A connected, blocking socket, or -1 with errno set
+static int ConnectTo(const struct sockaddr_un &address)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	SetSocketOptions(fd);
+	if (connect(fd, (const struct sockaddr *)&address, sizeof(address)) != 0)
+	{
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+	return fd;
+}
+
+static void WakeHub()
+{
+	char byte = 0;
+	// A full pipe already wakes the hub thread
+	ssize_t written = write(wakeFds[1], &byte, 1);
+	(void)written;
+}
+
+// Must hold hubMutex
+static void RemoveSubscriber(HubSubscriber_t *subscriber)
+{
+	close(subscriber->fd);
+	MemoryAccount(MemoryCategory_Events, -(int64_t)subscriber->queue.size(), -(int64_t)(subscriber->queue.size() * sizeof(EventHubRecord_t)));
+	delete subscriber;
+}
+
+static void HandleHubEvent(DeviceEvent_t event, ListResultItem_t *item, void *context)
+{
+	// The protocol only carries attach and detach
+	if (event == DeviceEvent_Changed)
+	{
+		return;
+	}
+
+	EventHubRecord_t record;
+	record.magic = EVENT_HUB_MAGIC;
+	record.version = EVENT_HUB_VERSION;
+	record.type = event == DeviceEvent_Added ? EventHubMessage_Added : EventHubMessage_Removed;
+	record.dropped = 0;
+	record.reserved = 0;
+	EncodeDeviceRecord(item, &record.device);
+
+	bool queued = false;
+	{
+		lock_guard<mutex> lock(hubMutex);
+		for (HubSubscriber_t *subscriber : subscribers)
+		{
+			if (!DeviceRecordMatches(&record.device, subscriber->vid, subscriber->pid))
+			{
+				continue;
+			}
+			if (subscriber->queue.size() >= EVENT_HUB_QUEUE_LIMIT)
+			{
+				subscriber->dropped++;
+				METRICS_INCREMENT(Metric_EventsDropped);
+				continue;
+			}
+			record.dropped = subscriber->dropped;
+			subscriber->dropped = 0;
+			subscriber->queue.push_back(record);
+			MemoryAccount(MemoryCategory_Events, 1, sizeof(EventHubRecord_t));
+			queued = true;
+		}
+	}
+
+	if (queued)
+	{
+		WakeHub();
+	}
+}
+
+// Queues the attached devices that match the subscriber's filter, and the end
+// marker. They are not held to the queue limit. Must hold hubMutex.
+static void QueueSnapshot(HubSubscriber_t *subscriber)
+{
+	list<DeviceItem_t *> items;
+	CreateSnapshot(&items);
+
+	EventHubRecord_t record;
+	memset(&record, 0, sizeof(record));
+	record.magic = EVENT_HUB_MAGIC;
+	record.version = EVENT_HUB_VERSION;
+	record.type = EventHubMessage_Snapshot;
+	size_t queued = 0;
+	for (DeviceItem_t *item : items)
+	{
+		EncodeDeviceRecord(&item->deviceParams, &record.device);
+		if (DeviceRecordMatches(&record.device, subscriber->vid, subscriber->pid))
+		{
+			subscriber->queue.push_back(record);
+			queued++;
+		}
+		delete item;
+	}
+
+	// The snapshot covers whatever was dropped before it
+	memset(&record.device, 0, sizeof(record.device));
+	record.type = EventHubMessage_SnapshotEnd;
+	record.dropped = subscriber->dropped;
+	subscriber->dropped = 0;
+	subscriber->queue.push_back(record);
+	queued++;
+	MemoryAccount(MemoryCategory_Events, queued, queued * sizeof(EventHubRecord_t));
+}
+
+// Reads filter messages until the socket would block, answering each with a
+// snapshot. Must hold hubMutex; returns false if the subscriber is gone or
+// broke the protocol.
+static bool ReceiveFromSubscriber(HubSubscriber_t *subscriber)
+{
+	while (true)
+	{
+		ssize_t received = recv(subscriber->fd, (char *)&subscriber->filter + subscriber->received, sizeof(EventHubFilter_t) - subscriber->received, 0);
+		if (received <= 0)
+		{
+			return received < 0 && WouldBlock();
+		}
+		subscriber->received += received;
+		if (subscriber->received < sizeof(EventHubFilter_t))
+		{
+			continue;
+		}
+
+		subscriber->received = 0;
+		const EventHubFilter_t &filter = subscriber->filter;
+		if (filter.magic != EVENT_HUB_MAGIC || filter.version != EVENT_HUB_VERSION || filter.type != EventHubMessage_Filter)
+		{
+			return false;
+		}
+		subscriber->vid = filter.vendorId;
+		subscriber->pid = filter.productId;
+		QueueSnapshot(subscriber);
+	}
+}
+
+// Sends queued records until the socket would block. Must hold hubMutex;
+// returns false if the subscriber is gone.
+static bool SendToSubscriber(HubSubscriber_t *subscriber)
+{
+	while (!subscriber->queue.empty())
+	{
+		const char *record = (const char *)&subscriber->queue.front();
+		ssize_t sent = send(subscriber->fd, record + subscriber->sent, sizeof(EventHubRecord_t) - subscriber->sent, MSG_NOSIGNAL);
+		if (sent < 0)
+		{
+			return WouldBlock();
+		}
+		subscriber->sent += sent;
+		if (subscriber->sent == sizeof(EventHubRecord_t))
+		{
+			subscriber->sent = 0;
+			subscriber->queue.pop_front();
+			MemoryAccount(MemoryCategory_Events, -1, -(int64_t)sizeof(EventHubRecord_t));
+		}
+	}
+	return true;
+}
+
+static void AcceptSubscribers()
+{
+	int fd;
+	while ((fd = accept(listenFd, NULL, NULL)) >= 0)
+	{
+		SetSocketOptions(fd);
+		SetNonBlocking(fd);
+		HubSubscriber_t *subscriber = new HubSubscriber_t();
+		subscriber->fd = fd;
+
+		lock_guard<mutex> lock(hubMutex);
+		subscribers.push_back(subscriber);
+	}
+}
+
+static void HubLoop()
+{
+	vector<struct pollfd> fds;
+	vector<HubSubscriber_t *> polled;
+	// Snapshots are taken from the device list
+	LazyInit();
+
+	while (isListening.load())
+	{
+		fds.assign({{wakeFds[0], POLLIN, 0}, {listenFd, POLLIN, 0}});
+		polled.clear();
+		{
+			lock_guard<mutex> lock(hubMutex);
+			for (HubSubscriber_t *subscriber : subscribers)
+			{
+				fds.push_back({subscriber->fd, (short)(subscriber->queue.empty() ? POLLIN : POLLIN | POLLOUT), 0});
+				polled.push_back(subscriber);
+			}
+		}
+
+		if (poll(fds.data(), fds.size(), -1) < 0)
+		{
+			if (errno != EINTR)
+			{
+				// E.g. ENOMEM; wait for it to pass rather than spin
+				this_thread::sleep_for(chrono::milliseconds(EVENT_HUB_RETRY_MS));
+			}
+			continue;
+		}
+
+		if (fds[0].revents & POLLIN)
+		{
+			char buffer[64];
+			while (read(wakeFds[0], buffer, sizeof(buffer)) > 0)
+			{
+			}
+		}
+		if (fds[1].revents & POLLIN)
+		{
+			AcceptSubscribers();
+		}
+
+		lock_guard<mutex> lock(hubMutex);
+		for (size_t i = 0; i < polled.size(); i++)
+		{
+			HubSubscriber_t *subscriber = polled[i];
+			short events = fds[i + 2].revents;
+			bool healthy = !(events & (POLLERR | POLLNVAL));
+			if (healthy && (events & (POLLIN | POLLHUP)))
+			{
+				healthy = ReceiveFromSubscriber(subscriber);
+			}
+			// Also picks up records queued since the poll set was built
+			if (healthy)
+			{
+				healthy = SendToSubscriber(subscriber);
+			}
+			if (!healthy)
+			{
+				subscribers.remove(subscriber);
+				RemoveSubscriber(subscriber);
+			}
+		}
+	}
+}
+
+static vector<ListResultItem_t>::iterator FindDevice(vector<ListResultItem_t> &devices, const ListResultItem_t *device)
+{
+	vector<ListResultItem_t>::iterator it;
+	for (it = devices.begin(); it != devices.end(); ++it)
+	{
+		if (IsSameDevice(&*it, device))
+		{
+			break;
+		}
+	}
+	return it;
+}
+
+// Reports what changed between what was known and a fresh snapshot
+static void ReportDifferences(vector<ListResultItem_t> &known, vector<ListResultItem_t> &snapshot)
+{
+	for (ListResultItem_t &device : known)
+	{
+		if (FindDevice(snapshot, &device) == snapshot.end())
+		{
+			NotifyRemoved(&device);
+		}
+	}
+	for (ListResultItem_t &device : snapshot)
+	{
+		if (FindDevice(known, &device) == known.end())
+		{
+			NotifyAdded(&device);
+		}
+	}
+}
+
+static void ReceiveLoop()
+{
+	struct sockaddr_un address;
+	string error;
+	MakeAddress(hubPath.c_str(), &address, &error);
+
+	EventHubFilter_t filter;
+	memset(&filter, 0, sizeof(filter));
+	filter.magic = EVENT_HUB_MAGIC;
+	filter.version = EVENT_HUB_VERSION;
+	filter.type = EventHubMessage_Filter;
+	filter.vendorId = filterVid;
+	filter.productId = filterPid;
+
+	EventHubRecord_t record;
+	ListResultItem_t item;
+	// What this process has reported as attached, and the hub's snapshot
+	// being received. The first snapshot only sets the baseline; later ones
+	// (after reconnecting or missing events) are reported as differences.
+	vector<ListResultItem_t> known;
+	vector<ListResultItem_t> snapshot;
+	bool hasBaseline = false;
+	while (isReceiving.load())
+	{
+		int fd = ConnectTo(address);
+		if (fd >= 0 && !IsTrustedPeer(fd))
+		{
+			close(fd);
+			fd = -1;
+		}
+		if (fd < 0)
+		{
+			this_thread::sleep_for(chrono::milliseconds(EVENT_HUB_RETRY_MS));
+			continue;
+		}
+		snapshot.clear();
+
+		bool healthy = send(fd, &filter, sizeof(filter), MSG_NOSIGNAL) == sizeof(filter);
+		size_t received = 0;
+		while (healthy && isReceiving.load())
+		{
+			struct pollfd pfd = {fd, POLLIN, 0};
+			int ready = poll(&pfd, 1, EVENT_HUB_RETRY_MS);
+			if (ready <= 0)
+			{
+				healthy = ready == 0 || errno == EINTR;
+				continue;
+			}
+
+			ssize_t count = recv(fd, (char *)&record + received, sizeof(record) - received, 0);
+			if (count <= 0)
+			{
+				healthy = count < 0 && WouldBlock();
+				continue;
+			}
+			received += count;
+			if (received < sizeof(record))
+			{
+				continue;
+			}
+
+			received = 0;
+			if (record.magic != EVENT_HUB_MAGIC || record.version != EVENT_HUB_VERSION)
+			{
+				healthy = false;
+				continue;
+			}
+			DecodeDeviceRecord(&record.device, &item);
+			switch (record.type)
+			{
+			case EventHubMessage_Added:
+				// May already be in a snapshot taken just before it
+				if (FindDevice(known, &item) == known.end())
+				{
+					known.push_back(item);
+					NotifyAdded(&item);
+				}
+				break;
+			case EventHubMessage_Removed:
+			{
+				vector<ListResultItem_t>::iterator it = FindDevice(known, &item);
+				if (it != known.end())
+				{
+					known.erase(it);
+					NotifyRemoved(&item);
+				}
+				break;
+			}
+			case EventHubMessage_Snapshot:
+				snapshot.push_back(item);
+				break;
+			case EventHubMessage_SnapshotEnd:
+				if (hasBaseline)
+				{
+					ReportDifferences(known, snapshot);
+				}
+				known.swap(snapshot);
+				snapshot.clear();
+				hasBaseline = true;
+				break;
+			}
+
+			if (record.dropped > 0)
+			{
+				MetricsAdd(Metric_EventsDropped, record.dropped);
+				// Catch up from a fresh snapshot
+				healthy = record.type == EventHubMessage_SnapshotEnd || send(fd, &filter, sizeof(filter), MSG_NOSIGNAL) == sizeof(filter);
+			}
+		}
+		close(fd);
+
+		if (!healthy && isReceiving.load())
+		{
+			this_thread::sleep_for(chrono::milliseconds(EVENT_HUB_RETRY_MS));
+		}
+	}
+}
+
+/**********************************
+ * Public Functions
+ **********************************/
+bool EventHubDefaultPath(string *path, string *error)
+{
+	const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+	if (runtimeDir != NULL && runtimeDir[0] == '/')
+	{
+		*path = string(runtimeDir) + "/" EVENT_HUB_SOCKET_NAME;
+		return true;
+	}
+
+	// Only this user can create or replace sockets in it
+	string directory = "/tmp/usb-detection-" + to_string(geteuid());
+	if (mkdir(directory.c_str(), 0700) != 0 && errno != EEXIST)
+	{
+		*error = "Can't create " + directory + ": " + strerror(errno);
+		return false;
+	}
+	struct stat info;
+	if (lstat(directory.c_str(), &info) != 0 || !S_ISDIR(info.st_mode) || info.st_uid != geteuid() || (info.st_mode & 077) != 0)
+	{
+		*error = "Refusing to use " + directory + ", as it is not private to this user";
+		return false;
+	}
+	*path = directory + "/" EVENT_HUB_SOCKET_NAME;
+	return true;
+}
+
+bool EventHubListen(const char *path, string *error)
+{
+	lock_guard<mutex> lock(stateMutex);
+	if (isListening.load())
+	{
+		*error = "The event hub is already running";
+		return false;
+	}
+
+	struct sockaddr_un address;
+	if (!MakeAddress(path, &address, error))
+	{
+		return false;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+	{
+		*error = string("Can't create the event hub socket: ") + strerror(errno);
+		return false;
+	}
+	SetSocketOptions(fd);
+
+	int bound = bind(fd, (const struct sockaddr *)&address, sizeof(address));
+	if (bound != 0 && errno == EADDRINUSE)
+	{
+		// Only replace a socket nobody is listening on any more, as left
+		// behind by a hub that did not shut down cleanly
+		int probe = ConnectTo(address);
+		struct stat info;
+		if (probe < 0 && errno == ECONNREFUSED && lstat(path, &info) == 0 && S_ISSOCK(info.st_mode))
+		{
+			unlink(path);
+			bound = bind(fd, (const struct sockaddr *)&address, sizeof(address));
+		}
+		else
+		{
+			if (probe >= 0)
+			{
+				close(probe);
+			}
+			errno = EADDRINUSE;
+		}
+	}
+	if (bound != 0 || listen(fd, SOMAXCONN) != 0)
+	{
+		*error = string("Can't listen on the event hub socket: ") + strerror(errno);
+		close(fd);
+		return false;
+	}
+	SetNonBlocking(fd);
+
+	if (pipe(wakeFds) != 0)
+	{
+		*error = string("Can't create the event hub wake pipe: ") + strerror(errno);
+		close(fd);
+		unlink(path);
+		return false;
+	}
+	for (int wakeFd : wakeFds)
+	{
+		fcntl(wakeFd, F_SETFD, FD_CLOEXEC);
+		SetNonBlocking(wakeFd);
+	}
+
+	listenFd = fd;
+	listenPath = path;
+	isListening.store(true);
+	hubThread = thread(HubLoop);
+	hubSubscription = SubscribeDeviceEvents(HandleHubEvent, NULL);
+	return true;
+}
+
+void EventHubClose()
+{
+	lock_guard<mutex> lock(stateMutex);
+	if (!isListening.load())
+	{
+		return;
+	}
+
+	UnsubscribeDeviceEvents(hubSubscription);
+	hubSubscription = 0;
+	isListening.store(false);
+	WakeHub();
+	if (hubThread.joinable())
+	{
+		hubThread.join();
+	}
+
+	{
+		lock_guard<mutex> hubLock(hubMutex);
+		for (HubSubscriber_t *subscriber : subscribers)
+		{
+			RemoveSubscriber(subscriber);
+		}
+		subscribers.clear();
+	}
+	close(listenFd);
+	listenFd = -1;
+	for (int &wakeFd : wakeFds)
+	{
+		close(wakeFd);
+		wakeFd = -1;
+	}
+	unlink(listenPath.c_str());
+}
+
+bool EventHubConnect(const char *path, int vid, int pid, string *error)
+{
+	lock_guard<mutex> lock(stateMutex);
+	if (isConnected.load())
+	{
+		*error = "Already using an event hub";
+		return false;
+	}
+
+	struct sockaddr_un address;
+	if (!MakeAddress(path, &address, error))
+	{
+		return false;
+	}
+	int fd = ConnectTo(address);
+	if (fd < 0)
+	{
+		*error = string("Can't connect to the event hub: ") + strerror(errno);
+		return false;
+	}
+	bool trusted = IsTrustedPeer(fd);
+	// The receiver thread makes its own connection once the monitor starts
+	close(fd);
+	if (!trusted)
+	{
+		*error = "The event hub is run by another user";
+		return false;
+	}
+
+	hubPath = path;
+	filterVid = vid;
+	filterPid = pid;
+	isConnected.store(true);
+	return true;
+}
+
+bool EventHubIsConnected()
+{
+	return isConnected.load();
+}
+
+void EventHubStartReceiving()
+{
+	if (!EventHubIsConnected() || isReceiving.exchange(true))
+	{
+		return;
+	}
+	receiveThread = thread(ReceiveLoop);
+}
+
+void EventHubStopReceiving()
+{
+	if (!isReceiving.exchange(false))
+	{
+		return;
+	}
+	if (receiveThread.joinable())
+	{
+		receiveThread.join();
+	}
+}
+
+#else
+
+bool EventHubDefaultPath(string *path, string *error)
+{
+	*error = "The event hub is not supported on Windows";
+	return false;
+}
+
+bool EventHubListen(const char *path, string *error)
+{
+	*error = "The event hub is not supported on Windows";
+	return false;
+}
+
+void EventHubClose()
+{
+}
+
+bool EventHubConnect(const char *path, int vid, int pid, string *error)
+{
+	*error = "The event hub is not supported on Windows";
+	return false;
+}
+
+bool EventHubIsConnected()
+{
+	return false;
+}
+
+void EventHubStartReceiving()
+{
+}
+
+void EventHubStopReceiving()
+{
+}
+
+#endif
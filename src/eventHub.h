@@ -0,0 +1,83 @@
+#ifndef _EVENT_HUB_H
+#define _EVENT_HUB_H
+
+#include <stdint.h>
+#include <string>
+#include "deviceRecord.h"
+
+// Hotplug events over a local Unix domain socket (not on Windows).
+//
+// The hub runs next to the monitor and writes one fixed-size
+// EventHubRecord_t per add/remove to every connected subscriber. Subscribers
+// can narrow what they get with an EventHubFilter_t at any time. Each one has
+// a bounded send queue, so a slow reader misses events (and is told how many)
+// rather than holding up the monitor or the other subscribers.
+//
+// The client side feeds the records into NotifyAdded()/NotifyRemoved() in
+// place of the platform monitor, e.g. inside a container that has the socket
+// mounted but no netlink access of its own. It only trusts a hub run by the
+// same user or root.
+//
+// Every filter message is answered with a snapshot of the matching devices.
+// A client sends one on (re)connecting and after missing events, and
+// reconciles with the snapshot, reporting what changed in between.
+
+#define EVENT_HUB_MAGIC 0x48425355 // "USBH"
+// Bump on any change to the messages below or to DeviceRecord_t
+#define EVENT_HUB_VERSION 4
+
+typedef enum _EventHubMessage_t
+{
+	EventHubMessage_Added = 1,
+	EventHubMessage_Removed = 2,
+	EventHubMessage_Filter = 3,
+	// One per device attached when the filter arrived
+	EventHubMessage_Snapshot = 4,
+	// Ends the snapshot; carries no device
+	EventHubMessage_SnapshotEnd = 5,
+} EventHubMessage_t;
+
+// Hub -> subscriber, native byte order
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t type;
+	// Events this subscriber missed just before this one, its queue being full
+	uint32_t dropped;
+	uint32_t reserved;
+	DeviceRecord_t device;
+} EventHubRecord_t;
+
+// Subscriber -> hub. Only matching events are queued from then on; 0 matches
+// any vendor/product, which is also the default.
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t type;
+	int32_t vendorId;
+	int32_t productId;
+} EventHubFilter_t;
+
+// Socket path used when none is given: in $XDG_RUNTIME_DIR, or else in a
+// private per-user directory under /tmp, which is created if needed. Returns
+// false and sets `error` if that directory is not safe to use.
+bool EventHubDefaultPath(std::string *path, std::string *error);
+
+// Server. Holds the monitor while listening. Returns false and sets `error`
+// on failure.
+bool EventHubListen(const char *path, std::string *error);
+// Disconnects every subscriber and removes the socket
+void EventHubClose();
+
+// Client. Checks that a hub is listening on `path`, then makes it the event
+// source for the monitor from now on. Returns false and sets `error` if not.
+bool EventHubConnect(const char *path, int vid, int pid, std::string *error);
+bool EventHubIsConnected();
+// Turns records from the hub into NotifyAdded()/NotifyRemoved() calls on a
+// receiver thread, reconnecting if the hub goes away
+void EventHubStartReceiving();
+void EventHubStopReceiving();
+
+#endif
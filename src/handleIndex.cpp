@@ -0,0 +1,59 @@
+#include <atomic>
+#include <unordered_map>
+#include "handleIndex.h"
+#include "memoryUsage.h"
+
+using namespace std;
+
+/**********************************
+ * Local defines
+ **********************************/
+// Estimated size of a handleOwners node: the key/value pair, the chain link
+// and its bucket slot
+#define HANDLE_ENTRY_BYTES (sizeof(unordered_map<uint64_t, DeviceItem_t *>::value_type) + 2 * sizeof(void *))
+
+/**********************************
+ * Local Variables
+ **********************************/
+static unordered_map<uint64_t, DeviceItem_t *> handleOwners;
+
+static atomic<uint64_t> nextHandle(1);
+
+/**********************************
+ * Public Functions
+ **********************************/
+uint64_t NewDeviceHandle()
+{
+	return nextHandle.fetch_add(1);
+}
+
+void HandleIndexInsert(DeviceItem_t *item)
+{
+	uint64_t handle = item->deviceParams.handle;
+	if (handle != 0 && handleOwners.insert(pair<uint64_t, DeviceItem_t *>(handle, item)).second)
+	{
+		MemoryAccount(MemoryCategory_Registry, 1, HANDLE_ENTRY_BYTES);
+	}
+}
+
+void HandleIndexRemove(DeviceItem_t *item)
+{
+	unordered_map<uint64_t, DeviceItem_t *>::iterator it = handleOwners.find(item->deviceParams.handle);
+	if (it != handleOwners.end() && it->second == item)
+	{
+		MemoryAccount(MemoryCategory_Registry, -1, -(int64_t)HANDLE_ENTRY_BYTES);
+		handleOwners.erase(it);
+	}
+}
+
+void HandleIndexClear()
+{
+	MemoryAccount(MemoryCategory_Registry, -(int64_t)handleOwners.size(), -(int64_t)(handleOwners.size() * HANDLE_ENTRY_BYTES));
+	handleOwners.clear();
+}
+
+DeviceItem_t *HandleIndexFind(uint64_t handle)
+{
+	unordered_map<uint64_t, DeviceItem_t *>::iterator it = handleOwners.find(handle);
+	return it != handleOwners.end() ? it->second : NULL;
+}
@@ -0,0 +1,20 @@
+#ifndef _HANDLE_INDEX_H
+#define _HANDLE_INDEX_H
+
+#include <stdint.h>
+#include "deviceList.h"
+
+// Index from the session handle of every stored item back to the item. The
+// registry keeps it in sync under its own lock; none of these functions lock.
+
+// A handle no connection in this process has had yet. Never 0, and it stays
+// a safe integer when marshalled as a JS number.
+uint64_t NewDeviceHandle();
+
+void HandleIndexInsert(DeviceItem_t *item);
+void HandleIndexRemove(DeviceItem_t *item);
+void HandleIndexClear();
+// The stored item with `handle`, or NULL
+DeviceItem_t *HandleIndexFind(uint64_t handle);
+
+#endif
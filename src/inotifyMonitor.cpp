@@ -0,0 +1,488 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#ifdef __linux__
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+#include "detectionCore.h"
+#include "inotifyMonitor.h"
+#include "metrics.h"
+#include "nameDatabase.h"
+#include "usbDescriptors.h"
+
+using namespace std;
+
+#ifdef __linux__
+
+/**********************************
+ * Local defines
+ **********************************/
+// Major number of usb_device character devices
+#define USB_DEVICE_MAJOR 189
+// A rescan that races with live changes is retried this many times
+#define RECONCILE_ATTEMPTS 3
+// Delay before catching up again after all of those attempts raced
+#define RECONCILE_RETRY_MS 1000
+
+/**********************************
+ * Local typedefs
+ **********************************/
+typedef struct
+{
+	const char *sysattr;
+	DeviceField_t field;
+} ExtraSysattr_t;
+
+/**********************************
+ * Local Variables
+ **********************************/
+// The sysattr-backed extra fields, as read by the udev backend
+static const ExtraSysattr_t extraSysattrs[] = {
+	{"speed", DeviceField_Speed},
+	{"bDeviceClass", DeviceField_DeviceClass},
+	{"bcdDevice", DeviceField_BcdDevice},
+};
+
+// Set once, before the monitor thread reads them
+static mutex configMutex;
+static string sysfsRoot = INOTIFY_DEFAULT_SYSFS_ROOT;
+static string devRoot = INOTIFY_DEFAULT_DEV_ROOT;
+static atomic<bool> isEnabled{false};
+
+/**********************************
+ * Local Helper Functions
+ **********************************/
+static string UsbfsPath()
+{
+	return devRoot + "/bus/usb";
+}
+
+static string BusPath(int bus)
+{
+	char name[8];
+	snprintf(name, sizeof(name), "/%03d", bus);
+	return UsbfsPath() + name;
+}
+
+// The registry key, matching the devnode udev reports
+static string NodePath(int bus, int address)
+{
+	char name[8];
+	snprintf(name, sizeof(name), "/%03d", address);
+	return BusPath(bus) + name;
+}
+
+// The kernel numbers usb_device minors by bus and address
+static string SysfsDevicePath(int bus, int address)
+{
+	return sysfsRoot + "/dev/char/" + to_string(USB_DEVICE_MAJOR) + ":" + to_string((bus - 1) * 128 + (address - 1));
+}
+
+// usbfs names are zero-padded decimal numbers ("001")
+static bool ParseNumber(const char *name, int *value)
+{
+	char *end;
+	long number = strtol(name, &end, 10);
+	if (end == name || *end != '\0' || number <= 0 || number > 999)
+	{
+		return false;
+	}
+	*value = (int)number;
+	return true;
+}
+
+// One-line sysfs attribute, without the trailing newline
+static bool ReadAttribute(const string &directory, const char *name, string *value)
+{
+	FILE *file = fopen((directory + "/" + name).c_str(), "re");
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	char buffer[256];
+	size_t length = fread(buffer, 1, sizeof(buffer), file);
+	fclose(file);
+	while (length > 0 && (buffer[length - 1] == '\n' || buffer[length - 1] == '\0'))
+	{
+		length--;
+	}
+	value->assign(buffer, length);
+	return true;
+}
+
+static string LinkName(const string &path, bool follow)
+{
+	char target[PATH_MAX];
+	if (follow)
+	{
+		if (realpath(path.c_str(), target) == NULL)
+		{
+			return "";
+		}
+	}
+	else
+	{
+		ssize_t length = readlink(path.c_str(), target, sizeof(target) - 1);
+		if (length < 0)
+		{
+			return "";
+		}
+		target[length] = '\0';
+	}
+
+	const char *name = strrchr(target, '/');
+	return name ? name + 1 : target;
+}
+
+// A keyed item for the node <bus>/<address>, or NULL if sysfs doesn't know it
+static DeviceItem_t *ReadDevice(int bus, int address)
+{
+	string directory = SysfsDevicePath(bus, address);
+	string value;
+	if (!ReadAttribute(directory, "idVendor", &value))
+	{
+		return NULL;
+	}
+
+	DeviceItem_t *item = new DeviceItem_t();
+	ListResultItem_t *params = &item->deviceParams;
+	params->vendorId = strtol(value.c_str(), NULL, 16);
+	if (ReadAttribute(directory, "idProduct", &value))
+	{
+		params->productId = strtol(value.c_str(), NULL, 16);
+	}
+	ReadAttribute(directory, "product", &params->deviceName);
+	ReadAttribute(directory, "manufacturer", &params->manufacturer);
+	ReadAttribute(directory, "serial", &params->serialNumber);
+	params->locationId = bus;
+	params->deviceAddress = address;
+	ResolveDeviceNames(params);
+	ReadInterfaceTypes(directory.c_str(), params);
+
+	unsigned int mask = GetExtraFieldMask();
+	for (const ExtraSysattr_t &extra : extraSysattrs)
+	{
+		if (mask & DEVICE_FIELD_BIT(extra.field))
+		{
+			ReadAttribute(directory, extra.sysattr, &params->extraFields[extra.field]);
+		}
+	}
+	if (mask & DEVICE_FIELD_BIT(DeviceField_Driver))
+	{
+		params->extraFields[DeviceField_Driver] = LinkName(directory + "/driver", false);
+	}
+	params->extraFieldMask = mask;
+	// The device directory is named after its port chain, as in GetPortPath()
+	params->extraFields[DeviceField_PortPath] = LinkName(directory, true);
+	if (!params->extraFields[DeviceField_PortPath].empty())
+	{
+		params->extraFieldMask |= DEVICE_FIELD_BIT(DeviceField_PortPath);
+	}
+
+	item->deviceState = DeviceState_Connect;
+	string key = NodePath(bus, address);
+	item->SetKey((char *)key.c_str());
+	return item;
+}
+
+static void ScanBus(int bus, list<DeviceItem_t *> *items)
+{
+	DIR *directory = opendir(BusPath(bus).c_str());
+	if (directory == NULL)
+	{
+		return;
+	}
+
+	struct dirent *entry;
+	while ((entry = readdir(directory)) != NULL)
+	{
+		int address;
+		if (!ParseNumber(entry->d_name, &address))
+		{
+			continue;
+		}
+		DeviceItem_t *item = ReadDevice(bus, address);
+		if (item != NULL)
+		{
+			(*items).push_back(item);
+		}
+	}
+	closedir(directory);
+}
+
+// Stores and reports a freshly read item, or deletes it if already known
+static bool DeviceAdded(DeviceItem_t *item)
+{
+	if (IsItemAlreadyStored(item->GetKey()))
+	{
+		delete item;
+		return false;
+	}
+
+	// Once stored, the item belongs to the registry
+	ListResultItem_t params = item->deviceParams;
+	params.handle = AddItemToList(item->GetKey(), item);
+	NotifyAdded(&params);
+	return true;
+}
+
+static bool NodeAdded(int bus, int address)
+{
+	DeviceItem_t *item = ReadDevice(bus, address);
+	return item != NULL && DeviceAdded(item);
+}
+
+static bool NodeRemoved(int bus, int address)
+{
+	// sysfs has already forgotten the device, so only a stored one can be
+	// described
+	string key = NodePath(bus, address);
+	DeviceItem_t *item = TakeItemFromList((char *)key.c_str());
+	if (item == NULL)
+	{
+		return false;
+	}
+
+	NotifyRemoved(&item->deviceParams);
+	delete item;
+	return true;
+}
+
+// Catches up with usbfs after the watches were (re)created or the event
+// queue overflowed. Costs a full scan, unlike single events. Returns false if
+// every attempt raced with live changes, leaving the registry as it was.
+static bool ReconcileWithUsbfs()
+{
+	for (int attempt = 0; attempt < RECONCILE_ATTEMPTS; attempt++)
+	{
+		uint64_t generation = GetListGeneration();
+		list<DeviceItem_t *> scanned;
+		InotifyMonitorScan(&scanned);
+
+		list<ListResultItem_t *> added;
+		list<ListResultItem_t *> removed;
+		list<ListResultItem_t *> changed;
+		if (!ReconcileList(&scanned, generation, &added, &removed, &changed))
+		{
+			continue;
+		}
+		for (ListResultItem_t *item : removed)
+		{
+			NotifyRemoved(item);
+			delete item;
+		}
+		for (ListResultItem_t *item : added)
+		{
+			NotifyAdded(item);
+			delete item;
+		}
+		for (ListResultItem_t *item : changed)
+		{
+			NotifyChanged(item);
+			delete item;
+		}
+		return true;
+	}
+	return false;
+}
+
+static void WatchBus(int inotifyFd, int bus, map<int, int> *busWatches)
+{
+	int watch = inotify_add_watch(inotifyFd, BusPath(bus).c_str(), IN_CREATE | IN_DELETE | IN_ONLYDIR);
+	if (watch >= 0)
+	{
+		(*busWatches)[watch] = bus;
+	}
+}
+
+static void WatchAllBuses(int inotifyFd, map<int, int> *busWatches)
+{
+	DIR *directory = opendir(UsbfsPath().c_str());
+	if (directory == NULL)
+	{
+		return;
+	}
+
+	struct dirent *entry;
+	while ((entry = readdir(directory)) != NULL)
+	{
+		int bus;
+		if (ParseNumber(entry->d_name, &bus))
+		{
+			WatchBus(inotifyFd, bus, busWatches);
+		}
+	}
+	closedir(directory);
+}
+
+/**********************************
+ * Public Functions
+ **********************************/
+bool InotifyMonitorEnable(const char *sysfs, const char *dev, string *error)
+{
+	lock_guard<mutex> lock(configMutex);
+	if (IsInitialized())
+	{
+		*error = "The inotify monitor must be chosen before the device list is built";
+		return false;
+	}
+
+	if (sysfs != NULL)
+	{
+		sysfsRoot = sysfs;
+	}
+	if (dev != NULL)
+	{
+		devRoot = dev;
+	}
+	isEnabled.store(true, memory_order_release);
+	return true;
+}
+
+bool InotifyMonitorIsEnabled()
+{
+	return isEnabled.load(memory_order_acquire);
+}
+
+void InotifyMonitorScan(list<DeviceItem_t *> *items)
+{
+	DIR *directory = opendir(UsbfsPath().c_str());
+	if (directory == NULL)
+	{
+		return;
+	}
+
+	struct dirent *entry;
+	while ((entry = readdir(directory)) != NULL)
+	{
+		int bus;
+		if (ParseNumber(entry->d_name, &bus))
+		{
+			ScanBus(bus, items);
+		}
+	}
+	closedir(directory);
+}
+
+void InotifyMonitorLoop(int wakeFd, bool (*onWake)())
+{
+	int inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotifyFd < 0)
+	{
+		return;
+	}
+
+	// Buses come and go with their host controllers
+	int rootWatch = inotify_add_watch(inotifyFd, UsbfsPath().c_str(), IN_CREATE | IN_DELETE | IN_ONLYDIR);
+	// Watch descriptor -> bus number
+	map<int, int> busWatches;
+	WatchAllBuses(inotifyFd, &busWatches);
+	// Anything that changed before the watches were in place
+	bool reconcilePending = !ReconcileWithUsbfs();
+
+	alignas(struct inotify_event) char buffer[4096];
+	pollfd fds[2] = {{inotifyFd, POLLIN, 0}, {wakeFd, POLLIN, 0}};
+	while (true)
+	{
+		int ret = poll(fds, 2, reconcilePending ? RECONCILE_RETRY_MS : -1);
+		if (ret < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (ret < 0 || (fds[1].revents && !onWake()))
+		{
+			break;
+		}
+		if (ret == 0)
+		{
+			reconcilePending = !ReconcileWithUsbfs();
+			continue;
+		}
+		if (!fds[0].revents)
+		{
+			continue;
+		}
+
+		ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+		const struct inotify_event *event;
+		for (char *next = buffer; length > 0 && next < buffer + length; next += sizeof(struct inotify_event) + event->len)
+		{
+			event = (const struct inotify_event *)next;
+			METRICS_INCREMENT(Metric_UeventsReceived);
+			bool handled = false;
+			int number;
+			map<int, int>::iterator bus = busWatches.find(event->wd);
+
+			if (event->mask & IN_Q_OVERFLOW)
+			{
+				reconcilePending = !ReconcileWithUsbfs();
+				handled = true;
+			}
+			else if (event->mask & IN_IGNORED)
+			{
+				busWatches.erase(event->wd);
+			}
+			else if (event->len > 0 && ParseNumber(event->name, &number))
+			{
+				if (event->wd == rootWatch && (event->mask & IN_CREATE))
+				{
+					WatchBus(inotifyFd, number, &busWatches);
+					// Nodes created before the watch was
+					list<DeviceItem_t *> items;
+					ScanBus(number, &items);
+					for (DeviceItem_t *item : items)
+					{
+						handled = DeviceAdded(item) || handled;
+					}
+				}
+				else if (bus != busWatches.end() && (event->mask & IN_CREATE))
+				{
+					handled = NodeAdded(bus->second, number);
+				}
+				else if (bus != busWatches.end() && (event->mask & IN_DELETE))
+				{
+					handled = NodeRemoved(bus->second, number);
+				}
+			}
+
+			if (!handled)
+			{
+				METRICS_INCREMENT(Metric_UeventsFiltered);
+			}
+		}
+	}
+
+	close(inotifyFd);
+}
+
+#else
+
+bool InotifyMonitorEnable(const char *sysfs, const char *dev, string *error)
+{
+	*error = "The inotify monitor is only supported on Linux";
+	return false;
+}
+
+bool InotifyMonitorIsEnabled()
+{
+	return false;
+}
+
+void InotifyMonitorScan(list<DeviceItem_t *> *items)
+{
+}
+
+void InotifyMonitorLoop(int wakeFd, bool (*onWake)())
+{
+}
+
+#endif
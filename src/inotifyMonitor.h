@@ -0,0 +1,33 @@
+#ifndef _INOTIFY_MONITOR_H
+#define _INOTIFY_MONITOR_H
+
+#include <list>
+#include <string>
+#include "deviceList.h"
+
+// Fallback Linux monitor for where udev events never arrive, e.g. in
+// unprivileged containers. It watches the usbfs nodes under
+// <devRoot>/bus/usb with inotify and reads the attributes of only the node
+// that changed from <sysfsRoot>/dev/char/189:<minor>, so an event costs the
+// same however many devices are attached. Both roots can point at a fake
+// tree, e.g. for tests.
+//
+// Unlike udev it has no udev properties (`path` stays empty) and does not
+// track child device nodes.
+
+#define INOTIFY_DEFAULT_SYSFS_ROOT "/sys"
+#define INOTIFY_DEFAULT_DEV_ROOT "/dev"
+
+// Selects the inotify monitor for this process; NULL keeps a root's default.
+// Returns false and sets `error` once the device list has been built, or
+// where unsupported.
+bool InotifyMonitorEnable(const char *sysfsRoot, const char *devRoot, std::string *error);
+bool InotifyMonitorIsEnabled();
+
+// Used by the Linux backend in place of udev
+void InotifyMonitorScan(std::list<DeviceItem_t *> *items);
+// Applies and reports changes, calling `onWake` whenever `wakeFd` becomes
+// readable, until it returns false
+void InotifyMonitorLoop(int wakeFd, bool (*onWake)());
+
+#endif
@@ -0,0 +1,86 @@
+#include <atomic>
+#include "memoryUsage.h"
+
+using namespace std;
+
+/**********************************
+ * Local typedefs
+ **********************************/
+typedef struct
+{
+	atomic<int64_t> count;
+	atomic<int64_t> bytes;
+} MemoryCounter_t;
+
+/**********************************
+ * Local Variables
+ **********************************/
+// In MemoryCategory_t order
+static const char *categoryNames[MemoryCategory_Count] = {
+	"registry",
+	"strings",
+	"events",
+	"batons",
+	"findCache",
+	"names",
+};
+
+static MemoryCounter_t counters[MemoryCategory_Count];
+
+// Capacity of an empty string, i.e. its small-string buffer
+static const size_t inlineCapacity = string().capacity();
+
+/**********************************
+ * Public Functions
+ **********************************/
+void MemoryAccount(MemoryCategory_t category, int64_t count, int64_t bytes)
+{
+	counters[category].count.fetch_add(count, memory_order_relaxed);
+	counters[category].bytes.fetch_add(bytes, memory_order_relaxed);
+}
+
+void MemoryGetUsage(MemoryCategory_t category, int64_t *count, int64_t *bytes)
+{
+	*count = counters[category].count.load(memory_order_relaxed);
+	*bytes = counters[category].bytes.load(memory_order_relaxed);
+}
+
+int64_t MemoryGetTotalBytes()
+{
+	int64_t total = 0;
+	for (int i = 0; i < MemoryCategory_Count; i++)
+	{
+		total += counters[i].bytes.load(memory_order_relaxed);
+	}
+	return total;
+}
+
+const char *MemoryCategoryName(MemoryCategory_t category)
+{
+	return categoryNames[category];
+}
+
+size_t StringHeapBytes(const string &value)
+{
+	return value.capacity() > inlineCapacity ? value.capacity() + 1 : 0;
+}
+
+void DeviceStringUsage(const ListResultItem_t *item, int64_t *count, int64_t *bytes)
+{
+	const string *strings[] = {&item->deviceName, &item->manufacturer, &item->serialNumber};
+
+	*count = 0;
+	*bytes = 0;
+	for (const string *value : strings)
+	{
+		size_t size = StringHeapBytes(*value);
+		*count += size > 0;
+		*bytes += size;
+	}
+	for (int field = 0; field < DeviceField_Count; field++)
+	{
+		size_t size = StringHeapBytes(item->extraFields[field]);
+		*count += size > 0;
+		*bytes += size;
+	}
+}
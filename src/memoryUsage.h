@@ -0,0 +1,41 @@
+#ifndef _MEMORY_USAGE_H
+#define _MEMORY_USAGE_H
+
+#include <stdint.h>
+#include <string>
+#include "deviceList.h"
+
+// Live object counts and bytes of the native allocations the addon holds,
+// kept with relaxed atomics where objects are created and freed. Fixed sizes
+// are exact; allocator and container overhead are estimates.
+
+typedef enum _MemoryCategory_t
+{
+	// DeviceItem_t's in the registry, their keys and map nodes
+	MemoryCategory_Registry,
+	// Heap-allocated string data of the devices in the registry
+	MemoryCategory_Strings,
+	// Device events waiting for JS: callback calls in flight, events()
+	// queues and the pause() buffer. String data is not included.
+	MemoryCategory_Events,
+	// In-flight find()/findUnder()/getTopology()/reconcile()/waitFor() calls
+	MemoryCategory_Batons,
+	// Cached find() results, strings included
+	MemoryCategory_FindCache,
+	// Vendor/product names cached from the hwdb, strings included
+	MemoryCategory_Names,
+	MemoryCategory_Count
+} MemoryCategory_t;
+
+void MemoryAccount(MemoryCategory_t category, int64_t count, int64_t bytes);
+void MemoryGetUsage(MemoryCategory_t category, int64_t *count, int64_t *bytes);
+int64_t MemoryGetTotalBytes();
+// Key used for the category in getMemoryUsage()
+const char *MemoryCategoryName(MemoryCategory_t category);
+
+// Heap bytes behind a string; 0 while it fits the small-string buffer
+size_t StringHeapBytes(const std::string &value);
+// Number and size of the heap-allocated strings of one device
+void DeviceStringUsage(const ListResultItem_t *item, int64_t *count, int64_t *bytes);
+
+#endif
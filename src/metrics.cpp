@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <atomic>
+#include "deviceList.h"
+#include "metrics.h"
+
+using namespace std;
+
+/**********************************
+ * Local defines
+ **********************************/
+#define METRIC_PREFIX "usb_detection_"
+
+/**********************************
+ * Local typedefs
+ **********************************/
+typedef struct
+{
+	const char *name;
+	const char *type;
+	const char *help;
+	// Stored in nanoseconds, exported in seconds
+	bool isDuration;
+} MetricInfo_t;
+
+/**********************************
+ * Local Variables
+ **********************************/
+// In Metric_t order
+static const MetricInfo_t metricInfo[Metric_Count] = {
+	{"uevents_received_total", "counter", "Hotplug notifications received from the OS.", false},
+	{"uevents_filtered_total", "counter", "Hotplug notifications ignored because they are not for a USB device add or remove.", false},
+	{"events_delivered_total", "counter", "Device events handed to JavaScript.", false},
+	{"events_dropped_total", "counter", "Device events discarded because a consumer queue was full or the environment was gone.", false},
+	{"events_coalesced_total", "counter", "Device events merged into a pending event for the same device.", false},
+	{"queue_depth", "gauge", "Device events waiting in native queues, including ones held by pause().", false},
+	{"enumeration_duration_seconds", "gauge", "Duration of the initial device enumeration.", true},
+};
+
+static atomic<int64_t> metrics[Metric_Count];
+
+// Upper bounds of the find() latency histogram, in seconds
+static const double findBuckets[] = {0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1};
+#define FIND_BUCKET_COUNT (sizeof(findBuckets) / sizeof(findBuckets[0]))
+
+// Not cumulative; the +Inf bucket is the last one
+static atomic<uint64_t> findBucketCounts[FIND_BUCKET_COUNT + 1];
+static atomic<uint64_t> findTotalNs(0);
+
+/**********************************
+ * Public Functions
+ **********************************/
+void MetricsAdd(Metric_t metric, int64_t delta)
+{
+	metrics[metric].fetch_add(delta, memory_order_relaxed);
+}
+
+void MetricsSet(Metric_t metric, int64_t value)
+{
+	metrics[metric].store(value, memory_order_relaxed);
+}
+
+void MetricsObserveFind(uint64_t durationNs)
+{
+	double seconds = durationNs / 1e9;
+	size_t bucket = 0;
+	while (bucket < FIND_BUCKET_COUNT && seconds > findBuckets[bucket])
+	{
+		bucket++;
+	}
+
+	findBucketCounts[bucket].fetch_add(1, memory_order_relaxed);
+	findTotalNs.fetch_add(durationNs, memory_order_relaxed);
+}
+
+void MetricsFormat(string *out)
+{
+	char line[256];
+
+	for (int i = 0; i < Metric_Count; i++)
+	{
+		const MetricInfo_t &info = metricInfo[i];
+		int64_t value = metrics[i].load(memory_order_relaxed);
+
+		snprintf(line, sizeof(line), "# HELP " METRIC_PREFIX "%s %s\n# TYPE " METRIC_PREFIX "%s %s\n", info.name, info.help, info.name, info.type);
+		*out += line;
+		if (info.isDuration)
+		{
+			snprintf(line, sizeof(line), METRIC_PREFIX "%s %.9f\n", info.name, value / 1e9);
+		}
+		else
+		{
+			snprintf(line, sizeof(line), METRIC_PREFIX "%s %lld\n", info.name, (long long)value);
+		}
+		*out += line;
+	}
+
+	snprintf(line, sizeof(line), "# HELP " METRIC_PREFIX "registry_devices Devices currently in the registry.\n# TYPE " METRIC_PREFIX "registry_devices gauge\n" METRIC_PREFIX "registry_devices %zu\n", GetDeviceCount());
+	*out += line;
+
+	*out += "# HELP " METRIC_PREFIX "find_duration_seconds Time from a find() call to its result being ready.\n";
+	*out += "# TYPE " METRIC_PREFIX "find_duration_seconds histogram\n";
+	uint64_t cumulative = 0;
+	for (size_t bucket = 0; bucket < FIND_BUCKET_COUNT; bucket++)
+	{
+		cumulative += findBucketCounts[bucket].load(memory_order_relaxed);
+		snprintf(line, sizeof(line), METRIC_PREFIX "find_duration_seconds_bucket{le=\"%g\"} %llu\n", findBuckets[bucket], (unsigned long long)cumulative);
+		*out += line;
+	}
+	cumulative += findBucketCounts[FIND_BUCKET_COUNT].load(memory_order_relaxed);
+	snprintf(line, sizeof(line), METRIC_PREFIX "find_duration_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)cumulative);
+	*out += line;
+	snprintf(line, sizeof(line), METRIC_PREFIX "find_duration_seconds_sum %.9f\n", findTotalNs.load(memory_order_relaxed) / 1e9);
+	*out += line;
+	// Same snapshot as the buckets, so +Inf and _count always agree
+	snprintf(line, sizeof(line), METRIC_PREFIX "find_duration_seconds_count %llu\n", (unsigned long long)cumulative);
+	*out += line;
+}
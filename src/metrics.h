@@ -0,0 +1,32 @@
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <stdint.h>
+#include <string>
+
+// Process-wide health counters and gauges, updated with relaxed atomics on
+// the hot paths and rendered in the Prometheus text format on demand.
+
+typedef enum _Metric_t
+{
+	// Counters
+	Metric_UeventsReceived,
+	Metric_UeventsFiltered,
+	Metric_EventsDelivered,
+	Metric_EventsDropped,
+	Metric_EventsCoalesced,
+	// Gauges
+	Metric_QueueDepth,
+	Metric_EnumerationNs,
+	Metric_Count
+} Metric_t;
+
+void MetricsAdd(Metric_t metric, int64_t delta);
+void MetricsSet(Metric_t metric, int64_t value);
+void MetricsObserveFind(uint64_t durationNs);
+// Appends every metric, plus the registry size, to `out`
+void MetricsFormat(std::string *out);
+
+#define METRICS_INCREMENT(metric) MetricsAdd(metric, 1)
+
+#endif
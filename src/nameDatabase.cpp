@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#ifdef __linux__
+#include <libudev.h>
+#endif
+#include "memoryUsage.h"
+#include "nameDatabase.h"
+
+using namespace std;
+
+#ifdef __linux__
+
+/**********************************
+ * Local defines
+ **********************************/
+#define HWDB_PROPERTY_VENDOR "ID_VENDOR_FROM_DATABASE"
+#define HWDB_PROPERTY_MODEL "ID_MODEL_FROM_DATABASE"
+
+// Estimated size of a nameCache node: the key/value pair plus the tree links
+#define NAME_ENTRY_BYTES (sizeof(map<uint32_t, DeviceNames_t>::value_type) + 4 * sizeof(void *))
+
+/**********************************
+ * Local typedefs
+ **********************************/
+typedef struct
+{
+	string vendor;
+	string product;
+} DeviceNames_t;
+
+/**********************************
+ * Local Variables
+ **********************************/
+static atomic<bool> isEnabled{false};
+
+// Guards the hwdb handle, which is not thread-safe, and the cache
+static mutex nameMutex;
+static struct udev *context = NULL;
+static struct udev_hwdb *hwdb = NULL;
+static bool isHwdbUnavailable = false;
+// Keyed by vendorId << 16 | productId. Misses are cached too.
+static map<uint32_t, DeviceNames_t> nameCache;
+
+/**********************************
+ * Local Helper Functions
+ **********************************/
+static bool OpenHwdb()
+{
+	if (hwdb != NULL || isHwdbUnavailable)
+	{
+		return hwdb != NULL;
+	}
+
+	context = udev_new();
+	hwdb = context ? udev_hwdb_new(context) : NULL;
+	if (hwdb == NULL)
+	{
+		isHwdbUnavailable = true;
+	}
+	return hwdb != NULL;
+}
+
+// Same modalias the udev hwdb builtin uses for usb_device's
+static void LookupNames(int vendorId, int productId, DeviceNames_t *names)
+{
+	char modalias[32];
+	snprintf(modalias, sizeof(modalias), "usb:v%04Xp%04X*", vendorId & 0xffff, productId & 0xffff);
+
+	struct udev_list_entry *entry;
+	udev_list_entry_foreach(entry, udev_hwdb_get_properties_list_entry(hwdb, modalias, 0))
+	{
+		const char *name = udev_list_entry_get_name(entry);
+		if (strcmp(name, HWDB_PROPERTY_VENDOR) == 0)
+		{
+			names->vendor = udev_list_entry_get_value(entry);
+		}
+		else if (strcmp(name, HWDB_PROPERTY_MODEL) == 0)
+		{
+			names->product = udev_list_entry_get_value(entry);
+		}
+	}
+}
+
+static const DeviceNames_t *FindNames(int vendorId, int productId)
+{
+	uint32_t key = (uint32_t)(vendorId & 0xffff) << 16 | (uint32_t)(productId & 0xffff);
+	map<uint32_t, DeviceNames_t>::iterator it = nameCache.find(key);
+	if (it != nameCache.end())
+	{
+		return &it->second;
+	}
+	if (!OpenHwdb())
+	{
+		return NULL;
+	}
+
+	DeviceNames_t &names = nameCache[key];
+	LookupNames(vendorId, productId, &names);
+	MemoryAccount(MemoryCategory_Names, 1, NAME_ENTRY_BYTES + StringHeapBytes(names.vendor) + StringHeapBytes(names.product));
+	return &names;
+}
+
+/**********************************
+ * Public Functions
+ **********************************/
+void SetNameResolution(bool enabled)
+{
+	isEnabled.store(enabled);
+}
+
+bool IsNameResolutionEnabled()
+{
+	return isEnabled.load();
+}
+
+void ResolveDeviceNames(ListResultItem_t *item)
+{
+	if (!isEnabled.load() || (!item->manufacturer.empty() && !item->deviceName.empty()))
+	{
+		return;
+	}
+
+	lock_guard<mutex> lock(nameMutex);
+	const DeviceNames_t *names = FindNames(item->vendorId, item->productId);
+	if (names == NULL)
+	{
+		return;
+	}
+	if (item->manufacturer.empty())
+	{
+		item->manufacturer = names->vendor;
+	}
+	if (item->deviceName.empty())
+	{
+		item->deviceName = names->product;
+	}
+}
+
+#else
+
+void SetNameResolution(bool enabled)
+{
+}
+
+bool IsNameResolutionEnabled()
+{
+	return false;
+}
+
+void ResolveDeviceNames(ListResultItem_t *item)
+{
+}
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef _NAME_DATABASE_H
+#define _NAME_DATABASE_H
+
+#include "deviceList.h"
+
+// Vendor/product names for devices without string descriptors, looked up in
+// udev's hwdb (the usb.ids data compiled into hwdb.bin, which libudev mmaps
+// and searches as a trie). Results are cached per vendor/product pair, so
+// nothing is parsed per process and each pair is looked up at most once.
+
+void SetNameResolution(bool enabled);
+bool IsNameResolutionEnabled();
+
+// Fills in an empty `manufacturer`/`deviceName` when enabled. Linux only;
+// does nothing elsewhere.
+void ResolveDeviceNames(ListResultItem_t *item);
+
+#endif
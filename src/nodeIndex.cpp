@@ -0,0 +1,136 @@
+#include <map>
+#include "memoryUsage.h"
+#include "nodeIndex.h"
+
+using namespace std;
+
+/**********************************
+ * Local defines
+ **********************************/
+// Estimated size of a nodeOwners node: the key/value pair plus the tree links
+#define NODE_ENTRY_BYTES (sizeof(map<string, DeviceItem_t *>::value_type) + 4 * sizeof(void *))
+
+/**********************************
+ * Local Variables
+ **********************************/
+static map<string, DeviceItem_t *> nodeOwners;
+
+/**********************************
+ * Local Helper Functions
+ **********************************/
+template <typename Visitor>
+static void ForEachNode(const string &nodes, Visitor visit)
+{
+	size_t start = 0;
+	while (start < nodes.size())
+	{
+		size_t end = nodes.find('\n', start);
+		if (end == string::npos)
+		{
+			end = nodes.size();
+		}
+		if (end > start)
+		{
+			visit(nodes.substr(start, end - start));
+		}
+		start = end + 1;
+	}
+}
+
+static const string &NodesOf(DeviceItem_t *item)
+{
+	return item->deviceParams.extraFields[DeviceField_Nodes];
+}
+
+static void AccountEntry(const string &node, int sign)
+{
+	MemoryAccount(MemoryCategory_Registry, sign, sign * (int64_t)(NODE_ENTRY_BYTES + StringHeapBytes(node)));
+}
+
+/**********************************
+ * Public Functions
+ **********************************/
+void NodeIndexInsert(DeviceItem_t *item)
+{
+	ForEachNode(NodesOf(item), [item](const string &node) {
+		pair<map<string, DeviceItem_t *>::iterator, bool> inserted = nodeOwners.insert(pair<string, DeviceItem_t *>(node, item));
+		if (inserted.second)
+		{
+			AccountEntry(node, 1);
+		}
+		else
+		{
+			// Node names are reused; the latest device to claim one owns it
+			inserted.first->second = item;
+		}
+	});
+}
+
+void NodeIndexRemove(DeviceItem_t *item)
+{
+	ForEachNode(NodesOf(item), [item](const string &node) {
+		map<string, DeviceItem_t *>::iterator it = nodeOwners.find(node);
+		if (it != nodeOwners.end() && it->second == item)
+		{
+			AccountEntry(node, -1);
+			nodeOwners.erase(it);
+		}
+	});
+}
+
+void NodeIndexClear()
+{
+	for (auto &entry : nodeOwners)
+	{
+		AccountEntry(entry.first, -1);
+	}
+	nodeOwners.clear();
+}
+
+DeviceItem_t *NodeIndexFind(const string &node)
+{
+	map<string, DeviceItem_t *>::iterator it = nodeOwners.find(node);
+	return it != nodeOwners.end() ? it->second : NULL;
+}
+
+bool AddToNodeList(string *nodes, const string &node)
+{
+	bool found = false;
+	ForEachNode(*nodes, [&](const string &existing) {
+		found = found || existing == node;
+	});
+	if (found || node.empty())
+	{
+		return false;
+	}
+
+	if (!(*nodes).empty())
+	{
+		*nodes += '\n';
+	}
+	*nodes += node;
+	return true;
+}
+
+bool RemoveFromNodeList(string *nodes, const string &node)
+{
+	string remaining;
+	bool found = false;
+	ForEachNode(*nodes, [&](const string &existing) {
+		if (existing == node)
+		{
+			found = true;
+			return;
+		}
+		if (!remaining.empty())
+		{
+			remaining += '\n';
+		}
+		remaining += existing;
+	});
+	if (found)
+	{
+		(*nodes).swap(remaining);
+	}
+	return found;
+}
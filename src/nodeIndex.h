@@ -0,0 +1,23 @@
+#ifndef _NODE_INDEX_H
+#define _NODE_INDEX_H
+
+#include <string>
+#include "deviceList.h"
+
+// Index from the device nodes of a device's children (/dev/ttyACM0,
+// /dev/hidraw3, /dev/sda, /dev/input/event5, ...) back to the device, built
+// from the DeviceField_Nodes list of every stored item. The registry keeps it
+// in sync under its own lock; none of these functions lock.
+
+void NodeIndexInsert(DeviceItem_t *item);
+void NodeIndexRemove(DeviceItem_t *item);
+void NodeIndexClear();
+// The stored item that has `node` as a child device node, or NULL
+DeviceItem_t *NodeIndexFind(const std::string &node);
+
+// DeviceField_Nodes holds a newline-separated list. Both return false if
+// there was nothing to change.
+bool AddToNodeList(std::string *nodes, const std::string &node);
+bool RemoveFromNodeList(std::string *nodes, const std::string &node);
+
+#endif
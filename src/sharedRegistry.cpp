@@ -0,0 +1,523 @@
+#include <string.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#include "detectionCore.h"
+#include "deviceRecord.h"
+#include "sharedRegistry.h"
+
+using namespace std;
+
+#ifdef __linux__
+
+/**********************************
+ * Local defines
+ **********************************/
+#define SHARED_REGISTRY_MAGIC 0x44425355 // "USBD"
+// Bump on any change to SharedRegistry_t or SharedDevice_t
+#define SHARED_REGISTRY_LAYOUT 3
+#define SHARED_REGISTRY_MAX_DEVICES 4096
+// Attempts at a consistent copy before a reader gives up
+#define SHARED_READ_ATTEMPTS 1000
+// How often the watcher thread checks whether it should stop
+#define SHARED_WATCH_INTERVAL_MS 250
+
+/**********************************
+ * Local typedefs
+ **********************************/
+typedef struct
+{
+	char key[DEVICE_RECORD_STRING_SIZE];
+	DeviceRecord_t device;
+} SharedDevice_t;
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t layout;
+	uint32_t size;
+	// Seqlock: odd while the publisher is writing. Readers also sleep on it
+	// with FUTEX_WAIT, and the publisher wakes them after every update.
+	atomic<uint32_t> sequence;
+	// Zero until the publisher has built its initial device list; set before
+	// the sequence is bumped, so waiters on the futex see it
+	atomic<uint32_t> ready;
+	// 0 once the publisher has stopped
+	atomic<int32_t> publisherPid;
+	uint32_t count;
+	SharedDevice_t devices[SHARED_REGISTRY_MAX_DEVICES];
+} SharedRegistry_t;
+
+static_assert(atomic<uint32_t>::is_always_lock_free && atomic<int32_t>::is_always_lock_free, "the seqlock needs lock-free 32-bit atomics");
+
+/**********************************
+ * Local Variables
+ **********************************/
+// Serialises publish/stop/open
+static mutex stateMutex;
+
+// Publisher side. `publishMutex` serialises writers (the initial publication
+// and the monitor thread).
+static mutex publishMutex;
+static SharedRegistry_t *published = NULL;
+static string publishedName;
+static int publishSubscription = 0;
+
+// Reader side; mapped for the rest of the process once opened
+static atomic<const SharedRegistry_t *> mapped{NULL};
+static thread watchThread;
+static atomic<bool> isWatching{false};
+
+/**********************************
+ * Local Helper Functions
+ **********************************/
+static uint32_t *FutexWord(const SharedRegistry_t *registry)
+{
+	return (uint32_t *)&registry->sequence;
+}
+
+// Whether the publisher is gone: stopped, or exited without stopping. A
+// publisher in another PID namespace looks gone too.
+static bool IsAbandoned(const SharedRegistry_t *registry)
+{
+	pid_t pid = registry->publisherPid.load(memory_order_acquire);
+	return pid <= 0 || (kill(pid, 0) != 0 && errno == ESRCH);
+}
+
+// Rewrites the whole segment from the local device list
+static void PublishSnapshot()
+{
+	list<DeviceItem_t *> items;
+	CreateSnapshot(&items);
+
+	{
+		lock_guard<mutex> lock(publishMutex);
+		if (published != NULL)
+		{
+			// Even while nobody writes; SharedRegistryPublish() makes sure of
+			// that for segments taken over from a crashed publisher
+			uint32_t sequence = published->sequence.load(memory_order_relaxed);
+			published->sequence.store(sequence + 1, memory_order_relaxed);
+			atomic_thread_fence(memory_order_release);
+
+			uint32_t count = 0;
+			for (DeviceItem_t *item : items)
+			{
+				if (count == SHARED_REGISTRY_MAX_DEVICES)
+				{
+					break;
+				}
+				SharedDevice_t &device = published->devices[count++];
+				CopyRecordString(device.key, item->GetKey());
+				EncodeDeviceRecord(&item->deviceParams, &device.device);
+			}
+			published->count = count;
+			if (IsInitialized())
+			{
+				published->ready.store(1, memory_order_relaxed);
+			}
+
+			published->sequence.store(sequence + 2, memory_order_release);
+			syscall(SYS_futex, FutexWord(published), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+		}
+	}
+
+	for (DeviceItem_t *item : items)
+	{
+		delete item;
+	}
+}
+
+static void HandlePublishedEvent(DeviceEvent_t event, ListResultItem_t *item, void *context)
+{
+	PublishSnapshot();
+}
+
+// Consistent raw copies of the matching records. Never blocks.
+static bool ReadRecords(const SharedRegistry_t *registry, int vid, int pid, uint32_t interfaceQuery, vector<SharedDevice_t> *records, uint32_t *sequence)
+{
+	for (int attempt = 0; attempt < SHARED_READ_ATTEMPTS; attempt++)
+	{
+		uint32_t before = registry->sequence.load(memory_order_acquire);
+		if (before & 1)
+		{
+			continue;
+		}
+
+		(*records).clear();
+		uint32_t count = registry->count;
+		if (count > SHARED_REGISTRY_MAX_DEVICES)
+		{
+			count = SHARED_REGISTRY_MAX_DEVICES;
+		}
+		for (uint32_t i = 0; i < count; i++)
+		{
+			// Filtering on fields that may be mid-update is fine; the whole
+			// copy is thrown away below if anything changed
+			if (DeviceRecordMatches(&registry->devices[i].device, vid, pid, interfaceQuery))
+			{
+				(*records).push_back(registry->devices[i]);
+			}
+		}
+
+		atomic_thread_fence(memory_order_acquire);
+		if (registry->sequence.load(memory_order_relaxed) == before)
+		{
+			*sequence = before;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void WatchLoop()
+{
+	const SharedRegistry_t *registry = mapped.load(memory_order_acquire);
+	map<string, ListResultItem_t> known;
+	vector<SharedDevice_t> records;
+	uint32_t sequence = 0;
+
+	// Like the platform monitors, report changes from here on only, but
+	// against the full list rather than whatever part of the publisher's
+	// initial enumeration is published yet
+	while (isWatching.load() && !registry->ready.load(memory_order_acquire) && !IsAbandoned(registry))
+	{
+		struct timespec timeout = {0, SHARED_WATCH_INTERVAL_MS * 1000000L};
+		syscall(SYS_futex, FutexWord(registry), FUTEX_WAIT, registry->sequence.load(memory_order_acquire), &timeout, NULL, 0);
+	}
+	if (ReadRecords(registry, 0, 0, 0, &records, &sequence))
+	{
+		for (const SharedDevice_t &record : records)
+		{
+			DecodeDeviceRecord(&record.device, &known[ReadRecordString(record.key)]);
+		}
+	}
+
+	while (isWatching.load())
+	{
+		struct timespec timeout = {0, SHARED_WATCH_INTERVAL_MS * 1000000L};
+		syscall(SYS_futex, FutexWord(registry), FUTEX_WAIT, sequence, &timeout, NULL, 0);
+
+		uint32_t current;
+		if (registry->sequence.load(memory_order_acquire) == sequence || !ReadRecords(registry, 0, 0, 0, &records, &current))
+		{
+			continue;
+		}
+		sequence = current;
+
+		map<string, ListResultItem_t> latest;
+		for (const SharedDevice_t &record : records)
+		{
+			DecodeDeviceRecord(&record.device, &latest[ReadRecordString(record.key)]);
+		}
+
+		for (auto &entry : known)
+		{
+			auto it = latest.find(entry.first);
+			if (it == latest.end() || !IsSameDevice(&it->second, &entry.second))
+			{
+				NotifyRemoved(&entry.second);
+			}
+		}
+		for (auto &entry : latest)
+		{
+			auto it = known.find(entry.first);
+			if (it == known.end() || !IsSameDevice(&it->second, &entry.second))
+			{
+				NotifyAdded(&entry.second);
+			}
+		}
+		known.swap(latest);
+	}
+}
+
+/**********************************
+ * Public Functions
+ **********************************/
+bool SharedRegistryPublish(const char *name, string *error)
+{
+	lock_guard<mutex> lock(stateMutex);
+	if (published != NULL)
+	{
+		*error = "Already publishing the device list";
+		return false;
+	}
+
+	int fd = shm_open(name, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+	if (fd < 0)
+	{
+		*error = string("Can't create the shared device list: ") + strerror(errno);
+		return false;
+	}
+	if (ftruncate(fd, sizeof(SharedRegistry_t)) != 0)
+	{
+		*error = string("Can't size the shared device list: ") + strerror(errno);
+		close(fd);
+		return false;
+	}
+	void *mapping = mmap(NULL, sizeof(SharedRegistry_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED)
+	{
+		*error = string("Can't map the shared device list: ") + strerror(errno);
+		return false;
+	}
+
+	// A segment left behind by an earlier publisher keeps its sequence, so
+	// readers still mapping it see the change. If that publisher died
+	// mid-write the sequence is odd; round it up so writes go even, odd, even
+	// again.
+	SharedRegistry_t *registry = static_cast<SharedRegistry_t *>(mapping);
+	uint32_t sequence = registry->sequence.load(memory_order_relaxed);
+	registry->sequence.store(sequence + (sequence & 1), memory_order_relaxed);
+	registry->magic = SHARED_REGISTRY_MAGIC;
+	registry->layout = SHARED_REGISTRY_LAYOUT;
+	registry->size = sizeof(SharedRegistry_t);
+	registry->ready.store(0, memory_order_relaxed);
+	registry->publisherPid.store(getpid(), memory_order_release);
+	{
+		lock_guard<mutex> publishLock(publishMutex);
+		published = registry;
+		publishedName = name;
+	}
+
+	PublishSnapshot();
+	publishSubscription = SubscribeDeviceEvents(HandlePublishedEvent, NULL);
+	// The initial enumeration can take a while; publish it when it is done.
+	// Detached like the cache rescan, so a process exiting mid-enumeration
+	// doesn't trip over a joinable thread; PublishSnapshot() is a no-op once
+	// the segment is gone.
+	thread([]() {
+		LazyInit();
+		PublishSnapshot();
+	}).detach();
+	return true;
+}
+
+void SharedRegistryStopPublishing()
+{
+	lock_guard<mutex> lock(stateMutex);
+	if (published == NULL)
+	{
+		return;
+	}
+
+	UnsubscribeDeviceEvents(publishSubscription);
+	publishSubscription = 0;
+
+	{
+		lock_guard<mutex> publishLock(publishMutex);
+		published->publisherPid.store(0, memory_order_release);
+		published->sequence.fetch_add(2, memory_order_release);
+		syscall(SYS_futex, FutexWord(published), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+		munmap(published, sizeof(SharedRegistry_t));
+		published = NULL;
+	}
+	shm_unlink(publishedName.c_str());
+}
+
+bool SharedRegistryOpen(const char *name, string *error)
+{
+	lock_guard<mutex> lock(stateMutex);
+	if (mapped.load() != NULL)
+	{
+		*error = "A shared device list is already open";
+		return false;
+	}
+
+	int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0)
+	{
+		*error = string("Can't open the shared device list: ") + strerror(errno);
+		return false;
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(SharedRegistry_t))
+	{
+		*error = "The shared device list is not from a compatible version";
+		close(fd);
+		return false;
+	}
+	void *mapping = mmap(NULL, sizeof(SharedRegistry_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED)
+	{
+		*error = string("Can't map the shared device list: ") + strerror(errno);
+		return false;
+	}
+
+	const SharedRegistry_t *registry = static_cast<const SharedRegistry_t *>(mapping);
+	if (registry->magic != SHARED_REGISTRY_MAGIC || registry->layout != SHARED_REGISTRY_LAYOUT || registry->size != sizeof(SharedRegistry_t))
+	{
+		*error = "The shared device list is not from a compatible version";
+		munmap(mapping, sizeof(SharedRegistry_t));
+		return false;
+	}
+
+	mapped.store(registry, memory_order_release);
+	return true;
+}
+
+bool SharedRegistryIsOpen()
+{
+	return mapped.load(memory_order_acquire) != NULL;
+}
+
+bool SharedRegistryRead(int vid, int pid, vector<ListResultItem_t> *devices, uint64_t *generation, uint32_t interfaceQuery)
+{
+	const SharedRegistry_t *registry = mapped.load(memory_order_acquire);
+	vector<SharedDevice_t> records;
+	uint32_t sequence;
+	if (registry == NULL || IsAbandoned(registry) || !ReadRecords(registry, vid, pid, interfaceQuery, &records, &sequence))
+	{
+		return false;
+	}
+
+	(*devices).resize(records.size());
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		DecodeDeviceRecord(&records[i].device, &(*devices)[i]);
+	}
+	*generation = sequence;
+	return true;
+}
+
+bool SharedRegistryIsReady()
+{
+	const SharedRegistry_t *registry = mapped.load(memory_order_acquire);
+	return registry != NULL && registry->ready.load(memory_order_acquire) != 0;
+}
+
+bool SharedRegistryWaitReady(string *error)
+{
+	const SharedRegistry_t *registry = mapped.load(memory_order_acquire);
+	if (registry == NULL)
+	{
+		*error = "No shared device list is open";
+		return false;
+	}
+
+	while (!registry->ready.load(memory_order_acquire))
+	{
+		if (IsAbandoned(registry))
+		{
+			*error = "The publisher of the shared device list has exited";
+			return false;
+		}
+		// Also wakes up now and then to notice a publisher that died
+		uint32_t sequence = registry->sequence.load(memory_order_acquire);
+		if (registry->ready.load(memory_order_acquire))
+		{
+			break;
+		}
+		struct timespec timeout = {0, SHARED_WATCH_INTERVAL_MS * 1000000L};
+		syscall(SYS_futex, FutexWord(registry), FUTEX_WAIT, sequence, &timeout, NULL, 0);
+	}
+	return true;
+}
+
+bool SharedRegistryIsAbandoned()
+{
+	const SharedRegistry_t *registry = mapped.load(memory_order_acquire);
+	return registry != NULL && IsAbandoned(registry);
+}
+
+uint64_t SharedRegistryGeneration()
+{
+	const SharedRegistry_t *registry = mapped.load(memory_order_acquire);
+	return registry != NULL ? registry->sequence.load(memory_order_acquire) : 0;
+}
+
+void SharedRegistryStartWatching()
+{
+	if (!SharedRegistryIsOpen() || isWatching.exchange(true))
+	{
+		return;
+	}
+	watchThread = thread(WatchLoop);
+}
+
+void SharedRegistryStopWatching()
+{
+	if (!isWatching.exchange(false))
+	{
+		return;
+	}
+	if (watchThread.joinable())
+	{
+		watchThread.join();
+	}
+}
+
+#else
+
+bool SharedRegistryPublish(const char *name, string *error)
+{
+	*error = "The shared device list is only supported on Linux";
+	return false;
+}
+
+void SharedRegistryStopPublishing()
+{
+}
+
+bool SharedRegistryOpen(const char *name, string *error)
+{
+	*error = "The shared device list is only supported on Linux";
+	return false;
+}
+
+bool SharedRegistryIsOpen()
+{
+	return false;
+}
+
+bool SharedRegistryRead(int vid, int pid, vector<ListResultItem_t> *devices, uint64_t *generation, uint32_t interfaceQuery)
+{
+	return false;
+}
+
+bool SharedRegistryIsReady()
+{
+	return false;
+}
+
+bool SharedRegistryWaitReady(string *error)
+{
+	*error = "The shared device list is only supported on Linux";
+	return false;
+}
+
+bool SharedRegistryIsAbandoned()
+{
+	return false;
+}
+
+uint64_t SharedRegistryGeneration()
+{
+	return 0;
+}
+
+void SharedRegistryStartWatching()
+{
+}
+
+void SharedRegistryStopWatching()
+{
+}
+
+#endif
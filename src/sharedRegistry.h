@@ -0,0 +1,50 @@
+#ifndef _SHARED_REGISTRY_H
+#define _SHARED_REGISTRY_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "deviceList.h"
+
+// Host-wide copy of the device list in POSIX shared memory (Linux only).
+//
+// One process publishes: it runs the monitor as usual and rewrites the
+// segment after every change, under a seqlock whose sequence word doubles as
+// a futex that readers can sleep on. Any number of readers map the segment
+// read-only and serve queries from it without syscalls, instead of opening
+// their own udev monitor and enumerating the bus themselves.
+
+// Segment name used when none is given, as passed to shm_open()
+#define SHARED_REGISTRY_DEFAULT_NAME "/usb-detection"
+
+// Publisher. Builds the device list in the background and keeps the segment
+// up to date until stopped. Returns false and sets `error` on failure.
+bool SharedRegistryPublish(const char *name, std::string *error);
+// Removes the segment. Mappings readers already hold stay valid, but reads
+// from them fail from then on.
+void SharedRegistryStopPublishing();
+
+// Reader. Returns false and sets `error` if no publisher has created `name`.
+bool SharedRegistryOpen(const char *name, std::string *error);
+bool SharedRegistryIsOpen();
+// Whether the publisher has published its initial device list
+bool SharedRegistryIsReady();
+// Blocks until it has. Returns false and sets `error` if the publisher is gone.
+bool SharedRegistryWaitReady(std::string *error);
+// Whether the publisher has stopped or exited without stopping
+bool SharedRegistryIsAbandoned();
+// Copies of the published devices matching `vid`/`pid` (0 matches any) and
+// an interface query (see usbDescriptors.h), and the generation they belong
+// to. Lock-free and syscall-free (bar a liveness check of the publisher);
+// returns false if the publisher is gone or no consistent copy could be
+// taken.
+bool SharedRegistryRead(int vid, int pid, std::vector<ListResultItem_t> *devices, uint64_t *generation, uint32_t interfaceQuery = 0);
+// Cheap check for changes, comparable with the `generation` from SharedRegistryRead()
+uint64_t SharedRegistryGeneration();
+
+// Turns changes to the published list into NotifyAdded()/NotifyRemoved()
+// calls on a watcher thread, in place of the platform monitor
+void SharedRegistryStartWatching();
+void SharedRegistryStopWatching();
+
+#endif
@@ -0,0 +1,208 @@
+#include <string.h>
+#include <mutex>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "threadPolicy.h"
+
+using namespace std;
+
+/**********************************
+ * Local Variables
+ **********************************/
+static mutex optionsMutex;
+static MonitorThreadOptions_t monitorOptions = {vector<int>(), false, 0, 0};
+static string lastError;
+
+/**********************************
+ * Local Helper Functions protoypes
+ **********************************/
+static void AppendError(string *errors, const char *what, int error);
+static void ApplyAffinity(const vector<int> &cpus, string *errors);
+static void ApplyNice(int nice, string *errors);
+static void ApplyFifoPriority(int priority, string *errors);
+
+/**********************************
+ * Public Functions
+ **********************************/
+void SetMonitorThreadOptions(const MonitorThreadOptions_t &options)
+{
+	lock_guard<mutex> lock(optionsMutex);
+	monitorOptions = options;
+}
+
+MonitorThreadOptions_t GetMonitorThreadOptions()
+{
+	lock_guard<mutex> lock(optionsMutex);
+	return monitorOptions;
+}
+
+void ApplyMonitorThreadOptions()
+{
+	MonitorThreadOptions_t options = GetMonitorThreadOptions();
+	string errors;
+
+	if (!options.cpus.empty())
+	{
+		ApplyAffinity(options.cpus, &errors);
+	}
+	if (options.setNice)
+	{
+		ApplyNice(options.nice, &errors);
+	}
+	if (options.fifoPriority > 0)
+	{
+		ApplyFifoPriority(options.fifoPriority, &errors);
+	}
+
+	lock_guard<mutex> lock(optionsMutex);
+	lastError = errors;
+}
+
+string GetMonitorThreadError()
+{
+	lock_guard<mutex> lock(optionsMutex);
+	return lastError;
+}
+
+/**********************************
+ * Local Functions
+ **********************************/
+static void AppendError(string *errors, const char *what, int error)
+{
+	if (!errors->empty())
+	{
+		*errors += "; ";
+	}
+	*errors += what;
+	if (error)
+	{
+		*errors += ": ";
+		*errors += strerror(error);
+	}
+}
+
+#if defined(__linux__)
+
+static void ApplyAffinity(const vector<int> &cpus, string *errors)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu : cpus)
+	{
+		if (cpu >= 0 && cpu < CPU_SETSIZE)
+		{
+			CPU_SET(cpu, &set);
+		}
+	}
+
+	int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (error)
+	{
+		AppendError(errors, "Can't set CPU affinity", error);
+	}
+}
+
+static void ApplyNice(int nice, string *errors)
+{
+	// On Linux the nice value is per thread when given a thread id
+	if (setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), nice) != 0)
+	{
+		AppendError(errors, "Can't set nice value", errno);
+	}
+}
+
+static void ApplyFifoPriority(int priority, string *errors)
+{
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = priority;
+
+	int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (error)
+	{
+		AppendError(errors, "Can't set SCHED_FIFO priority", error);
+	}
+}
+
+#elif defined(_WIN32)
+
+static void ApplyAffinity(const vector<int> &cpus, string *errors)
+{
+	DWORD_PTR mask = 0;
+	for (int cpu : cpus)
+	{
+		if (cpu >= 0 && cpu < (int)(sizeof(DWORD_PTR) * 8))
+		{
+			mask |= (DWORD_PTR)1 << cpu;
+		}
+	}
+
+	if (SetThreadAffinityMask(GetCurrentThread(), mask) == 0)
+	{
+		AppendError(errors, "Can't set CPU affinity", 0);
+	}
+}
+
+static void ApplyNice(int nice, string *errors)
+{
+	// Windows has no nice value; map its range onto the thread priority levels
+	int priority = THREAD_PRIORITY_NORMAL;
+	if (nice <= -10)
+		priority = THREAD_PRIORITY_HIGHEST;
+	else if (nice < 0)
+		priority = THREAD_PRIORITY_ABOVE_NORMAL;
+	else if (nice >= 10)
+		priority = THREAD_PRIORITY_LOWEST;
+	else if (nice > 0)
+		priority = THREAD_PRIORITY_BELOW_NORMAL;
+
+	if (!SetThreadPriority(GetCurrentThread(), priority))
+	{
+		AppendError(errors, "Can't set thread priority", 0);
+	}
+}
+
+static void ApplyFifoPriority(int priority, string *errors)
+{
+	if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+	{
+		AppendError(errors, "Can't set time-critical priority", 0);
+	}
+}
+
+#else
+
+static void ApplyAffinity(const vector<int> &cpus, string *errors)
+{
+	AppendError(errors, "CPU affinity is not supported on this platform", 0);
+}
+
+static void ApplyNice(int nice, string *errors)
+{
+	AppendError(errors, "Per-thread nice values are not supported on this platform", 0);
+}
+
+static void ApplyFifoPriority(int priority, string *errors)
+{
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = priority;
+
+	int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (error)
+	{
+		AppendError(errors, "Can't set SCHED_FIFO priority", error);
+	}
+}
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef _THREAD_POLICY_H
+#define _THREAD_POLICY_H
+
+#include <string>
+#include <vector>
+
+// CPU affinity and scheduling settings for the native monitor thread. Each
+// backend applies them from the monitor thread itself as it starts.
+
+typedef struct
+{
+	// CPUs the thread may run on; empty leaves the affinity alone
+	std::vector<int> cpus;
+	bool setNice;
+	int nice;
+	// SCHED_FIFO priority (time-critical on Windows); 0 leaves the policy alone
+	int fifoPriority;
+} MonitorThreadOptions_t;
+
+void SetMonitorThreadOptions(const MonitorThreadOptions_t &options);
+MonitorThreadOptions_t GetMonitorThreadOptions();
+
+// Call at the top of the monitor thread. Failures (e.g. EPERM for a negative
+// nice value or SCHED_FIFO) are not fatal; they are kept for GetMonitorThreadError().
+void ApplyMonitorThreadOptions();
+std::string GetMonitorThreadError();
+
+#endif
@@ -0,0 +1,252 @@
+#include <stdlib.h>
+#include <map>
+#include "topology.h"
+
+using namespace std;
+
+/**********************************
+ * Local typedefs
+ **********************************/
+typedef struct _TopologyNode_t
+{
+	DeviceItem_t *item;
+	map<int, struct _TopologyNode_t *> children;
+
+	_TopologyNode_t()
+	{
+		item = NULL;
+	}
+
+	~_TopologyNode_t()
+	{
+		map<int, struct _TopologyNode_t *>::iterator it;
+		for (it = children.begin(); it != children.end(); ++it)
+		{
+			delete it->second;
+		}
+	}
+} TopologyNode_t;
+
+/**********************************
+ * Local Variables
+ **********************************/
+// Bus number -> root hub node
+static map<int, TopologyNode_t *> busRoots;
+
+/**********************************
+ * Local Helper Functions
+ **********************************/
+static string FormatPortPath(const vector<int> &chain)
+{
+	string portPath;
+	if (chain.size() == 1)
+	{
+		return "usb" + to_string(chain[0]);
+	}
+
+	portPath = to_string(chain[0]) + "-";
+	for (size_t i = 1; i < chain.size(); i++)
+	{
+		if (i > 1)
+		{
+			portPath += ".";
+		}
+		portPath += to_string(chain[i]);
+	}
+	return portPath;
+}
+
+static TopologyNode_t *FindNode(const vector<int> &chain)
+{
+	map<int, TopologyNode_t *>::iterator root = busRoots.find(chain[0]);
+	if (root == busRoots.end())
+	{
+		return NULL;
+	}
+
+	TopologyNode_t *node = root->second;
+	for (size_t i = 1; i < chain.size() && node != NULL; i++)
+	{
+		map<int, TopologyNode_t *>::iterator child = node->children.find(chain[i]);
+		node = child == node->children.end() ? NULL : child->second;
+	}
+	return node;
+}
+
+static void CollectItems(TopologyNode_t *node, vector<DeviceItem_t *> *items)
+{
+	if (node->item != NULL)
+	{
+		(*items).push_back(node->item);
+	}
+
+	map<int, TopologyNode_t *>::iterator it;
+	for (it = node->children.begin(); it != node->children.end(); ++it)
+	{
+		CollectItems(it->second, items);
+	}
+}
+
+static void CollectEntries(TopologyNode_t *node, vector<int> *chain, int parent, vector<TopologyEntry_t> *entries)
+{
+	TopologyEntry_t entry;
+	entry.portPath = node->item != NULL ? node->item->deviceParams.extraFields[DeviceField_PortPath] : FormatPortPath(*chain);
+	entry.parent = parent;
+	entry.item = node->item;
+
+	int index = (int)(*entries).size();
+	(*entries).push_back(entry);
+
+	map<int, TopologyNode_t *>::iterator it;
+	for (it = node->children.begin(); it != node->children.end(); ++it)
+	{
+		(*chain).push_back(it->first);
+		CollectEntries(it->second, chain, index, entries);
+		(*chain).pop_back();
+	}
+}
+
+// Drop empty leaf nodes on the way back up after a removal
+static bool PruneNode(TopologyNode_t *node, const vector<int> &chain, size_t depth)
+{
+	if (depth < chain.size())
+	{
+		map<int, TopologyNode_t *>::iterator child = node->children.find(chain[depth]);
+		if (child != node->children.end() && PruneNode(child->second, chain, depth + 1))
+		{
+			delete child->second;
+			node->children.erase(child);
+		}
+	}
+
+	return node->item == NULL && node->children.empty();
+}
+
+/**********************************
+ * Public Functions
+ **********************************/
+bool ParsePortPath(const string &portPath, vector<int> *chain)
+{
+	bool isRootHub = portPath.compare(0, 3, "usb") == 0;
+	const char *cursor = portPath.c_str() + (isRootHub ? 3 : 0);
+	char *end;
+
+	(*chain).clear();
+
+	long bus = strtol(cursor, &end, 10);
+	if (end == cursor || bus <= 0)
+	{
+		return false;
+	}
+	(*chain).push_back((int)bus);
+
+	// "usb2" and "2" both name the root hub of bus 2
+	if (*end == '\0')
+	{
+		return true;
+	}
+	if (isRootHub || *end != '-')
+	{
+		return false;
+	}
+
+	do
+	{
+		cursor = end + 1;
+		long port = strtol(cursor, &end, 10);
+		if (end == cursor || port <= 0)
+		{
+			return false;
+		}
+		(*chain).push_back((int)port);
+	} while (*end == '.');
+
+	return *end == '\0';
+}
+
+void TopologyInsert(DeviceItem_t *item)
+{
+	vector<int> chain;
+	if (!(item->deviceParams.extraFieldMask & DEVICE_FIELD_BIT(DeviceField_PortPath)) ||
+		!ParsePortPath(item->deviceParams.extraFields[DeviceField_PortPath], &chain))
+	{
+		return;
+	}
+
+	TopologyNode_t *&root = busRoots[chain[0]];
+	if (root == NULL)
+	{
+		root = new TopologyNode_t();
+	}
+
+	TopologyNode_t *node = root;
+	for (size_t i = 1; i < chain.size(); i++)
+	{
+		TopologyNode_t *&child = node->children[chain[i]];
+		if (child == NULL)
+		{
+			child = new TopologyNode_t();
+		}
+		node = child;
+	}
+	node->item = item;
+}
+
+void TopologyRemove(DeviceItem_t *item)
+{
+	vector<int> chain;
+	if (!(item->deviceParams.extraFieldMask & DEVICE_FIELD_BIT(DeviceField_PortPath)) ||
+		!ParsePortPath(item->deviceParams.extraFields[DeviceField_PortPath], &chain))
+	{
+		return;
+	}
+
+	TopologyNode_t *node = FindNode(chain);
+	if (node == NULL || node->item != item)
+	{
+		return;
+	}
+	node->item = NULL;
+
+	map<int, TopologyNode_t *>::iterator root = busRoots.find(chain[0]);
+	if (PruneNode(root->second, chain, 1))
+	{
+		delete root->second;
+		busRoots.erase(root);
+	}
+}
+
+void TopologyClear()
+{
+	map<int, TopologyNode_t *>::iterator it;
+	for (it = busRoots.begin(); it != busRoots.end(); ++it)
+	{
+		delete it->second;
+	}
+	busRoots.clear();
+}
+
+void TopologyCollectUnder(const string &portPath, vector<DeviceItem_t *> *items)
+{
+	vector<int> chain;
+	if (!ParsePortPath(portPath, &chain))
+	{
+		return;
+	}
+
+	TopologyNode_t *node = FindNode(chain);
+	if (node != NULL)
+	{
+		CollectItems(node, items);
+	}
+}
+
+void TopologyCollectAll(vector<TopologyEntry_t> *entries)
+{
+	map<int, TopologyNode_t *>::iterator it;
+	for (it = busRoots.begin(); it != busRoots.end(); ++it)
+	{
+		vector<int> chain(1, it->first);
+		CollectEntries(it->second, &chain, -1, entries);
+	}
+}
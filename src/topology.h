@@ -0,0 +1,36 @@
+#ifndef _TOPOLOGY_H
+#define _TOPOLOGY_H
+
+#include <string>
+#include <vector>
+#include "deviceList.h"
+
+// Tree of the USB bus topology, keyed by the sysfs port chain of each device
+// ("2-1.4.3" is port 3 of the hub on port 4 of the hub on port 1 of bus 2,
+// "usb2" is the root hub of bus 2). The registry owns the DeviceItem_t's and
+// keeps this tree in sync under its own lock; none of these functions lock.
+
+typedef struct
+{
+	std::string portPath;
+	int parent; // index into the snapshot, -1 for bus roots
+	DeviceItem_t *item; // NULL for ports with nothing known attached
+} TopologyEntry_t;
+
+// Splits a port path into {bus, port, port, ...}. Returns false if malformed.
+bool ParsePortPath(const std::string &portPath, std::vector<int> *chain);
+
+void TopologyInsert(DeviceItem_t *item);
+void TopologyRemove(DeviceItem_t *item);
+void TopologyClear();
+
+// Every device at or below `portPath`, in pre-order. O(subtree size).
+void TopologyCollectUnder(const std::string &portPath, std::vector<DeviceItem_t *> *items);
+// The whole tree in pre-order; parents always precede their children.
+void TopologyCollectAll(std::vector<TopologyEntry_t> *entries);
+
+// Locked snapshot of the tree from the registry. Every non-NULL `item` is a
+// copy owned by the caller.
+void CreateTopologySnapshot(std::vector<TopologyEntry_t> *entries);
+
+#endif
@@ -0,0 +1,98 @@
+#include <atomic>
+#include <chrono>
+#include "trace.h"
+
+using namespace std;
+
+#ifdef TRACE_HAVE_USDT
+// Tracers find these through the probe notes and count themselves in and out
+#define TRACE_DEFINE_SEMAPHORE(name) unsigned short usb_detection_##name##_semaphore __attribute__((section(".probes"), visibility("hidden"))) = 0;
+extern "C"
+{
+	TRACE_PROBES(TRACE_DEFINE_SEMAPHORE)
+}
+#undef TRACE_DEFINE_SEMAPHORE
+#endif
+
+#ifdef USB_DETECTION_TRACE
+
+/**********************************
+ * Local defines
+ **********************************/
+// Must be a power of two
+#define TRACE_RING_SIZE 4096
+
+/**********************************
+ * Local typedefs
+ **********************************/
+// `sequence` is the 1-based position of the entry written into the slot, so a
+// reader can tell a complete entry from one being overwritten
+typedef struct
+{
+	atomic<uint64_t> sequence;
+	atomic<uint64_t> timestampNs;
+	atomic<const char *> name;
+	atomic<int64_t> arg1;
+	atomic<int64_t> arg2;
+} TraceSlot_t;
+
+/**********************************
+ * Local Variables
+ **********************************/
+static TraceSlot_t ring[TRACE_RING_SIZE];
+static atomic<uint64_t> ringHead{0};
+
+/**********************************
+ * Public Functions
+ **********************************/
+void TraceRecord(const char *name, int64_t arg1, int64_t arg2)
+{
+	uint64_t position = ringHead.fetch_add(1, memory_order_relaxed);
+	TraceSlot_t &slot = ring[position & (TRACE_RING_SIZE - 1)];
+
+	// Mark the slot as in progress, fill it in, then publish it
+	slot.sequence.store(0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	slot.timestampNs.store(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count(), memory_order_relaxed);
+	slot.name.store(name, memory_order_relaxed);
+	slot.arg1.store(arg1, memory_order_relaxed);
+	slot.arg2.store(arg2, memory_order_relaxed);
+	slot.sequence.store(position + 1, memory_order_release);
+}
+
+void TraceSnapshot(vector<TraceEntry_t> *entries)
+{
+	uint64_t head = ringHead.load(memory_order_acquire);
+	uint64_t start = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+
+	for (uint64_t position = start; position < head; position++)
+	{
+		TraceSlot_t &slot = ring[position & (TRACE_RING_SIZE - 1)];
+		if (slot.sequence.load(memory_order_acquire) != position + 1)
+		{
+			continue;
+		}
+
+		TraceEntry_t entry;
+		entry.timestampNs = slot.timestampNs.load(memory_order_relaxed);
+		entry.name = slot.name.load(memory_order_relaxed);
+		entry.arg1 = slot.arg1.load(memory_order_relaxed);
+		entry.arg2 = slot.arg2.load(memory_order_relaxed);
+
+		// Skip it if a writer lapped us while copying
+		atomic_thread_fence(memory_order_acquire);
+		if (slot.sequence.load(memory_order_relaxed) != position + 1)
+		{
+			continue;
+		}
+		entries->push_back(entry);
+	}
+}
+
+#else
+
+void TraceSnapshot(vector<TraceEntry_t> *entries)
+{
+}
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+// Tracing that costs nothing unless asked for:
+//
+// - USDT probes (provider `usb_detection`) when <sys/sdt.h> is available.
+//   Each is guarded by its semaphore, so until perf/bpftrace attaches it
+//   costs a load and a branch and its arguments are not evaluated, e.g.
+//   `bpftrace -e 'usdt:./build/Release/detection.node:usb_detection:* { @[probe] = count(); }'`
+// - A lock-free in-memory ring of the same events, compiled in only when
+//   built with USB_DETECTION_TRACE (`node-gyp rebuild -- -Dusb_detection_trace=1`)
+//   and read back from JS with `getTrace()`.
+// - DEBUG_LOG, which also prints to stderr when built with
+//   USB_DETECTION_DEBUG_LOG (`node-gyp rebuild -- -Dusb_detection_debug_log=1`).
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>) && !defined(USB_DETECTION_NO_USDT)
+// Makes every probe reference its usb_detection_<name>_semaphore
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define TRACE_HAVE_USDT 1
+#endif
+#endif
+
+// Every probe name; trace.cpp defines a semaphore for each
+#define TRACE_PROBES(X)    \
+	X(debug_log)           \
+	X(device_added)        \
+	X(device_changed)      \
+	X(device_removed)      \
+	X(find_done)           \
+	X(find_start)          \
+	X(init_done)           \
+	X(init_start)          \
+	X(register_added)      \
+	X(register_removed)    \
+	X(start_monitoring)    \
+	X(stop_monitoring)
+
+#ifdef TRACE_HAVE_USDT
+// Nonzero while a tracer is attached to the probe
+#define TRACE_DECLARE_SEMAPHORE(name) extern "C" unsigned short usb_detection_##name##_semaphore __attribute__((visibility("hidden")));
+TRACE_PROBES(TRACE_DECLARE_SEMAPHORE)
+#undef TRACE_DECLARE_SEMAPHORE
+#define TRACE_PROBE_ENABLED(name) __builtin_expect(usb_detection_##name##_semaphore, 0)
+#define TRACE_PROBE2(name, a, b)                      \
+	do                                                \
+	{                                                 \
+		if (TRACE_PROBE_ENABLED(name))                \
+		{                                             \
+			DTRACE_PROBE2(usb_detection, name, a, b); \
+		}                                             \
+	} while (0)
+#else
+#define TRACE_PROBE2(name, a, b) \
+	do                           \
+	{                            \
+	} while (0)
+#endif
+
+typedef struct
+{
+	uint64_t timestampNs;
+	// Static string: the probe name or, for DEBUG_LOG, the function name
+	const char *name;
+	int64_t arg1;
+	int64_t arg2;
+} TraceEntry_t;
+
+#ifdef USB_DETECTION_TRACE
+void TraceRecord(const char *name, int64_t arg1, int64_t arg2);
+#define TRACE_RECORD(name, a, b) TraceRecord(name, (int64_t)(a), (int64_t)(b))
+#else
+#define TRACE_RECORD(name, a, b) \
+	do                           \
+	{                            \
+	} while (0)
+#endif
+
+// TRACE_EVENT(find_done, count, 0): fires usb_detection:find_done and records it in the ring
+#define TRACE_EVENT(name, a, b)      \
+	do                               \
+	{                                \
+		TRACE_PROBE2(name, a, b);    \
+		TRACE_RECORD(#name, a, b);   \
+	} while (0)
+
+// Oldest first. Empty unless built with USB_DETECTION_TRACE.
+void TraceSnapshot(std::vector<TraceEntry_t> *entries);
+
+#ifdef USB_DETECTION_DEBUG_LOG
+#define DEBUG_HEADER fprintf(stderr, "node-usb-detection [%s:%s() %d]: ", __FILE__, __FUNCTION__, __LINE__);
+#define DEBUG_FOOTER fprintf(stderr, "\n");
+#define DEBUG_PRINT(...) DEBUG_HEADER fprintf(stderr, __VA_ARGS__); DEBUG_FOOTER
+#else
+#define DEBUG_PRINT(...)
+#endif
+
+// Diagnostic messages: a debug_log probe/ring entry (function name and line)
+// in every build, plus the formatted message on stderr when built with
+// USB_DETECTION_DEBUG_LOG. Not tied to DEBUG, which the macOS default
+// configuration defines.
+#define DEBUG_LOG(...)                                  \
+	do                                                  \
+	{                                                   \
+		TRACE_PROBE2(debug_log, __FUNCTION__, __LINE__); \
+		TRACE_RECORD(__FUNCTION__, __LINE__, 0);        \
+		DEBUG_PRINT(__VA_ARGS__);                       \
+	} while (0)
+
+#endif
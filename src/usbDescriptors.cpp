@@ -0,0 +1,161 @@
+#include <string>
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "usbDescriptors.h"
+
+using namespace std;
+
+/**********************************
+ * Local defines
+ **********************************/
+#define USB_DT_INTERFACE 0x04
+#define USB_DT_INTERFACE_SIZE 9
+// Offsets into an interface descriptor
+#define INTERFACE_CLASS_OFFSET 5
+#define INTERFACE_SUBCLASS_OFFSET 6
+#define INTERFACE_PROTOCOL_OFFSET 7
+
+// Large enough for the device descriptor plus the configurations of all but
+// the most elaborate devices; anything beyond it is not parsed
+#define DESCRIPTORS_MAX_BYTES 8192
+
+// Which bytes of a packed query must match
+#define INTERFACE_QUERY_CLASS (1u << 24)
+#define INTERFACE_QUERY_SUBCLASS (1u << 25)
+#define INTERFACE_QUERY_PROTOCOL (1u << 26)
+
+/**********************************
+ * Local Helper Functions
+ **********************************/
+static void AddInterfaceType(ListResultItem_t *item, uint8_t interfaceClass, uint8_t interfaceSubclass, uint8_t protocol)
+{
+	for (unsigned int i = 0; i < item->interfaceTypeCount; i++)
+	{
+		const InterfaceType_t &known = item->interfaceTypes[i];
+		if (known.interfaceClass == interfaceClass && known.interfaceSubclass == interfaceSubclass && known.protocol == protocol)
+		{
+			return;
+		}
+	}
+	if (item->interfaceTypeCount < MAX_INTERFACE_TYPES)
+	{
+		InterfaceType_t &added = item->interfaceTypes[item->interfaceTypeCount++];
+		added.interfaceClass = interfaceClass;
+		added.interfaceSubclass = interfaceSubclass;
+		added.protocol = protocol;
+	}
+}
+
+static bool MatchesInterfaceType(const InterfaceType_t &type, uint32_t query)
+{
+	return (!(query & INTERFACE_QUERY_CLASS) || type.interfaceClass == ((query >> 16) & 0xff)) &&
+		   (!(query & INTERFACE_QUERY_SUBCLASS) || type.interfaceSubclass == ((query >> 8) & 0xff)) &&
+		   (!(query & INTERFACE_QUERY_PROTOCOL) || type.protocol == (query & 0xff));
+}
+
+/**********************************
+ * Public Functions
+ **********************************/
+void ParseInterfaceTypes(const uint8_t *descriptors, size_t length, ListResultItem_t *item)
+{
+	item->interfaceTypeCount = 0;
+	size_t offset = 0;
+	while (length - offset >= 2)
+	{
+		const uint8_t *descriptor = descriptors + offset;
+		size_t descriptorLength = descriptor[0];
+		if (descriptorLength < 2 || descriptorLength > length - offset)
+		{
+			break;
+		}
+		if (descriptor[1] == USB_DT_INTERFACE && descriptorLength >= USB_DT_INTERFACE_SIZE)
+		{
+			AddInterfaceType(item, descriptor[INTERFACE_CLASS_OFFSET], descriptor[INTERFACE_SUBCLASS_OFFSET], descriptor[INTERFACE_PROTOCOL_OFFSET]);
+		}
+		offset += descriptorLength;
+	}
+}
+
+uint32_t MakeInterfaceQuery(int interfaceClass, int interfaceSubclass, int protocol)
+{
+	uint32_t query = 0;
+	if (interfaceClass >= 0)
+	{
+		query |= INTERFACE_QUERY_CLASS | (uint32_t)(interfaceClass & 0xff) << 16;
+	}
+	if (interfaceSubclass >= 0)
+	{
+		query |= INTERFACE_QUERY_SUBCLASS | (uint32_t)(interfaceSubclass & 0xff) << 8;
+	}
+	if (protocol >= 0)
+	{
+		query |= INTERFACE_QUERY_PROTOCOL | (uint32_t)(protocol & 0xff);
+	}
+	return query;
+}
+
+bool InterfaceTypesMatch(const InterfaceType_t *types, unsigned int count, uint32_t query)
+{
+	if (query == 0)
+	{
+		return true;
+	}
+	for (unsigned int i = 0; i < count && i < MAX_INTERFACE_TYPES; i++)
+	{
+		if (MatchesInterfaceType(types[i], query))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool MatchesInterfaceQuery(const ListResultItem_t *item, uint32_t query)
+{
+	return InterfaceTypesMatch(item->interfaceTypes, item->interfaceTypeCount, query);
+}
+
+#ifdef __linux__
+
+bool ReadInterfaceTypes(const char *devicePath, ListResultItem_t *item)
+{
+	string path = string(devicePath) + "/descriptors";
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	// The one copy is the kernel's, into this buffer; the parser walks it
+	uint8_t descriptors[DESCRIPTORS_MAX_BYTES];
+	size_t length = 0;
+	while (length < sizeof(descriptors))
+	{
+		ssize_t got = read(fd, descriptors + length, sizeof(descriptors) - length);
+		if (got < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (got <= 0)
+		{
+			break;
+		}
+		length += (size_t)got;
+	}
+	close(fd);
+
+	ParseInterfaceTypes(descriptors, length, item);
+	return true;
+}
+
+#else
+
+bool ReadInterfaceTypes(const char *devicePath, ListResultItem_t *item)
+{
+	return false;
+}
+
+#endif
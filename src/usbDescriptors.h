@@ -0,0 +1,28 @@
+#ifndef _USB_DESCRIPTORS_H
+#define _USB_DESCRIPTORS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "deviceList.h"
+
+// Interface types from the raw descriptors the kernel keeps for every USB
+// device (sysfs `descriptors`: the device descriptor followed by each
+// configuration as the device sent it), so devices can be found by interface
+// class without asking the device or running `lsusb -v`.
+
+// Walks `length` bytes of descriptors in place and records the distinct
+// class/subclass/protocol triples of the interface descriptors, alternate
+// settings included. Stops at the first malformed descriptor.
+void ParseInterfaceTypes(const uint8_t *descriptors, size_t length, ListResultItem_t *item);
+// Reads `<devicePath>/descriptors` and parses it. Linux only; returns false
+// (leaving `item` alone) if it cannot be read.
+bool ReadInterfaceTypes(const char *devicePath, ListResultItem_t *item);
+
+// Packs an interface filter into one value, e.g. for cache keys. -1 leaves a
+// field unconstrained; all three -1 gives 0, which matches every device.
+uint32_t MakeInterfaceQuery(int interfaceClass, int interfaceSubclass, int protocol);
+// Whether any of the interface types satisfies the whole query
+bool InterfaceTypesMatch(const InterfaceType_t *types, unsigned int count, uint32_t query);
+bool MatchesInterfaceQuery(const ListResultItem_t *item, uint32_t query);
+
+#endif
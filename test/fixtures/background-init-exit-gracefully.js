@@ -0,0 +1,5 @@
+process.env.USB_DETECTION_BACKGROUND_INIT = '1';
+
+var usbDetect = require('../../');
+
+usbDetect.ready();
@@ -0,0 +1,12 @@
+// Prints `find()` as JSON, with the device list snapshot kept at argv[2]
+var usbDetect = require('../../');
+
+usbDetect.setCacheFile(process.argv[2]);
+usbDetect.find()
+	.then(function(devices) {
+		console.log(JSON.stringify(devices));
+	})
+	.catch(function(err) {
+		console.error(err);
+		process.exit(1);
+	});
@@ -0,0 +1,58 @@
+// Fills a fake tree with enough devices that vendor filters are answered from
+// the id columns, and exits non-zero unless `find()` agrees with filtering the
+// full list in JS
+var createFakeUsbTree = require('../lib/fake-usb-tree');
+
+var tree = createFakeUsbTree();
+var VENDOR_IDS = [0x0403, 0x16c0, 0x2341, 0x1a86];
+var DEVICE_COUNT = 40;
+
+function fail(message) {
+	console.error(message);
+	tree.remove();
+	process.exit(1);
+}
+
+for(var i = 0; i < DEVICE_COUNT; i++) {
+	var vendorId = VENDOR_IDS[i % VENDOR_IDS.length];
+	var productId = Math.floor(i / VENDOR_IDS.length) % 2 ? 0x6001 : 0x0483;
+	tree.addDevice(1, i + 2, '1-' + (i + 1), vendorId.toString(16).padStart(4, '0'), productId.toString(16).padStart(4, '0'), 'Device ' + i);
+}
+
+var usbDetect = require('../../');
+usbDetect.useInotifyMonitor({
+	sysfsRoot: tree.sysfsRoot,
+	devRoot: tree.devRoot
+});
+
+function expectSame(query, found, all) {
+	var expected = all.filter(function(device) {
+		return device.vendorId === query.vendorId && (!query.productId || device.productId === query.productId);
+	});
+	if(expected.length === 0 || JSON.stringify(found) !== JSON.stringify(expected)) {
+		fail('find(' + JSON.stringify(query) + ') returned ' + found.length + ' devices, expected ' + expected.length);
+	}
+}
+
+usbDetect.find()
+	.then(function(all) {
+		if(all.length !== DEVICE_COUNT) {
+			fail('Unexpected initial devices: ' + all.length);
+		}
+		return Promise.all(VENDOR_IDS.map(function(vendorId) {
+			return Promise.all([
+				usbDetect.find(vendorId).then(function(found) {
+					expectSame({ vendorId: vendorId }, found, all);
+				}),
+				usbDetect.find(vendorId, 0x6001).then(function(found) {
+					expectSame({ vendorId: vendorId, productId: 0x6001 }, found, all);
+				})
+			]);
+		}));
+	})
+	.then(function() {
+		tree.remove();
+	})
+	.catch(function(err) {
+		fail(err);
+	});
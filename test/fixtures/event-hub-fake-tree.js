@@ -0,0 +1,101 @@
+// Runs an event hub over a fake tree in a child process and exits non-zero
+// unless this process, subscribed to it, sees a plug and, after the hub
+// restarts, a removal that happened while it was down
+var childProcess = require('child_process');
+var path = require('path');
+
+var usbDetect = require('../../');
+
+// Hub mode: sysfsRoot, devRoot and the socket path are passed in
+if(process.argv[2] === 'hub') {
+	usbDetect.useInotifyMonitor({
+		sysfsRoot: process.argv[3],
+		devRoot: process.argv[4]
+	});
+	usbDetect.startEventHub(process.argv[5]);
+	process.send('listening');
+	// The IPC channel keeps this process alive until it is killed
+	return;
+}
+
+var createFakeUsbTree = require('../lib/fake-usb-tree');
+
+var tree = createFakeUsbTree();
+var socketPath = path.join(tree.sysfsRoot, '..', 'hub.sock');
+var hub;
+
+function fail(message) {
+	console.error(message);
+	if(hub) {
+		hub.kill('SIGKILL');
+	}
+	tree.remove();
+	process.exit(1);
+}
+
+function startHub() {
+	return new Promise(function(resolve) {
+		hub = childProcess.fork(__filename, ['hub', tree.sysfsRoot, tree.devRoot, socketPath]);
+		hub.once('message', resolve);
+	});
+}
+
+function stopHub() {
+	return new Promise(function(resolve) {
+		hub.once('exit', resolve);
+		hub.kill('SIGKILL');
+	});
+}
+
+function nextEvent(eventName) {
+	return new Promise(function(resolve) {
+		usbDetect.once(eventName, resolve);
+	});
+}
+
+function delay(ms) {
+	return new Promise(function(resolve) {
+		setTimeout(resolve, ms);
+	});
+}
+
+tree.addDevice(1, 2, '1-1', '1001', '0001', 'Unplugged while the hub is down');
+
+startHub()
+	.then(function() {
+		usbDetect.useEventHub(socketPath);
+		usbDetect.startMonitoring();
+		// Time for the receiver to connect and take its baseline
+		return delay(500);
+	})
+	.then(function() {
+		var added = nextEvent('add');
+		tree.addDevice(1, 3, '1-2', '1002', '0001', 'Plugged while connected');
+		return added;
+	})
+	.then(function(device) {
+		if(device.vendorId !== 0x1002) {
+			fail('Unexpected add: ' + JSON.stringify(device));
+		}
+		return stopHub();
+	})
+	.then(function() {
+		tree.removeDevice(1, 2);
+		var removed = nextEvent('remove');
+		return startHub().then(function() {
+			return removed;
+		});
+	})
+	.then(function(device) {
+		if(device.vendorId !== 0x1001) {
+			fail('Unexpected remove: ' + JSON.stringify(device));
+		}
+		usbDetect.stopMonitoring();
+		return stopHub();
+	})
+	.then(function() {
+		tree.remove();
+	})
+	.catch(function(err) {
+		fail(err);
+	});
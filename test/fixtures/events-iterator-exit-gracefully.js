@@ -0,0 +1,9 @@
+var usbDetect = require('../../');
+
+var iterator = usbDetect.events();
+
+// A pending `next()` keeps the process alive until the iterator is closed
+iterator.next();
+setTimeout(function() {
+	iterator.return();
+}, 100);
@@ -0,0 +1,75 @@
+// Exits non-zero unless only the fields passed to `setExtraFields()` show up
+// on devices of a fake tree
+var createFakeUsbTree = require('../lib/fake-usb-tree');
+
+var tree = createFakeUsbTree();
+
+var DEVICE_KEYS = ['locationId', 'vendorId', 'productId', 'deviceName', 'manufacturer', 'serialNumber', 'deviceAddress', 'handle'];
+
+function fail(message) {
+	console.error(message);
+	tree.remove();
+	process.exit(1);
+}
+
+function checkKeys(device, extraKeys) {
+	var keys = Object.keys(device).sort();
+	if(JSON.stringify(keys) !== JSON.stringify(DEVICE_KEYS.concat(extraKeys).sort())) {
+		fail('Unexpected device keys: ' + keys.join(', '));
+	}
+}
+
+// Everything an extra field can be read from
+function addDevice(bus, address, portPath, vendorId, productId, name, speed) {
+	tree.addSysfsDevice(bus, address, portPath, vendorId, productId, name);
+	tree.writeAttribute(portPath, 'speed', speed);
+	tree.writeAttribute(portPath, 'bDeviceClass', '09');
+	tree.writeAttribute(portPath, 'bcdDevice', '0100');
+	tree.linkDriver(portPath, 'usb');
+	tree.addNode(bus, address);
+}
+
+addDevice(1, 1, 'usb1', '1d6b', '0002', 'Root hub', '480');
+
+var usbDetect = require('../../');
+usbDetect.useInotifyMonitor({
+	sysfsRoot: tree.sysfsRoot,
+	devRoot: tree.devRoot
+});
+
+usbDetect.find()
+	.then(function(devices) {
+		if(devices.length !== 1) {
+			fail('Unexpected initial devices: ' + JSON.stringify(devices));
+		}
+		checkKeys(devices[0], []);
+
+		usbDetect.setExtraFields(['driver', 'speed', 'portPath']);
+		usbDetect.startMonitoring();
+		// Give the monitor thread a moment to set up its watches
+		return new Promise(function(resolve) {
+			setTimeout(resolve, 200);
+		});
+	})
+	.then(function() {
+		var added = new Promise(function(resolve) {
+			usbDetect.on('add', resolve);
+		});
+		addDevice(1, 2, '1-1', '0403', '6001', 'FT232R', '12');
+		return added;
+	})
+	.then(function(device) {
+		checkKeys(device, ['driver', 'speed', 'portPath']);
+		if(device.driver !== 'usb' || device.speed !== 12 || device.portPath !== '1-1') {
+			fail('Unexpected extra fields: ' + JSON.stringify(device));
+		}
+		usbDetect.stopMonitoring();
+		tree.remove();
+	})
+	.catch(function(err) {
+		fail(err);
+	});
+
+setTimeout(function() {
+	fail('Timed out waiting for the added device');
+}, 5000).unref();
@@ -0,0 +1,80 @@
+// Runs the inotify monitor against a fake /sys and /dev tree and exits
+// non-zero unless the expected devices and events show up
+var createFakeUsbTree = require('../lib/fake-usb-tree');
+
+var tree = createFakeUsbTree();
+
+// Device, configuration, hub interface and endpoint descriptors of a root hub
+var HUB_DESCRIPTORS = [
+	18, 1, 0x00, 0x02, 9, 0, 1, 64, 0x6b, 0x1d, 0x02, 0x00, 0, 0, 3, 2, 1, 1,
+	9, 2, 25, 0, 1, 1, 0, 0xe0, 0,
+	9, 4, 0, 0, 1, 9, 0, 0, 0,
+	7, 5, 0x81, 3, 4, 0, 12
+];
+
+// What the device list accounts for; must return to the same after a plug cycle
+function storedBytes() {
+	var usage = usbDetect.getMemoryUsage();
+	return usage.registry.bytes + usage.strings.bytes;
+}
+
+function fail(message) {
+	console.error(message);
+	process.exit(1);
+}
+
+tree.addDevice(1, 1, 'usb1', '1d6b', '0002', 'Root hub');
+tree.writeDescriptors('usb1', HUB_DESCRIPTORS);
+
+var usbDetect = require('../../');
+var baselineBytes;
+usbDetect.useInotifyMonitor({
+	sysfsRoot: tree.sysfsRoot,
+	devRoot: tree.devRoot
+});
+
+usbDetect.find()
+	.then(function(devices) {
+		if(devices.length !== 1 || devices[0].vendorId !== 0x1d6b) {
+			fail('Unexpected initial devices: ' + JSON.stringify(devices));
+		}
+		if(usbDetect.findSync({ interfaceClass: 9 }).length !== 1 || usbDetect.findSync({ interfaceClass: 9, protocol: 1 }).length !== 0) {
+			fail('Unexpected interface class matches');
+		}
+
+		baselineBytes = storedBytes();
+		usbDetect.startMonitoring();
+		return new Promise(function(resolve) {
+			usbDetect.on('add:1027:24577', function(device) {
+				if(device.deviceName !== 'FT232R' || device.locationId !== 1 || device.deviceAddress !== 5) {
+					fail('Unexpected added device: ' + JSON.stringify(device));
+				}
+				tree.removeDevice(1, 5);
+			});
+			usbDetect.on('remove:1027:24577', resolve);
+			// Give the monitor thread a moment to set up its watches
+			setTimeout(function() {
+				tree.addDevice(1, 5, '1-2', '0403', '6001', 'FT232R');
+			}, 200);
+		});
+	})
+	.then(function() {
+		return usbDetect.find();
+	})
+	.then(function(devices) {
+		if(devices.length !== 1) {
+			fail('Unexpected devices after remove: ' + JSON.stringify(devices));
+		}
+		if(storedBytes() !== baselineBytes) {
+			fail('Memory accounting drifted over a plug cycle: ' + baselineBytes + ' -> ' + storedBytes());
+		}
+		usbDetect.stopMonitoring();
+		tree.remove();
+	})
+	.catch(function(err) {
+		fail(err);
+	});
+
+setTimeout(function() {
+	fail('Timed out waiting for inotify events');
+}, 5000).unref();
@@ -0,0 +1,79 @@
+// Gives fake devices malformed and oversized descriptors and exits non-zero
+// unless `find()` by interface class sees exactly the interfaces that parse
+var createFakeUsbTree = require('../lib/fake-usb-tree');
+
+var tree = createFakeUsbTree();
+
+var DEVICE_DESCRIPTOR = [18, 1, 0x00, 0x02, 0, 0, 0, 64, 0x34, 0x12, 0x01, 0x00, 0, 0, 1, 2, 3, 1];
+var CONFIGURATION_DESCRIPTOR = [9, 2, 0, 0, 1, 1, 0, 0x80, 50];
+
+function interfaceDescriptor(number, interfaceClass) {
+	return [9, 4, number, 0, 0, interfaceClass, 0, 0, 0];
+}
+
+function fail(message) {
+	console.error(message);
+	tree.remove();
+	process.exit(1);
+}
+
+// The second interface descriptor is cut off
+tree.addDevice(1, 2, '1-1', '1001', '0001', 'Truncated');
+tree.writeDescriptors('1-1', DEVICE_DESCRIPTOR.concat(CONFIGURATION_DESCRIPTOR, interfaceDescriptor(0, 0x02), interfaceDescriptor(1, 0x0a).slice(0, 6)));
+
+// An empty descriptors file
+tree.addDevice(1, 3, '1-2', '1002', '0001', 'Empty');
+tree.writeDescriptors('1-2', []);
+
+// A zero bLength stops the walk instead of looping on it
+tree.addDevice(1, 4, '1-3', '1003', '0001', 'Zero length');
+tree.writeDescriptors('1-3', DEVICE_DESCRIPTOR.concat(CONFIGURATION_DESCRIPTOR, interfaceDescriptor(0, 0x03), [0, 4], interfaceDescriptor(1, 0x07)));
+
+// Ten distinct interface types; only the first eight are kept
+var composite = DEVICE_DESCRIPTOR.concat(CONFIGURATION_DESCRIPTOR);
+for(var i = 0; i < 10; i++) {
+	composite = composite.concat(interfaceDescriptor(i, 0xf0 + i));
+}
+tree.addDevice(1, 5, '1-4', '1004', '0001', 'Composite');
+tree.writeDescriptors('1-4', composite);
+
+var usbDetect = require('../../');
+usbDetect.useInotifyMonitor({
+	sysfsRoot: tree.sysfsRoot,
+	devRoot: tree.devRoot
+});
+
+// Interface class -> vendor ids of the devices expected to have it
+var EXPECTED = {
+	0x02: [0x1001],
+	0x0a: [],
+	0x03: [0x1003],
+	0x07: [],
+	0xf0: [0x1004],
+	0xf7: [0x1004],
+	0xf8: [],
+	0xf9: []
+};
+
+usbDetect.find()
+	.then(function(all) {
+		if(all.length !== 4) {
+			fail('Unexpected initial devices: ' + all.length);
+		}
+		return Promise.all(Object.keys(EXPECTED).map(function(interfaceClass) {
+			return usbDetect.find({ interfaceClass: Number(interfaceClass) }).then(function(found) {
+				var vendorIds = found.map(function(device) {
+					return device.vendorId;
+				});
+				if(JSON.stringify(vendorIds) !== JSON.stringify(EXPECTED[interfaceClass])) {
+					fail('find({ interfaceClass: ' + interfaceClass + ' }) returned ' + JSON.stringify(vendorIds));
+				}
+			});
+		}));
+	})
+	.then(function() {
+		tree.remove();
+	})
+	.catch(function(err) {
+		fail(err);
+	});
@@ -0,0 +1,28 @@
+var usbDetect = require('../../');
+
+function fail(message) {
+	console.error(message);
+	process.exit(1);
+}
+
+usbDetect.startMonitoring();
+
+// Every change restarts the monitor thread
+setTimeout(function() {
+	usbDetect.setMonitorOptions({ nice: 5 });
+	usbDetect.setMonitorOptions({ cpus: [0] });
+	usbDetect.setMonitorOptions({ nice: null, cpus: null });
+
+	var stats = usbDetect.getStats();
+	if(!stats.monitoring || stats.monitorThread.nice !== null || stats.monitorThread.cpus.length !== 0) {
+		fail('Unexpected stats: ' + JSON.stringify(stats));
+	}
+
+	usbDetect.find()
+		.then(function() {
+			usbDetect.stopMonitoring();
+		})
+		.catch(function(err) {
+			fail(err);
+		});
+}, 100);
@@ -0,0 +1,110 @@
+// Changes a fake tree while events are paused and exits non-zero unless
+// `resume()` delivers them coalesced per device connection
+var createFakeUsbTree = require('../lib/fake-usb-tree');
+
+var tree = createFakeUsbTree();
+
+function fail(message) {
+	console.error(message);
+	tree.remove();
+	process.exit(1);
+}
+
+function wait(ms) {
+	return new Promise(function(resolve) {
+		setTimeout(resolve, ms);
+	});
+}
+
+tree.addDevice(1, 1, 'usb1', '1d6b', '0002', 'Root hub');
+tree.addDevice(1, 3, '1-1', '0403', '6001', 'FT232R');
+
+var usbDetect = require('../../');
+usbDetect.useInotifyMonitor({
+	sysfsRoot: tree.sysfsRoot,
+	devRoot: tree.devRoot
+});
+
+var events = [];
+usbDetect.on('add', function(device) {
+	events.push({ type: 'add', device: device });
+});
+usbDetect.on('remove', function(device) {
+	events.push({ type: 'remove', device: device });
+});
+usbDetect.on('change', function(device, changedFields) {
+	// add and remove are also emitted as `change`, without changedFields
+	if(changedFields !== undefined) {
+		events.push({ type: 'change', device: device, changedFields: changedFields });
+	}
+});
+
+var serialHandle;
+usbDetect.find(0x0403, 0x6001)
+	.then(function(devices) {
+		serialHandle = devices[0].handle;
+		usbDetect.startMonitoring();
+		// Give the monitor thread a moment to set up its watches
+		return wait(200);
+	})
+	.then(function() {
+		usbDetect.pause();
+
+		// Comes and goes while paused: cancels out
+		tree.addDevice(1, 5, '1-2', '2341', '0043', 'Uno');
+		return wait(100);
+	})
+	.then(function() {
+		tree.removeDevice(1, 5);
+		return wait(100);
+	})
+	.then(function() {
+		// Two changes of the same device merge into one
+		tree.writeAttribute('usb1', 'product', 'Renamed hub');
+		return usbDetect.reconcile();
+	})
+	.then(function() {
+		tree.writeAttribute('usb1', 'manufacturer', 'Linux');
+		return usbDetect.reconcile();
+	})
+	.then(function() {
+		// Unplugged and plugged back: a new connection with a new handle, so
+		// the old one still has to be reported removed
+		tree.removeDevice(1, 3);
+		return wait(100);
+	})
+	.then(function() {
+		tree.addNode(1, 3);
+		return wait(100);
+	})
+	.then(function() {
+		if(events.length !== 0) {
+			fail('Events were delivered while paused: ' + JSON.stringify(events));
+		}
+		usbDetect.resume();
+		return wait(200);
+	})
+	.then(function() {
+		var summary = events.map(function(event) {
+			return event.type + ' ' + event.device.vendorId.toString(16);
+		});
+		if(JSON.stringify(summary) !== JSON.stringify(['change 1d6b', 'remove 403', 'add 403'])) {
+			fail('Unexpected events after resume: ' + JSON.stringify(events));
+		}
+		var bits = usbDetect.fieldBits;
+		if(events[0].changedFields !== (bits.deviceName | bits.manufacturer) || events[0].device.deviceName !== 'Renamed hub') {
+			fail('Changes were not merged: ' + JSON.stringify(events[0]));
+		}
+		if(events[1].device.handle !== serialHandle || events[2].device.handle === serialHandle) {
+			fail('Unexpected handles: ' + JSON.stringify(events.slice(1)));
+		}
+		usbDetect.stopMonitoring();
+		tree.remove();
+	})
+	.catch(function(err) {
+		fail(err);
+	});
+
+setTimeout(function() {
+	fail('Timed out waiting for paused events');
+}, 5000).unref();
@@ -0,0 +1,97 @@
+// Changes a fake tree behind the inotify monitor's back and exits non-zero
+// unless `reconcile()` reports and emits exactly the difference
+var createFakeUsbTree = require('../lib/fake-usb-tree');
+
+var tree = createFakeUsbTree();
+
+var DEVICE_KEYS = ['locationId', 'vendorId', 'productId', 'deviceName', 'manufacturer', 'serialNumber', 'deviceAddress', 'handle'];
+
+function fail(message) {
+	console.error(message);
+	tree.remove();
+	process.exit(1);
+}
+
+function checkShape(device) {
+	var keys = Object.keys(device).sort();
+	if(JSON.stringify(keys) !== JSON.stringify(DEVICE_KEYS.slice().sort())) {
+		fail('Unexpected device keys: ' + keys.join(', '));
+	}
+}
+
+function once(eventName) {
+	return new Promise(function(resolve) {
+		usbDetect.on(eventName, resolve);
+	});
+}
+
+tree.addDevice(1, 1, 'usb1', '1d6b', '0002', 'Root hub');
+tree.addDevice(1, 3, '1-1', '0403', '6001', 'FT232R');
+
+var usbDetect = require('../../');
+usbDetect.useInotifyMonitor({
+	sysfsRoot: tree.sysfsRoot,
+	devRoot: tree.devRoot
+});
+
+usbDetect.find()
+	.then(function(devices) {
+		if(devices.length !== 2) {
+			fail('Unexpected initial devices: ' + JSON.stringify(devices));
+		}
+		usbDetect.startMonitoring();
+		// Give the monitor thread a moment to set up its watches
+		return new Promise(function(resolve) {
+			setTimeout(resolve, 200);
+		});
+	})
+	.then(function() {
+		// A node whose sysfs entry shows up late can't be read when the
+		// monitor sees it, and a device that leaves sysfs alone fires nothing
+		tree.addNode(1, 5);
+		tree.addSysfsDevice(1, 5, '1-2', '2341', '0043', 'Uno');
+		tree.removeSysfsDevice('1-1');
+		return new Promise(function(resolve) {
+			setTimeout(resolve, 200);
+		});
+	})
+	.then(function() {
+		return usbDetect.find();
+	})
+	.then(function(devices) {
+		if(devices.length !== 2) {
+			fail('The monitor saw changes it should have missed: ' + JSON.stringify(devices));
+		}
+		return Promise.all([usbDetect.reconcile(), once('add:9025:67'), once('remove:1027:24577')]);
+	})
+	.then(function(results) {
+		var changes = results[0];
+		if(changes.added.length !== 1 || changes.removed.length !== 1) {
+			fail('Unexpected changes: ' + JSON.stringify(changes));
+		}
+		changes.added.concat(changes.removed, results[1], results[2]).forEach(checkShape);
+		if(changes.added[0].deviceName !== 'Uno' || changes.added[0].deviceAddress !== 5 || changes.removed[0].deviceName !== 'FT232R') {
+			fail('Unexpected changes: ' + JSON.stringify(changes));
+		}
+		if(results[1].handle !== changes.added[0].handle || results[2].handle !== changes.removed[0].handle) {
+			fail('Emitted events differ from the reported changes');
+		}
+		return Promise.all([usbDetect.reconcile(), usbDetect.find()]);
+	})
+	.then(function(results) {
+		if(results[0].added.length !== 0 || results[0].removed.length !== 0) {
+			fail('A second reconcile found changes: ' + JSON.stringify(results[0]));
+		}
+		if(results[1].length !== 2 || !results[1].some(function(device) { return device.vendorId === 0x2341; })) {
+			fail('Unexpected devices after reconcile: ' + JSON.stringify(results[1]));
+		}
+		usbDetect.stopMonitoring();
+		tree.remove();
+	})
+	.catch(function(err) {
+		fail(err);
+	});
+
+setTimeout(function() {
+	fail('Timed out waiting for reconcile()');
+}, 5000).unref();
@@ -0,0 +1,88 @@
+// Exits non-zero unless devices of a fake tree without string descriptors
+// only get hwdb names after `setResolveNames(true)`
+var fs = require('fs');
+var createFakeUsbTree = require('../lib/fake-usb-tree');
+
+var tree = createFakeUsbTree();
+
+// Where libudev looks for the compiled hwdb. Without one, resolving names
+// has to leave them empty.
+var HWDB_PATHS = [
+	'/etc/systemd/hwdb/hwdb.bin',
+	'/etc/udev/hwdb.bin',
+	'/usr/lib/systemd/hwdb/hwdb.bin',
+	'/usr/lib/udev/hwdb.bin',
+	'/lib/systemd/hwdb/hwdb.bin',
+	'/lib/udev/hwdb.bin'
+];
+var hasHwdb = HWDB_PATHS.some(function(hwdbPath) {
+	return fs.existsSync(hwdbPath);
+});
+
+function fail(message) {
+	console.error(message);
+	tree.remove();
+	process.exit(1);
+}
+
+function checkNames(device, manufacturer, deviceName) {
+	if(device.manufacturer !== manufacturer || device.deviceName !== deviceName) {
+		fail('Unexpected names: ' + JSON.stringify(device));
+	}
+}
+
+tree.addDevice(1, 1, 'usb1', '1d6b', '0002');
+
+// The variable would turn it on from the start
+delete process.env.USB_DETECTION_RESOLVE_NAMES;
+var usbDetect = require('../../');
+usbDetect.useInotifyMonitor({
+	sysfsRoot: tree.sysfsRoot,
+	devRoot: tree.devRoot
+});
+
+usbDetect.find()
+	.then(function(devices) {
+		if(devices.length !== 1) {
+			fail('Unexpected initial devices: ' + JSON.stringify(devices));
+		}
+		checkNames(devices[0], '', '');
+
+		usbDetect.setResolveNames(true);
+		usbDetect.startMonitoring();
+		// Give the monitor thread a moment to set up its watches
+		return new Promise(function(resolve) {
+			setTimeout(resolve, 200);
+		});
+	})
+	.then(function() {
+		var added = [];
+		var bothAdded = new Promise(function(resolve) {
+			usbDetect.on('add', function(device) {
+				added.push(device);
+				if(added.length === 2) {
+					resolve(added.sort(function(a, b) {
+						return a.deviceAddress - b.deviceAddress;
+					}));
+				}
+			});
+		});
+		tree.addDevice(2, 1, 'usb2', '1d6b', '0002');
+		tree.addDevice(2, 2, '2-1', '1d6b', '0003', 'Own name');
+		return bothAdded;
+	})
+	.then(function(added) {
+		var vendor = hasHwdb ? 'Linux Foundation' : '';
+		checkNames(added[0], vendor, hasHwdb ? '2.0 root hub' : '');
+		// A name the device reports itself is kept
+		checkNames(added[1], vendor, 'Own name');
+		usbDetect.stopMonitoring();
+		tree.remove();
+	})
+	.catch(function(err) {
+		fail(err);
+	});
+
+setTimeout(function() {
+	fail('Timed out waiting for the added devices');
+}, 5000).unref();
@@ -0,0 +1,14 @@
+var usbDetect = require('../../');
+
+usbDetect.startMonitoring();
+
+setTimeout(function() {
+	usbDetect.stopMonitoring();
+	usbDetect.startMonitoring();
+	usbDetect.pause();
+	usbDetect.resume();
+
+	usbDetect.find().then(function() {
+		usbDetect.stopMonitoring();
+	});
+}, 100);
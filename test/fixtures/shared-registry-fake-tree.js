@@ -0,0 +1,61 @@
+// Publishes a fake tree and reads it back through the shared device list in
+// the same process, and exits non-zero unless `find()` sees every device and
+// fails once the publisher has stopped, and `reconcile()` refuses to run
+var createFakeUsbTree = require('../lib/fake-usb-tree');
+
+var tree = createFakeUsbTree();
+var REGISTRY_NAME = '/usb-detection-test-' + process.pid;
+var DEVICE_COUNT = 20;
+
+function fail(message) {
+	console.error(message);
+	tree.remove();
+	process.exit(1);
+}
+
+for(var i = 0; i < DEVICE_COUNT; i++) {
+	tree.addDevice(1, i + 2, '1-' + (i + 1), '0403', i % 2 ? '6001' : '6015', 'Device ' + i);
+}
+
+var usbDetect = require('../../');
+usbDetect.useInotifyMonitor({
+	sysfsRoot: tree.sysfsRoot,
+	devRoot: tree.devRoot
+});
+usbDetect.publishRegistry(REGISTRY_NAME);
+usbDetect.useSharedRegistry(REGISTRY_NAME);
+
+usbDetect.ready()
+	.then(function() {
+		return Promise.all([usbDetect.find(), usbDetect.find(0x0403, 0x6001)]);
+	})
+	.then(function(results) {
+		if(results[0].length !== DEVICE_COUNT || results[1].length !== DEVICE_COUNT / 2) {
+			fail('Unexpected shared devices: ' + results[0].length + ', ' + results[1].length);
+		}
+
+		// Reading the shared list, there is no local one to reconcile
+		return usbDetect.reconcile().then(function() {
+			fail('reconcile() succeeded with a shared device list');
+		}, function(err) {
+			if(!/shared device list/.test(err.message)) {
+				fail('Unexpected error: ' + err.message);
+			}
+		});
+	})
+	.then(function() {
+		usbDetect.stopPublishingRegistry();
+		return usbDetect.find().then(function() {
+			fail('find() succeeded after the publisher stopped');
+		}, function(err) {
+			if(!/publisher/.test(err.message)) {
+				fail('Unexpected error: ' + err.message);
+			}
+		});
+	})
+	.then(function() {
+		tree.remove();
+	})
+	.catch(function(err) {
+		fail(err);
+	});
@@ -1,3 +1,8 @@
 var usbDetect = require('../../');
 
 usbDetect.startMonitoring();
+
+// Only reached if the signal let the process wind down instead of killing it
+process.on('exit', function() {
+	console.log('exited');
+});
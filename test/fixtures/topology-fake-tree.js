@@ -0,0 +1,89 @@
+// Builds a fake tree with a hub and exits non-zero unless `findUnder()` and
+// `getTopology()` follow its port chains
+var createFakeUsbTree = require('../lib/fake-usb-tree');
+
+var tree = createFakeUsbTree();
+
+function fail(message) {
+	console.error(message);
+	tree.remove();
+	process.exit(1);
+}
+
+function portPaths(devices) {
+	return devices.map(function(device) {
+		return device.portPath;
+	});
+}
+
+// Pre-order port paths of a topology
+function flatten(nodes) {
+	return nodes.reduce(function(paths, node) {
+		return paths.concat([node.portPath + (node.device ? '' : ' (empty)')], flatten(node.children));
+	}, []);
+}
+
+tree.addDevice(1, 1, 'usb1', '1d6b', '0002', 'Root hub');
+tree.addDevice(1, 2, '1-1', '05e3', '0608', 'Hub');
+tree.addDevice(1, 3, '1-1.2', '0403', '6001', 'FT232R');
+tree.addDevice(1, 4, '1-1.4', '2341', '0043', 'Uno');
+tree.addDevice(1, 5, '1-2', '046d', 'c52b', 'Receiver');
+// Behind a hub the tree doesn't know (yet)
+tree.addDevice(1, 6, '1-3.1', '1234', '5678', 'Orphan');
+tree.addDevice(2, 1, 'usb2', '1d6b', '0003', 'Root hub');
+
+var usbDetect = require('../../');
+usbDetect.useInotifyMonitor({
+	sysfsRoot: tree.sysfsRoot,
+	devRoot: tree.devRoot
+});
+
+Promise.all([
+	usbDetect.findUnder('1-1'),
+	usbDetect.findUnder('usb1'),
+	usbDetect.findUnder('2'),
+	usbDetect.findUnder('1-9'),
+	usbDetect.findUnder('1-1.2')
+])
+	.then(function(results) {
+		var expected = [
+			['1-1', '1-1.2', '1-1.4'],
+			['usb1', '1-1', '1-1.2', '1-1.4', '1-2', '1-3.1'],
+			['usb2'],
+			[],
+			['1-1.2']
+		];
+		results.forEach(function(devices, i) {
+			if(JSON.stringify(portPaths(devices)) !== JSON.stringify(expected[i])) {
+				fail('Unexpected findUnder() result ' + i + ': ' + JSON.stringify(portPaths(devices)));
+			}
+		});
+		if(results[0][1].vendorId !== 0x0403 || results[0][1].deviceName !== 'FT232R') {
+			fail('Unexpected device under the hub: ' + JSON.stringify(results[0][1]));
+		}
+
+		return usbDetect.findUnder('not-a-port').then(function() {
+			fail('findUnder() accepted an invalid port path');
+		}, function(err) {
+			if(!/Invalid port path/.test(err.message)) {
+				fail('Unexpected error: ' + err.message);
+			}
+		});
+	})
+	.then(function() {
+		return usbDetect.getTopology();
+	})
+	.then(function(roots) {
+		var expected = ['usb1', '1-1', '1-1.2', '1-1.4', '1-2', '1-3 (empty)', '1-3.1', 'usb2'];
+		if(roots.length !== 2 || JSON.stringify(flatten(roots)) !== JSON.stringify(expected)) {
+			fail('Unexpected topology: ' + JSON.stringify(flatten(roots)));
+		}
+		var hub = roots[0].children[0];
+		if(hub.device.deviceName !== 'Hub' || hub.device.portPath !== '1-1' || hub.children.length !== 2) {
+			fail('Unexpected hub node: ' + JSON.stringify(hub));
+		}
+		tree.remove();
+	})
+	.catch(function(err) {
+		fail(err);
+	});
@@ -0,0 +1,14 @@
+var Worker = require('worker_threads').Worker;
+
+// The worker goes away while its `waitFor` still has a timer pending. Its
+// event loop can only be closed if the timer was closed with it.
+var worker = new Worker(`
+	var parentPort = require('worker_threads').parentPort;
+	var usbDetect = require(${JSON.stringify(require.resolve('../../'))});
+	usbDetect.waitFor({ vendorId: 0xfffe, productId: 0xfffe }, 60000);
+	parentPort.postMessage('waiting');
+`, { eval: true });
+
+worker.on('message', function() {
+	worker.terminate();
+});
@@ -0,0 +1,17 @@
+var Worker = require('worker_threads').Worker;
+
+var usbDetect = require('../../');
+
+usbDetect.startMonitoring();
+
+var worker = new Worker(`
+	var usbDetect = require(${JSON.stringify(require.resolve('../../'))});
+	usbDetect.startMonitoring();
+	usbDetect.find().then(function() {
+		usbDetect.stopMonitoring();
+	});
+`, { eval: true });
+
+worker.on('exit', function() {
+	usbDetect.stopMonitoring();
+});
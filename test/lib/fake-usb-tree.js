@@ -0,0 +1,75 @@
+// A fake /sys and /dev tree for the inotify monitor (`useInotifyMonitor`)
+var fs = require('fs');
+var os = require('os');
+var path = require('path');
+
+module.exports = function() {
+	var root = fs.mkdtempSync(path.join(os.tmpdir(), 'usb-detection-'));
+
+	function deviceDir(portPath) {
+		return path.join(root, 'sys/devices', portPath);
+	}
+
+	return {
+		sysfsRoot: path.join(root, 'sys'),
+		devRoot: path.join(root, 'dev'),
+
+		addDevice: function(bus, address, portPath, vendorId, productId, name) {
+			this.addSysfsDevice(bus, address, portPath, vendorId, productId, name);
+			// The usbfs node last, as devtmpfs does
+			this.addNode(bus, address);
+		},
+
+		// Only the sysfs side of a device; the monitor notices nothing until
+		// its usbfs node appears. Without a `name`, the device has no product
+		// string descriptor.
+		addSysfsDevice: function(bus, address, portPath, vendorId, productId, name) {
+			fs.mkdirSync(deviceDir(portPath), { recursive: true });
+			fs.writeFileSync(path.join(deviceDir(portPath), 'idVendor'), vendorId + '\n');
+			fs.writeFileSync(path.join(deviceDir(portPath), 'idProduct'), productId + '\n');
+			if(name !== undefined) {
+				fs.writeFileSync(path.join(deviceDir(portPath), 'product'), name + '\n');
+			}
+
+			// Same minor the kernel gives the usb_device
+			var charDir = path.join(root, 'sys/dev/char');
+			fs.mkdirSync(charDir, { recursive: true });
+			fs.symlinkSync(deviceDir(portPath), path.join(charDir, '189:' + ((bus - 1) * 128 + address - 1)));
+		},
+
+		addNode: function(bus, address) {
+			var busDir = path.join(root, 'dev/bus/usb', String(bus).padStart(3, '0'));
+			fs.mkdirSync(busDir, { recursive: true });
+			fs.writeFileSync(path.join(busDir, String(address).padStart(3, '0')), '');
+		},
+
+		// Drops a device from sysfs but keeps its usbfs node, so the monitor
+		// sees no event for it
+		removeSysfsDevice: function(portPath) {
+			fs.rmSync(deviceDir(portPath), { recursive: true, force: true });
+		},
+
+		// Changes a sysfs attribute of a device in place; no monitor notices
+		writeAttribute: function(portPath, name, value) {
+			fs.writeFileSync(path.join(deviceDir(portPath), name), value + '\n');
+		},
+
+		// Binds a device to a driver, as far as the `driver` link goes
+		linkDriver: function(portPath, driver) {
+			fs.symlinkSync(path.join(root, 'sys/bus/usb/drivers', driver), path.join(deviceDir(portPath), 'driver'));
+		},
+
+		// Raw descriptors as the kernel exposes them in sysfs
+		writeDescriptors: function(portPath, bytes) {
+			fs.writeFileSync(path.join(deviceDir(portPath), 'descriptors'), Buffer.from(bytes));
+		},
+
+		removeDevice: function(bus, address) {
+			fs.unlinkSync(path.join(root, 'dev/bus/usb', String(bus).padStart(3, '0'), String(address).padStart(3, '0')));
+		},
+
+		remove: function() {
+			fs.rmSync(root, { recursive: true, force: true });
+		}
+	};
+};
@@ -1,3 +1,5 @@
+var fs = require('fs');
+var os = require('os');
 var path = require('path');
 
 var chai = require('chai');
@@ -20,7 +22,8 @@ var DEVICE_OBJECT_FIXTURE = {
 	deviceName: 'Teensy USB Serial (COM3)',
 	manufacturer: 'PJRC.COM, LLC.',
 	serialNumber: '',
-	deviceAddress: 11
+	deviceAddress: 11,
+	handle: 1
 };
 
 function once(eventName) {
@@ -47,6 +50,70 @@ describe('usb-detection', function() {
 			usbDetect.stopMonitoring();
 		});
 
+		describe('`.ready`', function() {
+			it('should resolve and keep resolving', function(done) {
+				usbDetect.ready()
+					.then(function() {
+						return usbDetect.ready();
+					})
+					.then(done)
+					.catch(done.fail);
+			});
+		});
+
+		describe('`.getMetrics`', function() {
+			it('should return Prometheus text', function(done) {
+				usbDetect.find()
+					.then(function() {
+						var text = usbDetect.getMetrics();
+						expect(text).to.match(/^usb_detection_registry_devices [1-9]\d*$/m);
+						expect(text).to.match(/^usb_detection_find_duration_seconds_count [1-9]\d*$/m);
+						expect(text).to.match(/^# TYPE usb_detection_uevents_received_total counter$/m);
+					})
+					.then(done)
+					.catch(done.fail);
+			});
+		});
+
+		describe('`.getMemoryUsage`', function() {
+			it('should account for the device list', function(done) {
+				usbDetect.find()
+					.then(function() {
+						var usage = usbDetect.getMemoryUsage();
+						expect(usage.registry.count).to.be.greaterThan(0);
+						expect(usage.registry.bytes).to.be.greaterThan(0);
+						expect(usage.totalBytes).to.be.at.least(usage.registry.bytes);
+					})
+					.then(done)
+					.catch(done.fail);
+			});
+		});
+
+		describe('`.waitFor`', function() {
+			it('should resolve with a device that is already attached', function(done) {
+				usbDetect.find()
+					.then(function(devices) {
+						return usbDetect.waitFor({ vendorId: devices[0].vendorId, productId: devices[0].productId }, 1000);
+					})
+					.then(function(device) {
+						testDeviceShape(device);
+					})
+					.then(done)
+					.catch(done.fail);
+			});
+
+			it('should reject on timeout', function(done) {
+				usbDetect.waitFor({ vendorId: 0xffff, productId: 0xffff, serialNumber: 'no-such-device' }, 50)
+					.then(function() {
+						done.fail(new Error('Expected waitFor to time out'));
+					})
+					.catch(function(err) {
+						expect(err.message).to.equal('Timed out waiting for device');
+						done();
+					});
+			});
+		});
+
 		describe('`.find`', function() {
 			var testArrayOfDevicesShape = function(devices) {
 				expect(devices.length).to.be.greaterThan(0);
@@ -106,6 +173,174 @@ describe('usb-detection', function() {
 					.then(done)
 					.catch(done.fail);
 			});
+
+			it('should match `.findSync`', function(done) {
+				usbDetect.find()
+					.then(function(devices) {
+						const devicesFromTestedFunction = usbDetect.findSync();
+						testArrayOfDevicesShape(devicesFromTestedFunction);
+						expect(devicesFromTestedFunction.length).to.equal(devices.length);
+						// Cached results are marshalled per call
+						expect(devicesFromTestedFunction[0]).to.not.equal(devices[0]);
+					})
+					.then(done)
+					.catch(done.fail);
+			});
+
+			it('`.getDevice` should return the device with a handle', function(done) {
+				usbDetect.find()
+					.then(function(devices) {
+						expect(devices[0].handle).to.be.greaterThan(0);
+						testDeviceShape(usbDetect.getDevice(devices[0].handle));
+						expect(usbDetect.getDevice(0)).to.equal(null);
+					})
+					.then(done)
+					.catch(done.fail);
+			});
+
+			it('`.findByNode` should resolve null for an unknown node', function(done) {
+				usbDetect.findByNode('/dev/usb-detection-test-no-such-node')
+					.then(function(device) {
+						expect(device).to.equal(null);
+					})
+					.then(done)
+					.catch(done.fail);
+			});
+		});
+
+		describe('`.setCacheFile`', function() {
+			// CacheHeader_t in deviceCache.cpp
+			var CACHE_MAGIC = 'USBD';
+			var CACHE_VERSION_OFFSET = 4;
+
+			var directory;
+			var cacheFile;
+
+			// Devices of one process, comparable with another's
+			function findWithCacheFile() {
+				return commandRunner(`node ${path.join(__dirname, './fixtures/cache-file-find.js')} ${cacheFile}`)
+					.then(function(resultInfo) {
+						return JSON.parse(resultInfo.stdout).map(function(device) {
+							return device.locationId + '/' + device.deviceAddress + ' ' + device.vendorId + ':' + device.productId + ' ' + device.deviceName;
+						}).sort();
+					});
+			}
+
+			function isCacheSupported() {
+				// Snapshots are only validated against usbfs
+				return process.platform === 'linux' && fs.existsSync('/dev/bus/usb');
+			}
+
+			beforeEach(function() {
+				directory = fs.mkdtempSync(path.join(os.tmpdir(), 'usb-detection-cache-'));
+				cacheFile = path.join(directory, 'devices.cache');
+			});
+
+			afterEach(function() {
+				fs.readdirSync(directory).forEach(function(name) {
+					fs.unlinkSync(path.join(directory, name));
+				});
+				fs.rmdirSync(directory);
+			});
+
+			it('should find the same devices on a warm start', function(done) {
+				if(!isCacheSupported()) {
+					done();
+					return;
+				}
+				var coldDevices;
+				findWithCacheFile()
+					.then(function(devices) {
+						coldDevices = devices;
+						expect(fs.readFileSync(cacheFile).toString('latin1', 0, 4)).to.equal(CACHE_MAGIC);
+						return findWithCacheFile();
+					})
+					.then(function(warmDevices) {
+						expect(warmDevices).to.deep.equal(coldDevices);
+					})
+					.then(done)
+					.catch(done.fail);
+			});
+
+			it('should rebuild from a corrupt file', function(done) {
+				if(!isCacheSupported()) {
+					done();
+					return;
+				}
+				var coldDevices;
+				findWithCacheFile()
+					.then(function(devices) {
+						coldDevices = devices;
+						var snapshot = fs.readFileSync(cacheFile);
+						// Cut off mid-item
+						fs.writeFileSync(cacheFile, snapshot.subarray(0, snapshot.length - 3));
+						return findWithCacheFile();
+					})
+					.then(function(devices) {
+						expect(devices).to.deep.equal(coldDevices);
+						fs.writeFileSync(cacheFile, 'not a snapshot');
+						return findWithCacheFile();
+					})
+					.then(function(devices) {
+						expect(devices).to.deep.equal(coldDevices);
+						// Replaced by a good one
+						expect(fs.readFileSync(cacheFile).toString('latin1', 0, 4)).to.equal(CACHE_MAGIC);
+					})
+					.then(done)
+					.catch(done.fail);
+			});
+
+			it('should rebuild from a snapshot of another version', function(done) {
+				if(!isCacheSupported()) {
+					done();
+					return;
+				}
+				var coldDevices;
+				var version;
+				findWithCacheFile()
+					.then(function(devices) {
+						coldDevices = devices;
+						var snapshot = fs.readFileSync(cacheFile);
+						version = snapshot.readUInt16LE(CACHE_VERSION_OFFSET);
+						snapshot.writeUInt16LE(version + 1, CACHE_VERSION_OFFSET);
+						fs.writeFileSync(cacheFile, snapshot);
+						return findWithCacheFile();
+					})
+					.then(function(devices) {
+						expect(devices).to.deep.equal(coldDevices);
+						expect(fs.readFileSync(cacheFile).readUInt16LE(CACHE_VERSION_OFFSET)).to.equal(version);
+					})
+					.then(done)
+					.catch(done.fail);
+			});
+		});
+
+		describe('Unchanged devices', function() {
+			it('should not emit anything for a `change` uevent with identical sysfs', function(done) {
+				// Replaying uevents needs root; the enumerated devices are the fixture
+				if(process.platform !== 'linux' || process.getuid() !== 0) {
+					done();
+					return;
+				}
+				var events = [];
+				function record(event, device) {
+					events.push(event + ' ' + JSON.stringify(device));
+				}
+				usbDetect.find()
+					.then(function() {
+						usbDetect.onAny(record);
+						return commandRunner('udevadm trigger --action=change --subsystem-match=usb --property-match=DEVTYPE=usb_device --settle');
+					})
+					.then(function() {
+						return getSetTimeoutPromise(500);
+					})
+					.then(function() {
+						usbDetect.offAny(record);
+						expect(events).to.deep.equal([]);
+					})
+					.then(done)
+					.catch(done.fail);
+			});
 		});
 
 		describe('Events `.on`', function() {
@@ -138,6 +373,48 @@ describe('usb-detection', function() {
 					.then(done)
 					.catch(done.fail);
 			}, MANUAL_INTERACTION_TIMEOUT);
+
+			it('should report child nodes as a device change', function(done) {
+				if(process.platform !== 'linux') {
+					done();
+					return;
+				}
+				console.log(chalk.black.bgCyan('Add/Insert or Remove a USB serial adapter'));
+				new Promise(function(resolve) {
+					usbDetect.on('change', function(device, changedFields) {
+						if(changedFields & usbDetect.fieldBits.nodes) {
+							resolve(device);
+						}
+					});
+				})
+					.then(function(device) {
+						testDeviceShape(device);
+					})
+					.then(done)
+					.catch(done.fail);
+			}, MANUAL_INTERACTION_TIMEOUT);
+		});
+
+		describe('`.events`', function() {
+			it('should yield device events', function(done) {
+				console.log(chalk.black.bgCyan('Add/Insert or Remove a USB device'));
+				var iterator = usbDetect.events();
+				iterator.next()
+					.then(function(result) {
+						expect(result.done).to.equal(false);
+						expect(result.value.type).to.be.oneOf(['add', 'remove', 'change']);
+						testDeviceShape(result.value.device);
+						return iterator.return();
+					})
+					.then(function() {
+						return iterator.next();
+					})
+					.then(function(result) {
+						expect(result.done).to.equal(true);
+					})
+					.then(done)
+					.catch(done.fail);
+			}, MANUAL_INTERACTION_TIMEOUT);
 		});
 	});
 
@@ -150,6 +427,14 @@ describe('usb-detection', function() {
 				});
 		});
 
+		it('when requiring with background init enabled', (done) => {
+			commandRunner(`node ${path.join(__dirname, './fixtures/background-init-exit-gracefully.js')}`)
+				.then(done)
+				.catch((resultInfo) => {
+					done.fail(resultInfo.err);
+				});
+		});
+
 		it('after `startMonitoring` then `stopMonitoring`', (done) => {
 			commandRunner(`node ${path.join(__dirname, './fixtures/start-stop-monitoring-exit-gracefully.js')}`)
 				.then(done)
@@ -166,10 +451,175 @@ describe('usb-detection', function() {
 				});
 		});
 
+		it('after restarting monitoring', (done) => {
+			commandRunner(`node ${path.join(__dirname, './fixtures/restart-monitoring-exit-gracefully.js')}`)
+				.then(done)
+				.catch((resultInfo) => {
+					done.fail(resultInfo.err);
+				});
+		});
+
+		it('after changing monitor options while monitoring', (done) => {
+			commandRunner(`node ${path.join(__dirname, './fixtures/monitor-options-while-monitoring-exit-gracefully.js')}`)
+				.then(done)
+				.catch((resultInfo) => {
+					done.fail(resultInfo.err);
+				});
+		});
+
+		it('after monitoring from the main thread and a worker thread', (done) => {
+			commandRunner(`node ${path.join(__dirname, './fixtures/worker-threads-exit-gracefully.js')}`)
+				.then(done)
+				.catch((resultInfo) => {
+					done.fail(resultInfo.err);
+				});
+		});
+
+		it('after terminating a worker thread with a pending `waitFor`', (done) => {
+			commandRunner(`node ${path.join(__dirname, './fixtures/wait-for-in-terminated-worker-exit-gracefully.js')}`)
+				.then(done)
+				.catch((resultInfo) => {
+					done.fail(resultInfo.err);
+				});
+		});
+
+		it('after closing an `events` iterator', (done) => {
+			commandRunner(`node ${path.join(__dirname, './fixtures/events-iterator-exit-gracefully.js')}`)
+				.then(done)
+				.catch((resultInfo) => {
+					done.fail(resultInfo.err);
+				});
+		});
+
+		it('after watching a fake tree with the inotify monitor', (done) => {
+			if(process.platform !== 'linux') {
+				done();
+				return;
+			}
+			commandRunner(`node ${path.join(__dirname, './fixtures/inotify-fake-tree.js')}`)
+				.then(done)
+				.catch((resultInfo) => {
+					done.fail(resultInfo.err);
+				});
+		});
+
+		it('after filtering a fake tree larger than the column threshold', (done) => {
+			if(process.platform !== 'linux') {
+				done();
+				return;
+			}
+			commandRunner(`node ${path.join(__dirname, './fixtures/column-filter-fake-tree.js')}`)
+				.then(done)
+				.catch((resultInfo) => {
+					done.fail(resultInfo.err);
+				});
+		});
+
+		it('after parsing malformed descriptors in a fake tree', (done) => {
+			if(process.platform !== 'linux') {
+				done();
+				return;
+			}
+			commandRunner(`node ${path.join(__dirname, './fixtures/interface-descriptors-fake-tree.js')}`)
+				.then(done)
+				.catch((resultInfo) => {
+					done.fail(resultInfo.err);
+				});
+		});
+
+		it('after relaying a fake tree through an event hub', (done) => {
+			if(process.platform !== 'linux') {
+				done();
+				return;
+			}
+			commandRunner(`node ${path.join(__dirname, './fixtures/event-hub-fake-tree.js')}`)
+				.then(done)
+				.catch((resultInfo) => {
+					done.fail(resultInfo.err);
+				});
+		});
+
+		it('after reading a fake tree through the shared device list', (done) => {
+			if(process.platform !== 'linux') {
+				done();
+				return;
+			}
+			commandRunner(`node ${path.join(__dirname, './fixtures/shared-registry-fake-tree.js')}`)
+				.then(done)
+				.catch((resultInfo) => {
+					done.fail(resultInfo.err);
+				});
+		});
+
+		it('after walking the topology of a fake tree', (done) => {
+			if(process.platform !== 'linux') {
+				done();
+				return;
+			}
+			commandRunner(`node ${path.join(__dirname, './fixtures/topology-fake-tree.js')}`)
+				.then(done)
+				.catch((resultInfo) => {
+					done.fail(resultInfo.err);
+				});
+		});
+
+		it('after pausing and resuming events from a fake tree', (done) => {
+			if(process.platform !== 'linux') {
+				done();
+				return;
+			}
+			commandRunner(`node ${path.join(__dirname, './fixtures/pause-fake-tree.js')}`)
+				.then(done)
+				.catch((resultInfo) => {
+					done.fail(resultInfo.err);
+				});
+		});
+
+		it('after reconciling a fake tree changed behind the monitor', (done) => {
+			if(process.platform !== 'linux') {
+				done();
+				return;
+			}
+			commandRunner(`node ${path.join(__dirname, './fixtures/reconcile-fake-tree.js')}`)
+				.then(done)
+				.catch((resultInfo) => {
+					done.fail(resultInfo.err);
+				});
+		});
+
+		it('after reading only the requested extra fields of a fake tree', (done) => {
+			if(process.platform !== 'linux') {
+				done();
+				return;
+			}
+			commandRunner(`node ${path.join(__dirname, './fixtures/extra-fields-fake-tree.js')}`)
+				.then(done)
+				.catch((resultInfo) => {
+					done.fail(resultInfo.err);
+				});
+		});
+
+		it('after resolving names of a fake tree only when asked to', (done) => {
+			if(process.platform !== 'linux') {
+				done();
+				return;
+			}
+			commandRunner(`node ${path.join(__dirname, './fixtures/resolve-names-fake-tree.js')}`)
+				.then(done)
+				.catch((resultInfo) => {
+					done.fail(resultInfo.err);
+				});
+		});
+
 		it('when SIGINT (Ctrl + c) after `startMonitoring`', (done) => {
 			const executor = new ChildExecutor();
 
 			executor.exec(`node ${path.join(__dirname, './fixtures/sigint-after-start-monitoring-exit-gracefully.js')}`)
+				.then((resultInfo) => {
+					if(process.platform === 'linux') {
+						expect(resultInfo.stdout).to.contain('exited');
+					}
+				})
 				.then(done)
 				.catch((resultInfo) => {
 					done.fail(resultInfo.err);